@@ -0,0 +1,132 @@
+// Measures the throughput of the lexer's word scanner on generated, comment heavy source text
+// and checks that the vectorized scanner finds the same words as the byte by byte one.
+//
+// Build and run from the root of the repository:
+//     cc -O2 bench/lexer_bench.c -o lexer_bench && ./lexer_bench
+//     cl /nologo /O2 /arch:AVX2 bench\lexer_bench.c && lexer_bench.exe
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/lexer.h"
+
+#define BENCH_SIZE (256 * 1024 * 1024)
+#define BENCH_RUNS 5
+
+struct Scan_result
+{
+    long words;
+    long checksum;
+};
+
+char *generate_source(size_t size)
+{
+    static const char *lines[] = {
+        "# This comment explains the next few lines of generated code in far too much detail.\n",
+        "var counter_%d int + counter 1          # keep track of how often we went around\n",
+        "while > 1000 i do                       # loop until we reach the limit\n",
+        "    set sum + sum % i 3\n",
+        "\n",
+        "    # A nested comment that is indented and pretty long, like the ones a generator writes.\n",
+        "end\n",
+    };
+    int line_count = sizeof(lines) / sizeof(lines[0]);
+
+    char *text = malloc(size);
+    if (text == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+
+    size_t length = 0;
+    for (int i = 0;; i++)
+    {
+        char line[256];
+        int line_length = snprintf(line, sizeof(line), lines[i % line_count], i);
+        if (length + line_length > size)
+            break;
+        memcpy(text + length, line, line_length);
+        length += line_length;
+    }
+    memset(text + length, ' ', size - length);
+    return text;
+}
+
+double now(void)
+{
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+struct Scan_result scan(struct Source_file *source, bool (*next_word)(struct Source_file *, struct FileIterator *))
+{
+    struct Scan_result result = {0};
+    struct FileIterator iter = {0};
+    while (next_word(source, &iter))
+    {
+        result.words++;
+        result.checksum += iter.start * 31 + iter.length;
+    }
+    return result;
+}
+
+struct Scan_result bench(char *name, struct Source_file *source, bool (*next_word)(struct Source_file *, struct FileIterator *))
+{
+    struct Scan_result result;
+    double best = 1e9;
+    for (int i = 0; i < BENCH_RUNS; i++)
+    {
+        double start = now();
+        result = scan(source, next_word);
+        double elapsed = now() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    printf("%-8s: %8.1f ms  %6.2f GB/s  (%ld words)\n",
+           name, best * 1e3, source->length / best / 1e9, result.words);
+    return result;
+}
+
+int main(void)
+{
+    struct Source_file source = {
+        .filename = "generated",
+        .text = generate_source(BENCH_SIZE),
+        .length = BENCH_SIZE,
+    };
+
+    struct Scan_result scalar = bench("scalar", &source, find_next_word_scalar);
+    bool matches = true;
+#if defined(LEXER_VECTORIZED)
+    Lexer_select_scanner();
+    bool has_avx2 = lexer_use_avx2;
+    lexer_use_avx2 = false;
+    struct Scan_result sse2 = bench("sse2", &source, find_next_word);
+    matches = scalar.words == sse2.words && scalar.checksum == sse2.checksum;
+    if (has_avx2)
+    {
+        lexer_use_avx2 = true;
+        struct Scan_result avx2 = bench("avx2", &source, find_next_word);
+        matches = matches && scalar.words == avx2.words && scalar.checksum == avx2.checksum;
+    }
+    else
+        printf("The CPU has no AVX2.\n");
+#else
+    printf("No vector instructions available, only the scalar scanner runs.\n");
+#endif
+
+    free(source.text);
+    if (!matches)
+    {
+        fprintf(stderr, "ERROR: The vector scanner does not match the scalar scanner.\n");
+        return 1;
+    }
+    return 0;
+}
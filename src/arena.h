@@ -0,0 +1,76 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct Arena_block
+{
+    struct Arena_block *previous;
+    size_t used;
+    size_t capacity;
+    _Alignas(ARENA_ALIGNMENT) char data[];
+};
+
+// A bump allocator. Everything allocated from an arena is released at once by 'Arena_free'.
+struct Arena
+{
+    struct Arena_block *current;
+};
+
+void Arena_init(struct Arena *arena)
+{
+    arena->current = NULL;
+}
+
+void *Arena_alloc(struct Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    struct Arena_block *block = arena->current;
+    if (block == NULL || block->capacity - block->used < size)
+    {
+        size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(struct Arena_block) + capacity);
+        if (block == NULL)
+        {
+            fprintf(stderr, "ERROR: Arena allocation error.\n");
+            exit(1);
+        }
+        block->used = 0;
+        block->capacity = capacity;
+        // Oversized allocations get a block of their own and the partly used block stays current.
+        if (arena->current != NULL && capacity > ARENA_BLOCK_SIZE)
+        {
+            block->previous = arena->current->previous;
+            arena->current->previous = block;
+        }
+        else
+        {
+            block->previous = arena->current;
+            arena->current = block;
+        }
+    }
+
+    void *memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+void Arena_free(struct Arena *arena)
+{
+    struct Arena_block *block = arena->current;
+    while (block != NULL)
+    {
+        struct Arena_block *previous = block->previous;
+        free(block);
+        block = previous;
+    }
+    arena->current = NULL;
+}
+
+#endif
@@ -1,83 +1,132 @@
 #ifndef ARRAY_H
 #define ARRAY_H
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-struct Array
-{
-    char *data;
-    int length;
-    int capacity;
-    int element_size;
-};
+#include "arena.h"
+
+// Growable arrays of one element type. 'Vec_declare(Name, Type)' declares the type 'Vec(Name)'
+// and 'Vec_define(Name, Type)' its functions 'Vec_Name_init', 'Vec_Name_add' and so on. The two
+// are apart so a type can hold a vector of itself. Elements are copied as values of their type
+// and every function is inline, so the hot loops compile to plain loads and stores.
+//
+// 'get', 'top' and 'pop' check their index unless NDEBUG is defined. The pointers they return
+// are only good until the next 'add', which can move the elements.
+#define Vec(Name) struct Vec_##Name
+
+#define Vec_declare(Name, Type) \
+    struct Vec_##Name           \
+    {                           \
+        Type *data;             \
+        int length;             \
+        int capacity;           \
+        struct Arena *arena;    \
+    }
+
+#ifdef NDEBUG
+#define Vec_check(condition, ...)
+#else
+#define Vec_check(condition, ...)         \
+    if (!(condition))                     \
+    {                                     \
+        fprintf(stderr, __VA_ARGS__);     \
+        exit(1);                          \
+    }
+#endif
+
+// Vectors start with room for this many elements.
+#define VEC_INITIAL_CAPACITY 8
 
-void Array_init(struct Array *array, int element_size)
+// Allocates the elements of a vector, in 'arena' when it is not NULL.
+void *Vec_allocate(struct Arena *arena, size_t size)
 {
-    char *data = malloc(element_size * 8);
+    void *data = arena != NULL ? Arena_alloc(arena, size) : malloc(size);
     if (data == NULL)
     {
         fprintf(stderr, "ERROR: Array allocation error.\n");
         exit(1);
     }
-    array->data = data;
-    array->length = 0;
-    array->capacity = 8;
-    array->element_size = element_size;
+    return data;
 }
 
-void Array_free(struct Array *array)
+// Doubles the room of a full vector. Vectors in an arena move to a new allocation in it, the old
+// one is freed with the arena.
+void *Vec_grow(void *data, int *capacity, size_t element_size, struct Arena *arena)
 {
-    free(array->data);
-}
-
-void Array_add(struct Array *array, void *thing)
-{
-    if (array->length == array->capacity)
+    size_t size = element_size * (size_t)*capacity;
+    void *grown;
+    if (arena != NULL)
     {
-        char *data = realloc(array->data, array->element_size * array->capacity * 2);
-        if (data == NULL)
+        grown = Vec_allocate(arena, size * 2);
+        memcpy(grown, data, size);
+    }
+    else
+    {
+        grown = realloc(data, size * 2);
+        if (grown == NULL)
         {
             fprintf(stderr, "ERROR: Array allocation error.\n");
             exit(1);
         }
-        array->data = data;
-        array->capacity = array->capacity * 2;
     }
-    memcpy(array->data + array->length * array->element_size, thing, array->element_size);
-    array->length++;
+    *capacity *= 2;
+    return grown;
 }
 
-void *Array_pop(struct Array *array)
-{
-    if (array->length == 0)
-    {
-        fprintf(stderr, "ERROR: Array is empty\n");
-        exit(1);
+#define Vec_define(Name, Type)                                                                                         \
+    static inline void Vec_##Name##_init(Vec(Name) * vec)                                                              \
+    {                                                                                                                  \
+        vec->data = Vec_allocate(NULL, sizeof(Type) * VEC_INITIAL_CAPACITY);                                           \
+        vec->length = 0;                                                                                               \
+        vec->capacity = VEC_INITIAL_CAPACITY;                                                                          \
+        vec->arena = NULL;                                                                                             \
+    }                                                                                                                  \
+                                                                                                                       \
+    /* Vectors in an arena grow inside of it and are never freed on their own. */                                     \
+    static inline void Vec_##Name##_init_arena(Vec(Name) * vec, struct Arena *arena)                                   \
+    {                                                                                                                  \
+        vec->data = Vec_allocate(arena, sizeof(Type) * VEC_INITIAL_CAPACITY);                                          \
+        vec->length = 0;                                                                                               \
+        vec->capacity = VEC_INITIAL_CAPACITY;                                                                          \
+        vec->arena = arena;                                                                                            \
+    }                                                                                                                  \
+                                                                                                                       \
+    static inline void Vec_##Name##_free(Vec(Name) * vec)                                                              \
+    {                                                                                                                  \
+        if (vec->arena == NULL)                                                                                        \
+            free(vec->data);                                                                                           \
+    }                                                                                                                  \
+                                                                                                                       \
+    static inline void Vec_##Name##_add(Vec(Name) * vec, Type element)                                                 \
+    {                                                                                                                  \
+        if (vec->length == vec->capacity)                                                                              \
+            vec->data = Vec_grow(vec->data, &vec->capacity, sizeof(Type), vec->arena);                                 \
+        vec->data[vec->length++] = element;                                                                            \
+    }                                                                                                                  \
+                                                                                                                       \
+    static inline Type *Vec_##Name##_get(Vec(Name) * vec, int index)                                                   \
+    {                                                                                                                  \
+        Vec_check(index >= 0 && index < vec->length,                                                                   \
+                  "ERROR: Array index out of range. Index: %d, Range: %d\n", index, vec->length - 1);                  \
+        return &vec->data[index];                                                                                      \
+    }                                                                                                                  \
+                                                                                                                       \
+    static inline Type *Vec_##Name##_top(Vec(Name) * vec)                                                              \
+    {                                                                                                                  \
+        Vec_check(vec->length > 0, "ERROR: Array is empty\n");                                                        \
+        return &vec->data[vec->length - 1];                                                                            \
+    }                                                                                                                  \
+                                                                                                                       \
+    static inline Type Vec_##Name##_pop(Vec(Name) * vec)                                                               \
+    {                                                                                                                  \
+        Vec_check(vec->length > 0, "ERROR: Array is empty\n");                                                        \
+        return vec->data[--vec->length];                                                                               \
     }
-    array->length--;
-    return &array->data[array->length * array->element_size];
-}
 
-void *Array_get(struct Array *array, int index)
-{
-    if (index >= array->length)
-    {
-        fprintf(stderr, "ERROR: Array index out of range. Index: %d, Range: %d\n", index, array->length - 1);
-        exit(1);
-    }
-    return &array->data[index * array->element_size];
-}
-
-void *Array_top(struct Array *array)
-{
-    if (array->length == 0)
-    {
-        fprintf(stderr, "ERROR: Array is empty\n");
-        exit(1);
-    }
-    return &array->data[(array->length - 1) * array->element_size];
-}
+Vec_declare(int, int);
+Vec_define(int, int)
 
-#endif
\ No newline at end of file
+#endif
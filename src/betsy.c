@@ -1,3 +1,8 @@
+#ifdef __linux__
+// Exposes mmap, madvise and friends when compiling with a strict -std.
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -7,551 +12,546 @@
 #include <stdint.h>
 
 #include "operation.h"
+#include "arena.h"
 #include "array.h"
-#include "iterator.h"
 #include "expression.h"
 #include "statement.h"
+#include "symbolTable.h"
+#include "intern.h"
+#include "sourceFile.h"
+#include "stringView.h"
+#include "tokenStream.h"
+#include "lexer.h"
+#include "optimize.h"
+#include "cfg.h"
+#include "ir.h"
+#include "evaluation.h"
 
 #include "simulation.h"
 #include "compilation.h"
-
-#define com_error(location, ...)                                                                 \
-    {                                                                                            \
-        fprintf(stderr, "%s:%d:%d ERROR: ", location.filename, location.line, location.collumn); \
-        fprintf(stderr, __VA_ARGS__);                                                            \
-        exit(1);                                                                                 \
+#include "build.h"
+#include "image.h"
+#include "native.h"
+#include "jit.h"
+
+#define com_error(location, ...)                                                                                   \
+    {                                                                                                              \
+        struct Location error_location = (location);                                                               \
+        fprintf(stderr, "%s:%d:%d ERROR: ", error_location.filename, error_location.line, error_location.collumn); \
+        fprintf(stderr, __VA_ARGS__);                                                                              \
+        exit(1);                                                                                                   \
     }
 
-#define fprintf_i(file, indent, ...)       \
-    fprintf(file, "%*s", indent * 4, " "); \
+#define fprintf_i(file, indent, ...)                                                                 \
+    fprintf(file, "%*s", ((indent) < COMPILE_MAX_INDENT ? (indent) : COMPILE_MAX_INDENT) * 4, " "); \
     fprintf(file, __VA_ARGS__);
 
-char *read_entire_file(char *filename)
+// Programs are parsed with stacks of their own instead of the C stack, so machine generated
+// programs can nest thousands of levels deep. Nesting deeper than this is an error.
+#define PARSE_MAX_DEPTH 1000000
+
+// An intrinsic whose operands are still being parsed.
+struct Parse_intrinsic
 {
-    FILE *input;
-    if (fopen_s(&input, filename, "rb"))
-    {
-        fprintf(stderr, "ERROR: File '%s' cannot be opened.\n", filename);
-        exit(0);
-    }
+    struct Operation op;
+    // The number of outputs of the expression in front of the first operand.
+    int prev_output_count;
+    int missing_operands;
+};
 
-    fseek(input, 0, SEEK_END);
-    long file_size = ftell(input);
-    rewind(input);
+Vec_declare(Parse_intrinsic, struct Parse_intrinsic);
+Vec_define(Parse_intrinsic, struct Parse_intrinsic)
 
-    char *file_text = malloc(file_size + 1);
-    fread(file_text, 1, file_size, input);
-    file_text[file_size] = 0;
-    fclose(input);
+// A statement whose nested statements are still being parsed. 'op' is the keyword the statement
+// starts with. For a 'do' block 'next' is the start of the statement that is parsed next.
+struct Parse_frame
+{
+    struct Statement statement;
+    struct Operation op;
+    struct Operation next;
+    int scope;
+};
 
-    return file_text;
-}
+Vec_declare(Parse_frame, struct Parse_frame);
+Vec_define(Parse_frame, struct Parse_frame)
 
-struct FileIterator
+struct Parser
 {
-    int start;
-    int length;
-    int line;
-    int line_collumn_start;
+    struct Token_source *tokens;
+    struct Symbol_table symbols;
+    struct Arena *arena;
+    int max_depth;
+    Vec(Parse_intrinsic) intrinsics;
+    Vec(Parse_frame) frames;
 };
 
-bool find_next_word(char *file_text, struct FileIterator *iter)
+// Type checks the intrinsic once all of its operands were parsed and adds it to the expression.
+void parse_intrinsic(struct Expression *exp, struct Source_file *source, struct Parse_intrinsic *intrinsic)
 {
-    int pos = iter->start + iter->length;
-    // find start of the next word
-    while (1)
+    struct Operation *op = &intrinsic->op;
+    _Static_assert(INTRINSIC_TYPE_COUNT == 7, "Exhaustive handling of intrinsic types");
+    switch (op->intrinsic.type)
     {
-        if (file_text[pos] == 0)
+    case INTRINSIC_TYPE_PRINT:
+        if (exp->outputs.length - intrinsic->prev_output_count != 1)
+            com_error(Token_location(source, op), "The 'print' intrinsic takes 1 input but %d were provided.\n", exp->outputs.length);
+        enum Type_info print_i = Vec_Type_info_pop(&exp->outputs);
+        if (print_i == TYPE_INFO_INT || print_i == TYPE_INFO_BOOL)
+            Vec_Operation_add(&exp->operations, *op);
+        else
+            com_error(Token_location(source, op), "Cannot print values of type '%s'.\n", Type_info_name(print_i));
+
+        break;
+    case INTRINSIC_TYPE_PLUS:
+        if (exp->outputs.length - intrinsic->prev_output_count != 2)
+            com_error(Token_location(source, op), "The 'plus' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
+        enum Type_info plus_r = Vec_Type_info_pop(&exp->outputs);
+        enum Type_info plus_l = Vec_Type_info_pop(&exp->outputs);
+        if (plus_r == TYPE_INFO_INT && plus_r == plus_l)
         {
-            return false;
+            Vec_Operation_add(&exp->operations, *op);
+            Vec_Type_info_add(&exp->outputs, plus_r);
         }
-        else if (file_text[pos] == '#')
+        else
+            com_error(Token_location(source, op), "Cannot add values of type '%s' and '%s'.\n", Type_info_name(plus_l), Type_info_name(plus_r));
+        break;
+    case INTRINSIC_TYPE_MINUS:
+        if (exp->outputs.length - intrinsic->prev_output_count != 2)
+            com_error(Token_location(source, op), "The 'minus' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
+        enum Type_info minus_r = Vec_Type_info_pop(&exp->outputs);
+        enum Type_info minus_l = Vec_Type_info_pop(&exp->outputs);
+        if (minus_r == TYPE_INFO_INT && minus_r == minus_l)
         {
-            while (file_text[pos] != 0 && file_text[pos] != '\n')
-                pos++;
-            pos--;
+            Vec_Operation_add(&exp->operations, *op);
+            Vec_Type_info_add(&exp->outputs, minus_r);
         }
-        else if (isgraph(file_text[pos]))
+        else
+            com_error(Token_location(source, op), "Cannot subtract values of type '%s' and '%s'.\n", Type_info_name(minus_l), Type_info_name(minus_r));
+        break;
+    case INTRINSIC_TYPE_GT:
+        if (exp->outputs.length - intrinsic->prev_output_count != 2)
+            com_error(Token_location(source, op), "The 'greater than' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
+        enum Type_info gt_r = Vec_Type_info_pop(&exp->outputs);
+        enum Type_info gt_l = Vec_Type_info_pop(&exp->outputs);
+        if (gt_r == TYPE_INFO_INT && gt_r == gt_l)
         {
-            iter->start = pos;
-            break;
+            Vec_Operation_add(&exp->operations, *op);
+            Vec_Type_info_add(&exp->outputs, TYPE_INFO_BOOL);
         }
-        else if (file_text[pos] == '\n')
+        else
+            com_error(Token_location(source, op), "Cannot compare values of type '%s' and '%s'.\n", Type_info_name(gt_l), Type_info_name(gt_r));
+        break;
+    case INTRINSIC_TYPE_MODULO:
+        if (exp->outputs.length - intrinsic->prev_output_count != 2)
+            com_error(Token_location(source, op), "The 'modulo' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
+        enum Type_info modulo_r = Vec_Type_info_pop(&exp->outputs);
+        enum Type_info modulo_l = Vec_Type_info_pop(&exp->outputs);
+        if (modulo_r == TYPE_INFO_INT && modulo_r == modulo_l)
         {
-            iter->line++;
-            iter->line_collumn_start = pos + 1;
+            Vec_Operation_add(&exp->operations, *op);
+            Vec_Type_info_add(&exp->outputs, modulo_r);
         }
-        pos++;
-    }
-
-    // find end of the current word
-    while (isgraph(file_text[pos]))
-        pos++;
-    iter->length = pos - iter->start;
-    return true;
-}
-
-bool tryParseInteger(char *word, int32_t *out)
-{
-    int32_t i = 0;
-    int32_t sign = 1;
-    if (word[0] == '-')
-    {
-        sign = -1;
-        i++;
-    }
-    int32_t value = 0;
-    for (; word[i] != 0; i++)
-    {
-        if (word[i] == '_')
-            continue;
-
-        if (word[i] < '0' || word[i] > '9')
+        else
+            com_error(Token_location(source, op), "Cannot 'modulo' combine values of type '%s' and '%s'.\n", Type_info_name(modulo_l), Type_info_name(modulo_r));
+        break;
+    case INTRINSIC_TYPE_EQUAL:
+        if (exp->outputs.length - intrinsic->prev_output_count != 2)
+            com_error(Token_location(source, op), "The 'equal' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
+        enum Type_info equal_r = Vec_Type_info_pop(&exp->outputs);
+        enum Type_info equal_l = Vec_Type_info_pop(&exp->outputs);
+        if (equal_r == TYPE_INFO_INT && equal_r == equal_l)
         {
-            return false;
+            Vec_Operation_add(&exp->operations, *op);
+            Vec_Type_info_add(&exp->outputs, TYPE_INFO_BOOL);
         }
-        // Test overflow
-        int8_t unit = word[i] - '0';
-        if (value > INT32_MAX / 10 - unit)
-            return false; // TODO: Give error message?
-        value = value * 10 + unit;
+        else
+            com_error(Token_location(source, op), "Cannot compare values of type '%s' and '%s'.\n", Type_info_name(equal_l), Type_info_name(equal_r));
+        break;
+    case INTRINSIC_TYPE_OR:
+        if (exp->outputs.length - intrinsic->prev_output_count != 2)
+            com_error(Token_location(source, op), "The 'or' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
+        enum Type_info or_r = Vec_Type_info_pop(&exp->outputs);
+        enum Type_info or_l = Vec_Type_info_pop(&exp->outputs);
+        if (or_r == TYPE_INFO_BOOL && or_r == or_l)
+        {
+            Vec_Operation_add(&exp->operations, *op);
+            Vec_Type_info_add(&exp->outputs, TYPE_INFO_BOOL);
+        }
+        else
+            com_error(Token_location(source, op), "Cannot 'or' combine values of type '%s' and '%s'.\n", Type_info_name(or_l), Type_info_name(or_r));
+        break;
+    default:
+        com_error(Token_location(source, op), "Intrinsic type '%d' is not implemented yet in 'parse_expression'.\n", op->intrinsic.type);
     }
-    *out = value * sign;
-    return true;
 }
 
-void parse_file(struct Array *operations, char *filename)
+void parse_expression(struct Parser *parser, struct Expression *exp)
 {
-    char *file_text = read_entire_file(filename);
-
-    struct FileIterator iter = {0};
-    while (find_next_word(file_text, &iter))
+    struct Token_source *tokens = parser->tokens;
+    struct Source_file *source = tokens->source;
+    int base = parser->intrinsics.length;
+    for (;;)
     {
-        // Create null terminated token
-        char *token = malloc(iter.length + 1);
-        if (token == NULL)
+        if (!Token_source_hasNext(tokens))
         {
-            fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
-            exit(1);
+            com_error(Token_location(source, &tokens->previous), "Expected an expression but got nothing.\n");
         }
-        strncpy_s(token, iter.length + 1, file_text + iter.start, iter.length);
-        token[iter.length] = 0;
-
-        // Create location
-        struct Location loc;
-        loc.filename = filename;
-        loc.line = iter.line + 1;
-        loc.collumn = iter.start - iter.line_collumn_start + 1;
-
-        // Create operation
-        struct Operation op;
-        int32_t value32;
-        _Static_assert(INTRINSIC_TYPE_COUNT == 7, "Exhaustive handling of intrinsic types");
-        _Static_assert(KEYWORD_TYPE_COUNT == 6, "Exhaustive handling of keyword types");
-        // INTRINSICS
-        if (strcmp(token, "print") == 0)
-            op = OP_INTRINSIC_PRINT;
-        else if (strcmp(token, "+") == 0)
-            op = OP_INTRINSIC_PLUS;
-        else if (strcmp(token, "-") == 0)
-            op = OP_INTRINSIC_MINUS;
-        else if (strcmp(token, ">") == 0)
-            op = OP_INTRINSIC_GT;
-        else if (strcmp(token, "%") == 0)
-            op = OP_INTRINSIC_MODULO;
-        else if (strcmp(token, "=") == 0)
-            op = OP_INTRINSIC_EQUAL;
-        else if (strcmp(token, "or") == 0)
-            op = OP_INTRINSIC_OR;
-        // KEYWORDS
-        else if (strcmp(token, "if") == 0)
-            op = OP_KEYWORD_IF;
-        else if (strcmp(token, "var") == 0)
-            op = OP_KEYWORD_VAR;
-        else if (strcmp(token, "do") == 0)
-            op = OP_KEYWORD_DO;
-        else if (strcmp(token, "end") == 0)
-            op = OP_KEYWORD_END;
-        else if (strcmp(token, "set") == 0)
-            op = OP_KEYWORD_SET;
-        else if (strcmp(token, "while") == 0)
-            op = OP_KEYWORD_WHILE;
-        // VALUES
-        else if (tryParseInteger(token, &value32))
+
+        struct Operation op = Token_source_next(tokens);
+        _Static_assert(OPERATION_TYPE_COUNT == 4, "Exhaustive handling of operation types");
+        switch (op.type)
         {
-            op = OP_VALUE_INT;
-            op.literal.value = value32;
+        case OPERATION_TYPE_VALUE:
+            Vec_Operation_add(&exp->operations, op);
+            Vec_Type_info_add(&exp->outputs, op.literal.typeInfo);
+            break;
+        case OPERATION_TYPE_IDENTIFIER:
+            struct Symbol *id_symbol = Symbol_table_get(&parser->symbols, op.identifier.name);
+            if (id_symbol == NULL)
+                com_error(Token_location(source, &op), "Unkown identifier '%.*s'.\n", String_view_arg(Token_spelling(source, &op)));
+            op.identifier.slot = id_symbol->slot;
+            Vec_Operation_add(&exp->operations, op);
+            Vec_Type_info_add(&exp->outputs, id_symbol->type_info);
+            break;
+        case OPERATION_TYPE_INTRINSIC:
+            if (parser->intrinsics.length - base >= parser->max_depth)
+                com_error(Token_location(source, &op), "Expression is nested deeper than %d levels.\n", parser->max_depth);
+            struct Parse_intrinsic intrinsic = {
+                .op = op,
+                .prev_output_count = exp->outputs.length,
+                .missing_operands = op.intrinsic.type == INTRINSIC_TYPE_PRINT ? 1 : 2,
+            };
+            Vec_Parse_intrinsic_add(&parser->intrinsics, intrinsic);
+            continue;
+        default:
+            com_error(Token_location(source, &op), "Operationt type '%d' not implemented yet in 'parse_expression'.\n", op.type);
         }
-        else
+
+        // An operand is complete, which can complete the intrinsics that are waiting for it.
+        while (parser->intrinsics.length > base)
         {
-            op = OP_IDENTIFIER;
-            op.identifier.word = op.token;
+            struct Parse_intrinsic *waiting = Vec_Parse_intrinsic_top(&parser->intrinsics);
+            if (--waiting->missing_operands > 0)
+                break;
+            struct Parse_intrinsic complete = Vec_Parse_intrinsic_pop(&parser->intrinsics);
+            parse_intrinsic(exp, source, &complete);
         }
-
-        // Assign token and location to op.
-        op.loc = loc;
-        op.token = token;
-        Array_add(operations, &op);
+        if (parser->intrinsics.length == base)
+            return;
     }
-
-    free(file_text);
 }
 
-struct Tuple
-{
-    struct Operation *op;
-    int required_size;
-};
-
-struct Identifier
+// Parses the condition of an if or a while statement, which has to leave exactly one value.
+void parse_condition(struct Parser *parser, struct Expression *condition, struct Operation *op, char *name)
 {
-    struct Operation op;
-    enum Type_info type_info;
-};
+    parse_expression(parser, condition);
+    if (condition->outputs.length != 1)
+        com_error(Token_location(parser->tokens->source, op), "%s condition must produce exactly one output.\n", name);
+}
 
-struct Identifier *get_identifier(struct Array *array, char *name)
+// Parses the declaration of a variable that follows the keyword 'op': its name, its type and
+// the expression that gives it its first value.
+void parse_variable(struct Parser *parser, struct Statement *statement, struct Operation *op)
 {
-    for (int i = 0; i < array->length; i++)
+    struct Token_source *tokens = parser->tokens;
+    struct Source_file *source = tokens->source;
+    struct Symbol_table *symbols = &parser->symbols;
+
+    // Parse identifier name
+    if (!Token_source_hasNext(tokens))
+        com_error(Token_location(source, op), "Unexpected end of file.\n");
+    struct Operation var_id_op = Token_source_next(tokens);
+    if (var_id_op.type != OPERATION_TYPE_IDENTIFIER)
+        com_error(Token_location(source, &var_id_op), "Expected a variable name but got '%.*s'.\n",
+                  String_view_arg(Token_spelling(source, &var_id_op)));
+
+    // Check if the identifier is already declared
+    struct Symbol *prev_var_symbol = Symbol_table_get(symbols, var_id_op.identifier.name);
+    if (prev_var_symbol != NULL)
     {
-        struct Identifier *id = Array_get(array, i);
-        if (strcmp(id->op.token, name) == 0)
-        {
-            return id;
-        }
+        struct Location prev_var_loc = Token_location(source, &prev_var_symbol->op);
+        com_error(Token_location(source, op), "Variable '%.*s' was already defined here: %s:%d:%d.\n.",
+                  String_view_arg(Token_spelling(source, &var_id_op)), prev_var_loc.filename, prev_var_loc.line, prev_var_loc.collumn);
     }
-    return NULL;
+
+    // Parse type info
+    if (!Token_source_hasNext(tokens))
+        com_error(Token_location(source, op), "Unexpected end of file.\n");
+    struct Operation var_type_op = Token_source_next(tokens);
+    enum Type_info var_type = Type_info_by_name(Token_spelling(source, &var_type_op));
+    if (var_type == -1)
+        com_error(Token_location(source, &var_type_op), "'%.*s' is not a valid type declaration.\n",
+                  String_view_arg(Token_spelling(source, &var_type_op)));
+
+    // Parse the expression
+    struct Expression var_exp;
+    Expression_init(&var_exp, parser->arena);
+    parse_expression(parser, &var_exp);
+
+    // Add the identifier after its assignment so the assignment cannot refer to it.
+    // Variables are stored in the frame in declaration order and a block releases its
+    // slots again when it ends, so the next free slot is the scope depth.
+    struct Symbol *var_symbol = Symbol_table_add(symbols, &var_id_op, var_type);
+
+    // Typecheck the expression
+    if (var_exp.outputs.length != 1)
+        com_error(Token_location(source, &var_id_op), "Variable declaration must produce exactly one ouput.\n");
+
+    enum Type_info *var_output = Vec_Type_info_top(&var_exp.outputs);
+    if (*var_output != var_symbol->type_info)
+        com_error(Token_location(source, &var_id_op), "Variable '%.*s' is of type '%s' but the assignment is of type '%s'.\n",
+                  String_view_arg(Token_spelling(source, &var_symbol->op)), Type_info_name(var_symbol->type_info), Type_info_name(*var_output));
+
+    statement->type = STATEMENT_TYPE_VAR;
+    statement->var.identifier = var_id_op;
+    statement->var.identifier.identifier.slot = var_symbol->slot;
+    statement->var.type_info = var_type;
+    statement->var.assignment = var_exp;
 }
 
-void parse_expression(struct Expression *exp, struct Iterator *operations_iter, struct Array *identifiers)
+// Parses a statement and every statement nested in it. The statements that wait for the ones
+// nested in them are kept in 'parser->frames'.
+void parse_statement(struct Parser *parser, struct Statement *statement)
 {
-    if (!Iterator_hasNext(operations_iter))
+    struct Token_source *tokens = parser->tokens;
+    struct Source_file *source = tokens->source;
+    struct Symbol_table *symbols = &parser->symbols;
+    struct Arena *arena = parser->arena;
+    int base = parser->frames.length;
+    for (;;)
     {
-        struct Operation *prev_op = Array_get(operations_iter->array, operations_iter->index - 1);
-        com_error(prev_op->loc, "Expected an expression but got nothing.\n");
-    }
-
-    struct Operation *op = Iterator_next(operations_iter);
-    _Static_assert(OPERATION_TYPE_COUNT == 4, "Exhaustive handling of operation types");
-    switch (op->type)
-    {
-    case OPERATION_TYPE_VALUE:
-        Array_add(&exp->operations, op);
-        Array_add(&exp->outputs, &op->literal.typeInfo);
-        break;
-    case OPERATION_TYPE_IDENTIFIER:
-        struct Identifier *id_id = get_identifier(identifiers, op->token);
-        if (id_id == NULL)
-            com_error(op->loc, "Unkown identifier '%s'.\n", op->token);
-        Array_add(&exp->operations, op);
-        Array_add(&exp->outputs, &id_id->type_info);
-        break;
-    case OPERATION_TYPE_INTRINSIC:
-        int prev_output_count = exp->outputs.length;
-        _Static_assert(INTRINSIC_TYPE_COUNT == 7, "Exhaustive handling of intrinsic types");
-        switch (op->intrinsic.type)
+        struct Operation op = Token_source_peekNext(tokens);
+        // A statement either waits in 'frame' for the statements nested in it or is complete
+        // right away.
+        struct Parse_frame frame = {.op = op};
+        struct Statement complete;
+        bool nested = false;
+        _Static_assert(OPERATION_TYPE_COUNT == 4, "Exhaustive handling of Operation types");
+        switch (op.type)
         {
-        case INTRINSIC_TYPE_PRINT:
-            parse_expression(exp, operations_iter, identifiers);
-            if (exp->outputs.length - prev_output_count != 1)
-                com_error(op->loc, "The 'print' intrinsic takes 1 input but %d were provided.\n", exp->outputs.length);
-            enum TypeInfo *print_i = Array_pop(&exp->outputs);
-            if (*print_i == TYPE_INFO_INT || *print_i == TYPE_INFO_BOOL)
-                Array_add(&exp->operations, op);
-            else
-                com_error(op->loc, "Cannot print values of type '%s'.\n", Type_info_name(*print_i));
-
-            break;
-        case INTRINSIC_TYPE_PLUS:
-            parse_expression(exp, operations_iter, identifiers);
-            parse_expression(exp, operations_iter, identifiers);
-            if (exp->outputs.length - prev_output_count != 2)
-                com_error(op->loc, "The 'plus' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
-            enum TypeInfo *plus_r = Array_pop(&exp->outputs);
-            enum TypeInfo *plus_l = Array_pop(&exp->outputs);
-            if (*plus_r == TYPE_INFO_INT && *plus_r == *plus_l)
+        case OPERATION_TYPE_KEYWORD:
+            _Static_assert(KEYWORD_TYPE_COUNT == 7, "Exhaustive handling of Keywords");
+            switch (op.keyword.type)
             {
-                Array_add(&exp->operations, op);
-                Array_add(&exp->outputs, plus_r);
+            case KEYWORD_TYPE_IF:
+                Token_source_next(tokens);
+                frame.statement.type = STATEMENT_TYPE_IF;
+                Expression_init(&frame.statement.iff.condition, arena);
+                parse_condition(parser, &frame.statement.iff.condition, &op, "If");
+                if (!Token_source_hasNext(tokens))
+                    com_error(Token_location(source, &op), "Unexpected end of file.\n");
+                struct Operation if_op = Token_source_peekNext(tokens);
+                if (if_op.type != OPERATION_TYPE_KEYWORD || if_op.keyword.type != KEYWORD_TYPE_DO)
+                    com_error(Token_location(source, &if_op), "Unexpected word '%.*s' after if condition. Expected the start of a block.\n",
+                              String_view_arg(Token_spelling(source, &if_op)));
+                nested = true;
+                break;
+            case KEYWORD_TYPE_WHILE:
+                Token_source_next(tokens);
+                frame.statement.type = STATEMENT_TYPE_WHILE;
+                Expression_init(&frame.statement.whilee.condition, arena);
+                parse_condition(parser, &frame.statement.whilee.condition, &op, "While");
+                if (!Token_source_hasNext(tokens))
+                    com_error(Token_location(source, &op), "Unexpected end of file.\n");
+                struct Operation while_op = Token_source_peekNext(tokens);
+                if (while_op.type != OPERATION_TYPE_KEYWORD || while_op.keyword.type != KEYWORD_TYPE_DO)
+                    com_error(Token_location(source, &while_op), "Unexpected word '%.*s' after while condition. Expected the start of a block.\n",
+                              String_view_arg(Token_spelling(source, &while_op)));
+                nested = true;
+                break;
+            case KEYWORD_TYPE_VAR:
+                Token_source_next(tokens);
+                parse_variable(parser, &complete, &op);
+                break;
+            case KEYWORD_TYPE_WITH:
+                Token_source_next(tokens);
+                // The variable of 'with' only exists inside of the loop that follows it, so the
+                // pair is parsed as a block of its own.
+                frame.scope = Symbol_table_scope_begin(symbols);
+                frame.statement.type = STATEMENT_TYPE_BLOCK;
+                Vec_Statement_init_arena(&frame.statement.block.statements, arena);
+
+                struct Statement with_variable;
+                parse_variable(parser, &with_variable, &op);
+                Vec_Statement_add(&frame.statement.block.statements, with_variable);
+
+                if (!Token_source_hasNext(tokens))
+                    com_error(Token_location(source, &op), "Unexpected end of file.\n");
+                struct Operation with_op = Token_source_peekNext(tokens);
+                if (with_op.type != OPERATION_TYPE_KEYWORD || with_op.keyword.type != KEYWORD_TYPE_WHILE)
+                    com_error(Token_location(source, &with_op), "Unexpected word '%.*s' after the variable of 'with'. Expected a while loop.\n",
+                              String_view_arg(Token_spelling(source, &with_op)));
+                nested = true;
+                break;
+            case KEYWORD_TYPE_SET:
+                Token_source_next(tokens);
+
+                if (!Token_source_hasNext(tokens))
+                    com_error(Token_location(source, &op), "Unexpected end of file.\n");
+
+                complete.type = STATEMENT_TYPE_SET;
+                complete.set.identifier = Token_source_next(tokens);
+                if (complete.set.identifier.type != OPERATION_TYPE_IDENTIFIER)
+                    com_error(Token_location(source, &complete.set.identifier), "Expected a variable name but got '%.*s'.\n",
+                              String_view_arg(Token_spelling(source, &complete.set.identifier)));
+
+                // Check if the identifier is declared
+                struct Symbol *set_symbol = Symbol_table_get(symbols, complete.set.identifier.identifier.name);
+                if (set_symbol == NULL)
+                    com_error(Token_location(source, &op), "Undefined variable '%.*s'.\n.",
+                              String_view_arg(Token_spelling(source, &complete.set.identifier)));
+                complete.set.identifier.identifier.slot = set_symbol->slot;
+
+                // Parse expression
+                Expression_init(&complete.set.assignment, arena);
+                parse_expression(parser, &complete.set.assignment);
+
+                // Typecheck expression
+                if (complete.set.assignment.outputs.length != 1)
+                    com_error(Token_location(source, &complete.set.identifier), "Variable assignment must produce exactly one ouput.\n");
+
+                enum Type_info *set_output = Vec_Type_info_top(&complete.set.assignment.outputs);
+                if (*set_output != set_symbol->type_info)
+                    com_error(Token_location(source, &complete.set.identifier), "Variable '%.*s' is of type '%s' but the assignment is of type '%s'.\n",
+                              String_view_arg(Token_spelling(source, &set_symbol->op)), Type_info_name(set_symbol->type_info), Type_info_name(*set_output));
+                break;
+            case KEYWORD_TYPE_DO:
+                Token_source_next(tokens);
+                frame.scope = Symbol_table_scope_begin(symbols);
+
+                frame.statement.type = STATEMENT_TYPE_BLOCK;
+                Vec_Statement_init_arena(&frame.statement.block.statements, arena);
+
+                if (!Token_source_hasNext(tokens))
+                    com_error(Token_location(source, &op), "Unexpected end of file.\n");
+                frame.next = Token_source_peekNext(tokens);
+                if (frame.next.type != OPERATION_TYPE_KEYWORD || frame.next.keyword.type != KEYWORD_TYPE_END)
+                {
+                    nested = true;
+                    break;
+                }
+                Token_source_next(tokens);
+                Symbol_table_scope_end(symbols, frame.scope);
+                complete = frame.statement;
+                break;
+            case KEYWORD_TYPE_END:
+                Token_source_next(tokens);
+                com_error(Token_location(source, &op), "Encountered 'end' without a matching 'do'.\n");
+                break;
+
+            default:
+                fprintf(stderr, "Unhandled keyword type '%d' in 'prase_program'\n", op.keyword.type);
+                exit(1);
             }
-            else
-                com_error(op->loc, "Cannot add values of type '%s' and '%s'.\n", Type_info_name(*plus_l), Type_info_name(*plus_r));
             break;
-        case INTRINSIC_TYPE_MINUS:
-            parse_expression(exp, operations_iter, identifiers);
-            parse_expression(exp, operations_iter, identifiers);
-            if (exp->outputs.length - prev_output_count != 2)
-                com_error(op->loc, "The 'minus' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
-            enum TypeInfo *minus_r = Array_pop(&exp->outputs);
-            enum TypeInfo *minus_l = Array_pop(&exp->outputs);
-            if (*minus_r == TYPE_INFO_INT && *minus_r == *minus_l)
-            {
-                Array_add(&exp->operations, op);
-                Array_add(&exp->outputs, minus_r);
-            }
-            else
-                com_error(op->loc, "Cannot subtract values of type '%s' and '%s'.\n", Type_info_name(*minus_l), Type_info_name(*minus_r));
+        case OPERATION_TYPE_IDENTIFIER:
+            com_error(Token_location(source, &op), "Unknown intrinsic '%.*s'. We do not support calling variable like functions yet.\n",
+                      String_view_arg(Token_spelling(source, &op)));
             break;
-        case INTRINSIC_TYPE_GT:
-            parse_expression(exp, operations_iter, identifiers);
-            parse_expression(exp, operations_iter, identifiers);
-            if (exp->outputs.length - prev_output_count != 2)
-                com_error(op->loc, "The 'greater than' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
-            enum TypeInfo *gt_r = Array_pop(&exp->outputs);
-            enum TypeInfo *gt_l = Array_pop(&exp->outputs);
-            if (*gt_r == TYPE_INFO_INT && *gt_r == *gt_l)
-            {
-                Array_add(&exp->operations, op);
-                enum Type_info gt_bool = TYPE_INFO_BOOL;
-                Array_add(&exp->outputs, &gt_bool);
-            }
-            else
-                com_error(op->loc, "Cannot compare values of type '%s' and '%s'.\n", Type_info_name(*gt_l), Type_info_name(*gt_r));
+        default:
+            // naked expression as statement
+            complete.type = STATEMENT_TYPE_EXP;
+            Expression_init(&complete.expression, arena);
+            parse_expression(parser, &complete.expression);
             break;
-        case INTRINSIC_TYPE_MODULO:
-            parse_expression(exp, operations_iter, identifiers);
-            parse_expression(exp, operations_iter, identifiers);
-            if (exp->outputs.length - prev_output_count != 2)
-                com_error(op->loc, "The 'modulo' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
-            enum TypeInfo *modulo_r = Array_pop(&exp->outputs);
-            enum TypeInfo *modulo_l = Array_pop(&exp->outputs);
-            if (*modulo_r == TYPE_INFO_INT && *modulo_r == *modulo_l)
+        }
+
+        if (nested)
+        {
+            if (parser->frames.length - base >= parser->max_depth)
+                com_error(Token_location(source, &op), "Statements are nested deeper than %d levels.\n", parser->max_depth);
+            Vec_Parse_frame_add(&parser->frames, frame);
+            continue;
+        }
+
+        // The complete statement can complete the statements it is nested in.
+        while (parser->frames.length > base)
+        {
+            struct Parse_frame *waiting = Vec_Parse_frame_top(&parser->frames);
+            if (waiting->statement.type == STATEMENT_TYPE_IF)
             {
-                Array_add(&exp->operations, op);
-                Array_add(&exp->outputs, modulo_r);
+                waiting->statement.iff.action = Arena_alloc(arena, sizeof(struct Statement));
+                *waiting->statement.iff.action = complete;
             }
-            else
-                com_error(op->loc, "Cannot 'modulo' combine values of type '%s' and '%s'.\n", Type_info_name(*modulo_l), Type_info_name(*modulo_r));
-            break;
-        case INTRINSIC_TYPE_EQUAL:
-            parse_expression(exp, operations_iter, identifiers);
-            parse_expression(exp, operations_iter, identifiers);
-            if (exp->outputs.length - prev_output_count != 2)
-                com_error(op->loc, "The 'equal' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
-            enum TypeInfo *equal_r = Array_pop(&exp->outputs);
-            enum TypeInfo *equal_l = Array_pop(&exp->outputs);
-            if (*equal_r == TYPE_INFO_INT && *equal_r == *equal_l)
+            else if (waiting->statement.type == STATEMENT_TYPE_WHILE)
             {
-                Array_add(&exp->operations, op);
-                enum Type_info equal_bool = TYPE_INFO_BOOL;
-                Array_add(&exp->outputs, &equal_bool);
+                waiting->statement.whilee.action = Arena_alloc(arena, sizeof(struct Statement));
+                *waiting->statement.whilee.action = complete;
             }
             else
-                com_error(op->loc, "Cannot compare values of type '%s' and '%s'.\n", Type_info_name(*equal_l), Type_info_name(*equal_r));
-            break;
-        case INTRINSIC_TYPE_OR:
-            parse_expression(exp, operations_iter, identifiers);
-            parse_expression(exp, operations_iter, identifiers);
-            if (exp->outputs.length - prev_output_count != 2)
-                com_error(op->loc, "The 'or' intrinsic takes 2 input but %d were provided.\n", exp->outputs.length);
-            enum TypeInfo *or_r = Array_pop(&exp->outputs);
-            enum TypeInfo *or_l = Array_pop(&exp->outputs);
-            if (*or_r == TYPE_INFO_BOOL && *or_r == *or_l)
             {
-                Array_add(&exp->operations, op);
-                enum Type_info equal_bool = TYPE_INFO_BOOL;
-                Array_add(&exp->outputs, &equal_bool);
+                Vec_Statement_add(&waiting->statement.block.statements, complete);
+                if (waiting->op.keyword.type == KEYWORD_TYPE_DO)
+                {
+                    if (!Token_source_hasNext(tokens))
+                    {
+                        struct Location do_loc = Token_location(source, &waiting->op);
+                        com_error(Token_location(source, &waiting->next), "Missing 'end' for 'do' in %s:%d:%d.\n",
+                                  do_loc.filename, do_loc.line, do_loc.collumn);
+                    }
+                    waiting->next = Token_source_peekNext(tokens);
+                    if (waiting->next.type != OPERATION_TYPE_KEYWORD || waiting->next.keyword.type != KEYWORD_TYPE_END)
+                        break;
+                    Token_source_next(tokens);
+                }
+                Symbol_table_scope_end(symbols, waiting->scope);
             }
-            else
-                com_error(op->loc, "Cannot 'or' combine values of type '%s' and '%s'.\n", Type_info_name(*or_l), Type_info_name(*or_r));
-            break;
-        default:
-            com_error(op->loc, "Intrinsic type '%d' is not implemented yet in 'parse_expression'.\n", op->intrinsic.type);
+            complete = Vec_Parse_frame_pop(&parser->frames).statement;
         }
-        break;
-    default:
-        com_error(op->loc, "Operationt type '%d' not implemented yet in 'parse_expression'.\n", op->type);
-    }
-}
-
-void parse_statement(struct Statement *statement, struct Iterator *iter_ops, struct Array *identifiers)
-{
-    struct Operation *op = Iterator_peekNext(iter_ops);
-    _Static_assert(OPERATION_TYPE_COUNT == 4, "Exhaustive handling of Operation types");
-    switch (op->type)
-    {
-    case OPERATION_TYPE_KEYWORD:
-        _Static_assert(KEYWORD_TYPE_COUNT == 6, "Exhaustive handling of Keywords");
-        switch (op->keyword.type)
+        if (parser->frames.length == base)
         {
-        case KEYWORD_TYPE_IF:
-            Iterator_next(iter_ops);
-            statement->type = STATEMENT_TYPE_IF;
-            Expression_init(&statement->iff.condition);
-            parse_expression(&statement->iff.condition, iter_ops, identifiers);
-            struct Operation *if_op = Iterator_peekNext(iter_ops);
-            if (if_op == NULL)
-                com_error(op->loc, "Unexpected end of file.\n");
-            if (if_op->type != OPERATION_TYPE_KEYWORD || if_op->keyword.type != KEYWORD_TYPE_DO)
-                com_error(if_op->loc, "Unexpected word '%s' after if condition. Expected the start of a block.\n",
-                          if_op->token);
-            statement->iff.action = malloc(sizeof(struct Statement));
-            parse_statement(statement->iff.action, iter_ops, identifiers);
-
-            break;
-        case KEYWORD_TYPE_WHILE:
-            Iterator_next(iter_ops);
-            statement->type = STATEMENT_TYPE_WHILE;
-            Expression_init(&statement->whilee.condition);
-            parse_expression(&statement->whilee.condition, iter_ops, identifiers);
-            struct Operation *while_op = Iterator_peekNext(iter_ops);
-            if (while_op == NULL)
-                com_error(op->loc, "Unexpected end of file.\n");
-            if (while_op->type != OPERATION_TYPE_KEYWORD || while_op->keyword.type != KEYWORD_TYPE_DO)
-                com_error(while_op->loc, "Unexpected word '%s' after while condition. Expected the start of a block.\n",
-                          while_op->token);
-            statement->whilee.action = malloc(sizeof(struct Statement));
-            parse_statement(statement->whilee.action, iter_ops, identifiers);
-            break;
-        case KEYWORD_TYPE_VAR:
-            Iterator_next(iter_ops);
-
-            // Parse identifier name
-            if (!Iterator_hasNext(iter_ops))
-                com_error(op->loc, "Unexpected end of file.\n");
-            struct Operation *var_id_op = Iterator_next(iter_ops);
-
-            // Check if the identifier is already declared
-            struct Identifier *prev_var_id = get_identifier(identifiers, var_id_op->token);
-            if (prev_var_id != NULL)
-                com_error(op->loc, "Variable '%s' was already defined here: %s:%d:%d.\n.",
-                          var_id_op->token, op->loc.filename, op->loc.line, op->loc.collumn);
-
-            // Parse type info
-            if (!Iterator_hasNext(iter_ops))
-                com_error(op->loc, "Unexpected end of file.\n");
-            struct Operation *var_type_op = Iterator_next(iter_ops);
-            enum Type_info var_type = Type_info_by_name(var_type_op->token);
-            if (var_type == -1)
-                com_error(var_type_op->loc, "'%s' is not a valid type declaration.\n", var_type_op->token);
-
-            // Add the identifier
-            struct Identifier var_id = {
-                .op = *var_id_op,
-                .type_info = var_type,
-            };
-            Array_add(identifiers, &var_id);
-
-            // Parse the expression
-            struct Expression var_exp;
-            Expression_init(&var_exp);
-            parse_expression(&var_exp, iter_ops, identifiers);
-
-            // Typecheck the expression
-            if (var_exp.outputs.length != 1)
-                com_error(var_id_op->loc, "Variable declaration must produce exactly one ouput.\n");
-
-            enum Type_info *var_output = Array_top(&var_exp.outputs);
-            if (*var_output != var_id.type_info)
-                com_error(var_id_op->loc, "Variable '%s' is of type '%s' but the assignment is of type '%s'.\n",
-                          var_id.op.token, Type_info_name(var_id.type_info), Type_info_name(*var_output));
-
-            statement->type = STATEMENT_TYPE_VAR;
-            statement->var.identifier = *var_id_op;
-            statement->var.type_info = var_type;
-            statement->var.assignment = var_exp;
-
-            break;
-        case KEYWORD_TYPE_SET:
-            Iterator_next(iter_ops);
-
-            if (!Iterator_hasNext(iter_ops))
-                com_error(op->loc, "Unexpected end of file.\n");
-
-            statement->type = STATEMENT_TYPE_SET;
-            statement->set.identifier = *((struct Operation *)Iterator_next(iter_ops));
-
-            // Check if the identifier is declared
-            struct Identifier *set_id = get_identifier(identifiers, statement->set.identifier.token);
-            if (set_id == NULL)
-                com_error(op->loc, "Undefined variable '%s'.\n.", statement->set.identifier.token);
-
-            // Parse expression
-            Expression_init(&statement->set.assignment);
-            parse_expression(&statement->set.assignment, iter_ops, identifiers);
-
-            // Typecheck expression
-            if (statement->set.assignment.outputs.length != 1)
-                com_error(statement->set.identifier.loc, "Variable assignment must produce exactly one ouput.\n");
-
-            enum Type_info *set_output = Array_top(&statement->set.assignment.outputs);
-            if (*set_output != set_id->type_info)
-                com_error(statement->set.identifier.loc, "Variable '%s' is of type '%s' but the assignment is of type '%s'.\n",
-                          set_id->op.token, Type_info_name(set_id->type_info), Type_info_name(*set_output));
-            break;
-        case KEYWORD_TYPE_DO:
-            Iterator_next(iter_ops);
-            int identifier_stack_length = identifiers->length;
-
-            statement->type = STATEMENT_TYPE_BLOCK;
-            Array_init(&statement->block.statements, sizeof(struct Statement));
-
-            struct Operation *block_op = Iterator_peekNext(iter_ops);
-            while (block_op->type != OPERATION_TYPE_KEYWORD || block_op->keyword.type != KEYWORD_TYPE_END)
-            {
-                struct Statement block_statement;
-                parse_statement(&block_statement, iter_ops, identifiers);
-                Array_add(&statement->block.statements, &block_statement);
-
-                if (!Iterator_hasNext(iter_ops))
-                    com_error(block_op->loc, "Missing 'end' for 'do' in %s:%d:%d.\n",
-                              op->loc.filename, op->loc.line, op->loc.collumn);
-
-                block_op = Iterator_peekNext(iter_ops);
-            }
-            Iterator_next(iter_ops);
-            identifiers->length = identifier_stack_length;
-            break;
-        case KEYWORD_TYPE_END:
-            Iterator_next(iter_ops);
-            com_error(op->loc, "Encountered 'end' without a matching 'do'.\n");
-            break;
-
-        default:
-            fprintf(stderr, "Unhandled keyword type '%d' in 'prase_program'\n", op->keyword.type);
-            exit(1);
+            *statement = complete;
+            return;
         }
-        break;
-    case OPERATION_TYPE_IDENTIFIER:
-        com_error(op->loc, "Unknown intrinsic '%s'. We do not support calling variable like functions yet.\n",
-                  op->token);
-        break;
-    default:
-        // naked expression as statement
-        statement->type = STATEMENT_TYPE_EXP;
-        Expression_init(&statement->expression);
-        parse_expression(&statement->expression, iter_ops, identifiers);
-        break;
     }
 }
 
-void parse_program(struct Array *program, struct Array *operations)
+// Nesting deeper than 'max_depth' levels is an error.
+void parse_program(Vec(Statement) *program, struct Token_source *tokens, struct Arena *arena, int max_depth)
 {
-    struct Array identifiers;
-    Array_init(&identifiers, sizeof(struct Identifier));
+    struct Parser parser = {.tokens = tokens, .arena = arena, .max_depth = max_depth};
+    Symbol_table_init(&parser.symbols);
+    Vec_Parse_intrinsic_init(&parser.intrinsics);
+    Vec_Parse_frame_init(&parser.frames);
 
-    struct Iterator iter_ops = Iterator_create(operations);
-    while (Iterator_hasNext(&iter_ops))
+    while (Token_source_hasNext(tokens))
     {
         struct Statement statement = {0};
-        parse_statement(&statement, &iter_ops, &identifiers);
-        Array_add(program, &statement);
+        parse_statement(&parser, &statement);
+        Vec_Statement_add(program, statement);
     }
-    Array_free(&identifiers);
+    Symbol_table_free(&parser.symbols);
+    Vec_Parse_intrinsic_free(&parser.intrinsics);
+    Vec_Parse_frame_free(&parser.frames);
 }
 
 void print_usage(void)
 {
-    printf("Usage: betsy <subcommand> <filename>\n");
+    printf("Usage: betsy <subcommand> <filename> [options]\n");
     printf("    Subcommands:\n");
     printf("        sim          : Simulate the program\n");
     printf("        com          : Compile the program\n");
+    printf("        native       : Compile the program to an x86-64 Linux executable\n");
+    printf("        build        : Compile the program to an executable with the system C compiler\n");
+    printf("        pack         : Write the simulator's form of the program to an image\n");
+    printf("        run          : Simulate an image that 'pack' wrote\n");
+    printf("    Options:\n");
+    printf("        --threads <n>       : Lex large files with n threads\n");
+    printf("        --no-opt            : Run the program exactly as written, without optimizations\n");
+    printf("        --partial-eval <n>  : Run up to n steps of the program while compiling it\n");
+    printf("        --jit               : Simulate the program as machine code where that is supported\n");
+    printf("        --no-tier           : Simulate every loop, even the ones that run long enough to compile them\n");
+    printf("        --count-allocations : Report the allocations the simulator makes while the program runs\n");
+    printf("        --max-depth <n>     : Reject programs that nest statements or expressions deeper than n levels\n");
+    printf("        --output <file>     : Name of the file 'build', 'native' or 'pack' writes\n");
+    printf("        --cflags <flags>    : Flags 'build' passes to the C compiler instead of the default optimizations\n");
 }
 
-void print_program(struct Array *program)
+void print_program(Vec(Statement) *program, struct Source_file *source)
 {
     for (int j = 0; j < program->length; j++)
     {
-        struct Statement *statement = Array_get(program, j);
+        struct Statement *statement = Vec_Statement_get(program, j);
         printf("%2d: type:%d | ", j, statement->type);
 
         switch (statement->type)
@@ -560,8 +560,8 @@ void print_program(struct Array *program)
             printf("out:%d\t", statement->expression.nr_outputs);
             for (int i = 0; i < statement->expression.operations.length; i++)
             {
-                struct Operation *op = Array_get(&statement->expression.operations, i);
-                printf("%s ", op->token);
+                struct Operation *op = Vec_Operation_get(&statement->expression.operations, i);
+                printf("%.*s ", String_view_arg(Token_spelling(source, op)));
             }
             printf("\n");
             break;
@@ -585,25 +585,152 @@ int main(int argc, char *argv[])
     if (argc < 3)
     {
         fprintf(stderr, "ERROR: No filename given.\n");
+        print_usage();
+        return 0;
+    }
+
+    int thread_count = 1;
+    bool optimize = true;
+    // Only 'com' and 'build' run the program while compiling it, and only when asked to.
+    long evaluation_steps = -1;
+    bool jit = false;
+    bool tiered = true;
+    bool count_allocations = false;
+    int max_depth = PARSE_MAX_DEPTH;
+    char *output = NULL;
+    char *cflags = NULL;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            thread_count = atoi(argv[++i]);
+            if (thread_count < 1)
+            {
+                fprintf(stderr, "ERROR: The number of threads must be at least 1.\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--no-opt") == 0)
+            optimize = false;
+        else if (strcmp(argv[i], "--jit") == 0)
+            jit = true;
+        else if (strcmp(argv[i], "--no-tier") == 0)
+            tiered = false;
+        else if (strcmp(argv[i], "--count-allocations") == 0)
+            count_allocations = true;
+        else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc)
+        {
+            max_depth = atoi(argv[++i]);
+            if (max_depth < 1)
+            {
+                fprintf(stderr, "ERROR: The nesting depth must be at least 1.\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--cflags") == 0 && i + 1 < argc)
+            cflags = argv[++i];
+        else if (strcmp(argv[i], "--partial-eval") == 0 && i + 1 < argc)
+        {
+            evaluation_steps = atol(argv[++i]);
+            if (evaluation_steps < 0)
+            {
+                fprintf(stderr, "ERROR: The number of steps must not be negative.\n");
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: Unknown option %s.\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+
+    // An image was parsed and lowered when it was packed, running it needs none of the front end.
+    if (strcmp(subcommand, "run") == 0)
+    {
+        run_image(argv[2], count_allocations);
+        return 0;
     }
 
-    struct Array operations;
-    Array_init(&operations, sizeof(struct Operation));
+    // Every allocation of the front end comes from this arena.
+    struct Arena arena;
+    Arena_init(&arena);
+
+    struct Interner interner;
+    Interner_init(&interner, &arena);
+
+    // Tokens refer to the source text, so it stays open until the end of the compilation.
+    struct Source_file source;
+    Source_file_open(&source, argv[2]);
+
+    // The parser lexes the words as it needs them. Lexing with several threads has to lex
+    // the whole file up front instead.
+    struct Token_stream stream;
+    Token_stream_init(&stream, &source);
+    struct Token_source tokens;
+    if (thread_count > 1)
+    {
+        parse_file(&stream, &interner, thread_count);
+        Token_source_init_stream(&tokens, &stream);
+    }
+    else
+        Token_source_init(&tokens, &source, &interner);
+
+    Vec(Statement) program;
+    Vec_Statement_init_arena(&program, &arena);
+
+    parse_program(&program, &tokens, &arena, max_depth);
+    Token_stream_free(&stream);
 
-    parse_file(&operations, argv[2]);
+    if (optimize)
+        optimize_program(&program);
 
-    struct Array program;
-    Array_init(&program, sizeof(struct Statement));
+    struct Cfg cfg;
+    Cfg_build(&cfg, &program, &arena);
+    if (optimize)
+        Cfg_optimize(&cfg);
 
-    parse_program(&program, &operations);
+    // Both backends work on the SSA form of the control flow graph.
+    struct Ir ir;
+    Ir_build(&ir, &cfg);
+    if (optimize)
+        Ir_optimize(&ir);
 
     if (strcmp(subcommand, "sim") == 0)
     {
-        simulate_program(&program);
+        if (!jit || !jit_program(&ir))
+            simulate_program(&ir, tiered, count_allocations);
     }
-    else if (strcmp(subcommand, "com") == 0)
+    else if (strcmp(subcommand, "com") == 0 || strcmp(subcommand, "build") == 0)
     {
-        compile_program(&program);
+        struct Evaluation evaluation;
+        if (evaluation_steps >= 0)
+            Evaluation_run_program(&evaluation, &ir, evaluation_steps);
+        struct Evaluation *evaluated = evaluation_steps >= 0 ? &evaluation : NULL;
+
+        if (strcmp(subcommand, "com") == 0)
+            compile_program(&ir, evaluated, "out.c");
+        else
+        {
+            char default_output[BUILD_PATH_SIZE];
+            build_default_output(default_output, sizeof(default_output), argv[2], BUILD_EXECUTABLE_EXTENSION);
+            build_program(&ir, evaluated, output != NULL ? output : default_output, cflags);
+        }
+        if (evaluated != NULL)
+            Evaluation_free(&evaluation);
+    }
+    else if (strcmp(subcommand, "native") == 0)
+    {
+        native_program(&ir, output != NULL ? output : "out");
+    }
+    else if (strcmp(subcommand, "pack") == 0)
+    {
+        char default_output[BUILD_PATH_SIZE];
+        build_default_output(default_output, sizeof(default_output), argv[2], ".img");
+        pack_program(&ir, output != NULL ? output : default_output);
     }
     else
     {
@@ -611,13 +738,10 @@ int main(int argc, char *argv[])
         print_usage();
     }
 
-    // print_program(&program);
-    for (int i = 0; i < program.length; i++)
-    {
-        struct Statement *statement = Array_get(&program, i);
-        Statement_free(statement);
-    }
-    Array_free(&program);
-    Array_free(&operations);
+    // print_program(&program, &source);
+    Ir_free(&ir);
+    Interner_free(&interner);
+    Arena_free(&arena);
+    Source_file_close(&source);
     return 0;
 }
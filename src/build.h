@@ -0,0 +1,262 @@
+#ifndef BUILD_H
+#define BUILD_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compilation.h"
+#include "evaluation.h"
+#include "ir.h"
+
+// 'betsy build' turns a program into an executable in one step. The C backend writes the
+// program, the system C compiler compiles it and the executable is kept in a cache, keyed by
+// a hash of the C, the compiler, its version and the flags. Building a program that did not
+// change only copies the cached executable. Every build works on files of its own in the cache
+// directory, so builds can run at the same time, and none of them touches 'out.c'.
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define BUILD_COMPILER "cl"
+#define BUILD_FLAGS "/O2"
+#define BUILD_EXECUTABLE_EXTENSION ".exe"
+#define build_make_directory(path) _mkdir(path)
+#define build_process_id() _getpid()
+#define build_popen _popen
+#define build_pclose _pclose
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define BUILD_COMPILER "cc"
+#define BUILD_FLAGS "-O2"
+#define BUILD_EXECUTABLE_EXTENSION ""
+#define build_make_directory(path) mkdir(path, 0755)
+#define build_process_id() getpid()
+#define build_popen popen
+#define build_pclose pclose
+#endif
+
+#define BUILD_PATH_SIZE 1024
+
+void build_error(const char *message, const char *path)
+{
+    fprintf(stderr, "ERROR: %s '%s'.\n", message, path);
+    exit(1);
+}
+
+// Formats a path or a command into 'buffer'. One that does not fit is an error instead of being
+// cut off.
+void build_format(char *buffer, int size, const char *format, ...)
+{
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsnprintf(buffer, size, format, arguments);
+    va_end(arguments);
+    if (length < 0 || length >= size)
+    {
+        fprintf(stderr, "ERROR: The path or command '%.40s...' is too long.\n", buffer);
+        exit(1);
+    }
+}
+
+// 64 bit FNV-1a, carried on from 'hash'.
+uint64_t build_hash(uint64_t hash, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t build_hash_file(uint64_t hash, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        build_error("Cannot read", path);
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        hash = build_hash(hash, buffer, length);
+    fclose(file);
+    return hash;
+}
+
+// Hashes what 'command' prints, which is how the version of the compiler gets into the key.
+uint64_t build_hash_command(uint64_t hash, const char *command)
+{
+    FILE *pipe = build_popen(command, "r");
+    if (pipe == NULL)
+        return hash;
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+        hash = build_hash(hash, buffer, length);
+    build_pclose(pipe);
+    return hash;
+}
+
+// Writes the cache directory into 'directory' and creates it. It is $BETSY_CACHE when that is
+// set, and a 'betsy' directory in the cache directory of the user otherwise.
+void build_cache_directory(char *directory, int size)
+{
+    const char *cache = getenv("BETSY_CACHE");
+    if (cache != NULL && cache[0] != 0)
+        build_format(directory, size, "%s", cache);
+    else
+    {
+#ifdef _WIN32
+        const char *local = getenv("LOCALAPPDATA");
+        build_format(directory, size, "%s\\betsy", local != NULL ? local : ".");
+#else
+        const char *xdg = getenv("XDG_CACHE_HOME");
+        const char *home = getenv("HOME");
+        if (xdg != NULL && xdg[0] != 0)
+            build_format(directory, size, "%s/betsy", xdg);
+        else
+        {
+            // $HOME/.cache might not exist yet either.
+            build_format(directory, size, "%s/.cache", home != NULL ? home : ".");
+            build_make_directory(directory);
+            build_format(directory, size, "%s/.cache/betsy", home != NULL ? home : ".");
+        }
+#endif
+    }
+    // The directory usually exists already, a directory that cannot be created shows when the
+    // first file is written into it.
+    build_make_directory(directory);
+}
+
+bool build_copy_file(const char *from, const char *to)
+{
+    FILE *input = fopen(from, "rb");
+    if (input == NULL)
+        return false;
+    FILE *output = fopen(to, "wb");
+    if (output == NULL)
+    {
+        fclose(input);
+        return false;
+    }
+    char buffer[4096];
+    size_t length;
+    bool copied = true;
+    while ((length = fread(buffer, 1, sizeof(buffer), input)) > 0)
+        copied = copied && fwrite(buffer, 1, length, output) == length;
+    fclose(input);
+    copied = fclose(output) == 0 && copied;
+#ifndef _WIN32
+    chmod(to, 0755);
+#endif
+    return copied;
+}
+
+// Moves the file 'from' to 'to', replacing 'to'. A program that still runs from 'to' keeps its
+// old file.
+bool build_replace_file(const char *from, const char *to)
+{
+#ifdef _WIN32
+    remove(to);
+#endif
+    return rename(from, to) == 0;
+}
+
+// Names the file that is made from 'source' in the current directory like 'source', without its
+// directory and with 'extension' in place of its own.
+void build_default_output(char *output, int size, const char *source, const char *extension)
+{
+    const char *name = source;
+    for (const char *c = source; *c != 0; c++)
+    {
+        if (*c == '/' || *c == '\\')
+            name = c + 1;
+    }
+    int length = (int)strlen(name);
+    const char *dot = strrchr(name, '.');
+    if (dot != NULL && dot != name)
+        length = (int)(dot - name);
+    build_format(output, size, "%.*s%s", length, name, extension);
+}
+
+// Builds the executable 'output' from the program. 'flags' are passed to the C compiler, which
+// is $CC when that is set.
+void build_program(struct Ir *ir, struct Evaluation *evaluation, const char *output, const char *flags)
+{
+    const char *compiler = getenv("CC");
+    if (compiler == NULL || compiler[0] == 0)
+        compiler = BUILD_COMPILER;
+    if (flags == NULL)
+        flags = BUILD_FLAGS;
+
+    char directory[BUILD_PATH_SIZE];
+    build_cache_directory(directory, sizeof(directory));
+    int id = (int)build_process_id();
+
+    // The C goes into a file of this build only, the key is known once it was written.
+    char source[BUILD_PATH_SIZE];
+    build_format(source, sizeof(source), "%s/build-%d.c", directory, id);
+    compile_program(ir, evaluation, source);
+
+    char command[3 * BUILD_PATH_SIZE];
+#ifdef _WIN32
+    build_format(command, sizeof(command), "%s 2>&1", compiler);
+#else
+    build_format(command, sizeof(command), "%s --version 2>&1", compiler);
+#endif
+    uint64_t key = build_hash(14695981039346656037ull, compiler, strlen(compiler) + 1);
+    key = build_hash(key, flags, strlen(flags) + 1);
+    key = build_hash_command(key, command);
+    key = build_hash_file(key, source);
+
+    char cached[BUILD_PATH_SIZE];
+    build_format(cached, sizeof(cached), "%s/%016llx%s", directory, (unsigned long long)key, BUILD_EXECUTABLE_EXTENSION);
+    FILE *hit = fopen(cached, "rb");
+    if (hit != NULL)
+        fclose(hit);
+    else
+    {
+        // The compiler writes next to the C, the finished executable is moved into place in
+        // one step, so a build that runs at the same time never sees half of it.
+        char compiled[BUILD_PATH_SIZE];
+        build_format(compiled, sizeof(compiled), "%s/build-%d%s", directory, id, BUILD_EXECUTABLE_EXTENSION);
+#ifdef _WIN32
+        build_format(command, sizeof(command), "%s /nologo %s /Fe\"%s\" /Fo\"%s/build-%d.obj\" \"%s\" >NUL",
+                 compiler, flags, compiled, directory, id, source);
+#else
+        build_format(command, sizeof(command), "%s %s -o \"%s\" \"%s\"", compiler, flags, compiled, source);
+#endif
+        int status = system(command);
+#ifdef _WIN32
+        build_format(command, sizeof(command), "%s/build-%d.obj", directory, id);
+        remove(command);
+#endif
+        // The C stays around when the compiler fails on it.
+        if (status != 0)
+        {
+            remove(compiled);
+            build_error("The C compiler failed on", source);
+        }
+        if (!build_replace_file(compiled, cached))
+        {
+            remove(source);
+            remove(compiled);
+            build_error("Cannot write", cached);
+        }
+    }
+    remove(source);
+
+    char copy[BUILD_PATH_SIZE];
+    build_format(copy, sizeof(copy), "%s.%d.tmp", output, id);
+    if (!build_copy_file(cached, copy) || !build_replace_file(copy, output))
+    {
+        remove(copy);
+        build_error("Cannot write", output);
+    }
+}
+
+#endif
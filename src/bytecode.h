@@ -0,0 +1,167 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "array.h"
+
+enum Opcode
+{
+    OPCODE_PUSH,
+    OPCODE_LOAD,
+    OPCODE_STORE,
+    OPCODE_POP,
+    OPCODE_PLUS,
+    OPCODE_MINUS,
+    OPCODE_GT,
+    OPCODE_MODULO,
+    OPCODE_EQUAL,
+    OPCODE_OR,
+    OPCODE_PRINT,
+    OPCODE_JUMP,
+    OPCODE_JUMP_IF_ZERO,
+    OPCODE_JUMP_IF_NOT_ZERO,
+    OPCODE_HALT,
+    OPCODE_LOOP,
+    OPCODE_COUNT
+};
+
+// A single bytecode instruction. The meaning of the operand depends on the opcode:
+// the literal value for PUSH, the frame slot for LOAD and STORE, the number of values
+// for POP, the target instruction index for the jumps and the index into 'loops' for LOOP,
+// which starts every iteration of a loop.
+struct Instruction
+{
+    uint8_t opcode;
+    int32_t operand;
+};
+
+Vec_declare(Instruction, struct Instruction);
+Vec_define(Instruction, struct Instruction)
+
+// A loop the simulator counts the iterations of. 'exit' is the instruction that follows the
+// loop, -1 when the loop never ends.
+struct Bytecode_loop
+{
+    int header;
+    int exit;
+};
+
+Vec_declare(Bytecode_loop, struct Bytecode_loop);
+Vec_define(Bytecode_loop, struct Bytecode_loop)
+
+struct Bytecode
+{
+    Vec(Instruction) instructions;
+    int stack_size;
+    int max_stack_size;
+    int frame_size;
+    // Loops only start with a LOOP instruction when 'count_loops' is set.
+    bool count_loops;
+    Vec(Bytecode_loop) loops;
+};
+
+void Bytecode_init(struct Bytecode *bytecode)
+{
+    Vec_Instruction_init(&bytecode->instructions);
+    bytecode->stack_size = 0;
+    bytecode->max_stack_size = 0;
+    bytecode->frame_size = 0;
+    bytecode->count_loops = false;
+    Vec_Bytecode_loop_init(&bytecode->loops);
+}
+
+void Bytecode_free(struct Bytecode *bytecode)
+{
+    Vec_Instruction_free(&bytecode->instructions);
+    Vec_Bytecode_loop_free(&bytecode->loops);
+}
+
+int Opcode_stack_effect(enum Opcode opcode, int32_t operand)
+{
+    _Static_assert(OPCODE_COUNT == 16, "Exhaustive handling of opcodes");
+    switch (opcode)
+    {
+    case OPCODE_PUSH:
+    case OPCODE_LOAD:
+        return 1;
+    case OPCODE_STORE:
+    case OPCODE_PLUS:
+    case OPCODE_MINUS:
+    case OPCODE_GT:
+    case OPCODE_MODULO:
+    case OPCODE_EQUAL:
+    case OPCODE_OR:
+    case OPCODE_PRINT:
+    case OPCODE_JUMP_IF_ZERO:
+    case OPCODE_JUMP_IF_NOT_ZERO:
+        return -1;
+    case OPCODE_POP:
+        return -operand;
+    case OPCODE_JUMP:
+    case OPCODE_HALT:
+    case OPCODE_LOOP:
+        return 0;
+    default:
+        assert(0 && "unknown opcode in Opcode_stack_effect");
+        return 0;
+    }
+}
+
+// The number of values the instruction takes off the stack before it pushes its result.
+int Opcode_input_count(enum Opcode opcode, int32_t operand)
+{
+    _Static_assert(OPCODE_COUNT == 16, "Exhaustive handling of opcodes");
+    switch (opcode)
+    {
+    case OPCODE_PLUS:
+    case OPCODE_MINUS:
+    case OPCODE_GT:
+    case OPCODE_MODULO:
+    case OPCODE_EQUAL:
+    case OPCODE_OR:
+        return 2;
+    case OPCODE_STORE:
+    case OPCODE_PRINT:
+    case OPCODE_JUMP_IF_ZERO:
+    case OPCODE_JUMP_IF_NOT_ZERO:
+        return 1;
+    case OPCODE_POP:
+        return operand;
+    case OPCODE_PUSH:
+    case OPCODE_LOAD:
+    case OPCODE_JUMP:
+    case OPCODE_HALT:
+    case OPCODE_LOOP:
+        return 0;
+    default:
+        assert(0 && "unknown opcode in Opcode_input_count");
+        return 0;
+    }
+}
+
+// Appends an instruction and returns its index so jumps can be patched later.
+int Bytecode_emit(struct Bytecode *bytecode, enum Opcode opcode, int32_t operand)
+{
+    struct Instruction instruction = {
+        .opcode = (uint8_t)opcode,
+        .operand = operand,
+    };
+    Vec_Instruction_add(&bytecode->instructions, instruction);
+
+    bytecode->stack_size += Opcode_stack_effect(opcode, operand);
+    if (bytecode->stack_size > bytecode->max_stack_size)
+        bytecode->max_stack_size = bytecode->stack_size;
+
+    return bytecode->instructions.length - 1;
+}
+
+void Bytecode_patch_jump(struct Bytecode *bytecode, int jump, int target)
+{
+    struct Instruction *instruction = Vec_Instruction_get(&bytecode->instructions, jump);
+    instruction->operand = target;
+}
+
+#endif
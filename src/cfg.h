@@ -0,0 +1,604 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "array.h"
+#include "expression.h"
+#include "operation.h"
+#include "statement.h"
+
+enum Terminator_type
+{
+    TERMINATOR_JUMP,
+    TERMINATOR_BRANCH,
+    TERMINATOR_HALT,
+    TERMINATOR_COUNT
+};
+
+// A straight line of statements that ends in a jump, a conditional branch or the end of the
+// program. Only expressions, variable declarations and assignments appear in 'statements'.
+// The statements and the condition point into the program the graph was built from. Blocks
+// without any statements do not allocate the array.
+//
+// The blocks keep the structure of the program they were built from, so that the backends
+// can turn them back into nested code. A branch or a loop header names its 'merge' block, the
+// block where control continues once the if or the loop is done. A loop header tests its
+// condition, its 'target' is the loop body and its 'else_target' the merge block.
+struct Block
+{
+    Vec(Statement_pointer) statements;
+    enum Terminator_type terminator;
+    struct Expression *condition;
+    int target;
+    int else_target;
+    int merge;
+    bool is_loop_header;
+};
+
+Vec_declare(Block, struct Block);
+Vec_define(Block, struct Block)
+
+// The control flow graph of a whole program. The entry is always block 0.
+struct Cfg
+{
+    Vec(Block) blocks;
+    struct Arena *arena;
+    int frame_size;
+};
+
+struct Block *Cfg_block(struct Cfg *cfg, int index)
+{
+    return Vec_Block_get(&cfg->blocks, index);
+}
+
+struct Statement *Cfg_statement(struct Block *block, int index)
+{
+    return *Vec_Statement_pointer_get(&block->statements, index);
+}
+
+void Cfg_add_statement(struct Cfg *cfg, struct Block *block, struct Statement *statement)
+{
+    if (block->statements.data == NULL)
+        Vec_Statement_pointer_init_arena(&block->statements, cfg->arena);
+    Vec_Statement_pointer_add(&block->statements, statement);
+}
+
+int Cfg_add_block(struct Cfg *cfg)
+{
+    struct Block block = {
+        .terminator = TERMINATOR_HALT,
+        .target = -1,
+        .else_target = -1,
+        .merge = -1,
+        .is_loop_header = false,
+    };
+    memset(&block.statements, 0, sizeof(block.statements));
+    Vec_Block_add(&cfg->blocks, block);
+    return cfg->blocks.length - 1;
+}
+
+void Cfg_jump(struct Cfg *cfg, int from, int to)
+{
+    struct Block *block = Cfg_block(cfg, from);
+    block->terminator = TERMINATOR_JUMP;
+    block->target = to;
+}
+
+void Cfg_branch(struct Cfg *cfg, int from, struct Expression *condition, int target, int else_target, int merge)
+{
+    struct Block *block = Cfg_block(cfg, from);
+    block->terminator = TERMINATOR_BRANCH;
+    block->condition = condition;
+    block->target = target;
+    block->else_target = else_target;
+    block->merge = merge;
+}
+
+// A statement whose nested statements are being added to the graph. Once they are, control
+// jumps from the block they end in to 'jump', unless it is -1, and continues in 'resume'. A
+// block statement adds its statements from index 'next' on.
+struct Cfg_frame
+{
+    struct Statement *statement;
+    int next;
+    int jump;
+    int resume;
+};
+
+Vec_declare(Cfg_frame, struct Cfg_frame);
+Vec_define(Cfg_frame, struct Cfg_frame)
+
+// Adds 'statement' to the graph, starting in block 'current'. Returns the block in which
+// control continues after the statement. The statements that wait for the ones nested in them
+// are kept in 'frames' instead of the C stack.
+int Cfg_build_statement(struct Cfg *cfg, int current, struct Statement *statement, Vec(Cfg_frame) *frames)
+{
+    int base = frames->length;
+    for (;;)
+    {
+        _Static_assert(STATEMENT_TYPE_COUNT == 6, "Exhaustive handling of statement types");
+        switch (statement->type)
+        {
+        case STATEMENT_TYPE_EXP:
+        case STATEMENT_TYPE_SET:
+            Cfg_add_statement(cfg, Cfg_block(cfg, current), statement);
+            break;
+        case STATEMENT_TYPE_VAR:
+            if (statement->var.identifier.identifier.slot >= cfg->frame_size)
+                cfg->frame_size = statement->var.identifier.identifier.slot + 1;
+            Cfg_add_statement(cfg, Cfg_block(cfg, current), statement);
+            break;
+        case STATEMENT_TYPE_IF:
+            int if_then = Cfg_add_block(cfg);
+            int if_merge = Cfg_add_block(cfg);
+            Cfg_branch(cfg, current, &statement->iff.condition, if_then, if_merge, if_merge);
+            Vec_Cfg_frame_add(frames, (struct Cfg_frame){.statement = statement, .jump = if_merge, .resume = if_merge});
+            current = if_then;
+            statement = statement->iff.action;
+            continue;
+        case STATEMENT_TYPE_WHILE:
+            int while_header = Cfg_add_block(cfg);
+            int while_body = Cfg_add_block(cfg);
+            int while_merge = Cfg_add_block(cfg);
+            Cfg_jump(cfg, current, while_header);
+            Cfg_branch(cfg, while_header, &statement->whilee.condition, while_body, while_merge, while_merge);
+            Cfg_block(cfg, while_header)->is_loop_header = true;
+            Vec_Cfg_frame_add(frames, (struct Cfg_frame){.statement = statement, .jump = while_header, .resume = while_merge});
+            current = while_body;
+            statement = statement->whilee.action;
+            continue;
+        case STATEMENT_TYPE_BLOCK:
+            if (statement->block.statements.length == 0)
+                break;
+            Vec_Cfg_frame_add(frames, (struct Cfg_frame){.statement = statement, .next = 1, .jump = -1});
+            statement = Vec_Statement_get(&statement->block.statements, 0);
+            continue;
+        default:
+            fprintf(stderr, "ERROR: Statement type '%d' not implemented yet in 'Cfg_build_statement'.\n", statement->type);
+            exit(1);
+        }
+
+        // The statement is complete, which can complete the statements it is nested in.
+        while (frames->length > base)
+        {
+            struct Cfg_frame *frame = Vec_Cfg_frame_top(frames);
+            if (frame->jump == -1)
+            {
+                Vec(Statement) *statements = &frame->statement->block.statements;
+                if (frame->next < statements->length)
+                {
+                    statement = Vec_Statement_get(statements, frame->next++);
+                    break;
+                }
+            }
+            else
+            {
+                Cfg_jump(cfg, current, frame->jump);
+                current = frame->resume;
+            }
+            Vec_Cfg_frame_pop(frames);
+        }
+        if (frames->length == base)
+            return current;
+    }
+}
+
+void Cfg_build(struct Cfg *cfg, Vec(Statement) *program, struct Arena *arena)
+{
+    Vec_Block_init_arena(&cfg->blocks, arena);
+    cfg->arena = arena;
+    cfg->frame_size = 0;
+
+    Vec(Cfg_frame) frames;
+    Vec_Cfg_frame_init(&frames);
+    int current = Cfg_add_block(cfg);
+    for (int i = 0; i < program->length; i++)
+        current = Cfg_build_statement(cfg, current, Vec_Statement_get(program, i), &frames);
+    Cfg_block(cfg, current)->terminator = TERMINATOR_HALT;
+    Vec_Cfg_frame_free(&frames);
+}
+
+// Calls 'visit' with every edge that leaves 'block'.
+#define Cfg_for_each_successor(block, successor, visit)  \
+    {                                                     \
+        int successor;                                    \
+        if ((block)->terminator != TERMINATOR_HALT)       \
+        {                                                 \
+            successor = (block)->target;                  \
+            visit;                                        \
+        }                                                 \
+        if ((block)->terminator == TERMINATOR_BRANCH)     \
+        {                                                 \
+            successor = (block)->else_target;             \
+            visit;                                        \
+        }                                                 \
+    }
+
+// Counts the edges that lead into every block.
+int *Cfg_predecessor_counts(struct Cfg *cfg)
+{
+    int *counts = calloc(cfg->blocks.length + 1, sizeof(int));
+    if (counts == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < cfg->blocks.length; i++)
+        Cfg_for_each_successor(Cfg_block(cfg, i), successor, counts[successor]++);
+    return counts;
+}
+
+// A condition that was folded to a single literal always takes the same way.
+bool Cfg_constant_condition(struct Expression *condition, bool *value)
+{
+    if (condition->operations.length != 1)
+        return false;
+    struct Operation *op = Vec_Operation_get(&condition->operations, 0);
+    if (op->type != OPERATION_TYPE_VALUE)
+        return false;
+    *value = op->literal.value != 0;
+    return true;
+}
+
+// Turns branches with a constant condition into jumps. Returns whether anything changed.
+bool Cfg_fold_branches(struct Cfg *cfg)
+{
+    bool changed = false;
+    for (int i = 0; i < cfg->blocks.length; i++)
+    {
+        struct Block *block = Cfg_block(cfg, i);
+        if (block->terminator != TERMINATOR_BRANCH)
+            continue;
+
+        bool value;
+        if (Cfg_constant_condition(block->condition, &value))
+        {
+            block->terminator = TERMINATOR_JUMP;
+            if (!value)
+                block->target = block->else_target;
+            // A loop whose condition always holds stays a loop, one that never runs does not.
+            if (!block->is_loop_header || !value)
+            {
+                block->is_loop_header = false;
+                block->merge = -1;
+            }
+            changed = true;
+        }
+        else if (block->target == block->else_target && !block->is_loop_header)
+        {
+            block->terminator = TERMINATOR_JUMP;
+            block->merge = -1;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Drops every block that cannot be reached from the entry and renumbers the others.
+bool Cfg_remove_unreachable(struct Cfg *cfg)
+{
+    int count = cfg->blocks.length;
+    int *new_index = malloc(sizeof(int) * count);
+    int *work = malloc(sizeof(int) * count);
+    if (new_index == NULL || work == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < count; i++)
+        new_index[i] = -1;
+
+    int work_size = 0;
+    new_index[0] = 0;
+    work[work_size++] = 0;
+    while (work_size > 0)
+    {
+        struct Block *block = Cfg_block(cfg, work[--work_size]);
+        Cfg_for_each_successor(block, successor, {
+            if (new_index[successor] == -1)
+            {
+                new_index[successor] = 0;
+                work[work_size++] = successor;
+            }
+        });
+    }
+
+    int reachable = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (new_index[i] == -1)
+            continue;
+        new_index[i] = reachable;
+        if (i != reachable)
+            memcpy(Cfg_block(cfg, reachable), Cfg_block(cfg, i), sizeof(struct Block));
+        reachable++;
+    }
+    cfg->blocks.length = reachable;
+
+    for (int i = 0; i < reachable; i++)
+    {
+        struct Block *block = Cfg_block(cfg, i);
+        if (block->target != -1)
+            block->target = new_index[block->target];
+        if (block->else_target != -1)
+            block->else_target = new_index[block->else_target];
+        if (block->merge != -1)
+            block->merge = new_index[block->merge];
+    }
+
+    free(new_index);
+    free(work);
+    return reachable != count;
+}
+
+// Appends a block to the block that jumps to it when nothing else leads there. The block
+// must not be a loop header or the merge block of a branch or a loop.
+bool Cfg_merge_blocks(struct Cfg *cfg)
+{
+    int *predecessors = Cfg_predecessor_counts(cfg);
+    int *merges = calloc(cfg->blocks.length + 1, sizeof(int));
+    if (merges == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < cfg->blocks.length; i++)
+    {
+        struct Block *block = Cfg_block(cfg, i);
+        if (block->merge != -1)
+            merges[block->merge]++;
+    }
+
+    bool changed = false;
+    for (int i = 0; i < cfg->blocks.length; i++)
+    {
+        struct Block *block = Cfg_block(cfg, i);
+        if (block->is_loop_header)
+            continue;
+        while (block->terminator == TERMINATOR_JUMP)
+        {
+            int next_index = block->target;
+            struct Block *next = Cfg_block(cfg, next_index);
+            if (next_index == i || next_index == 0 || predecessors[next_index] != 1 ||
+                merges[next_index] != 0 || next->is_loop_header)
+                break;
+
+            for (int j = 0; j < next->statements.length; j++)
+                Cfg_add_statement(cfg, block, Cfg_statement(next, j));
+            block->terminator = next->terminator;
+            block->condition = next->condition;
+            block->target = next->target;
+            block->else_target = next->else_target;
+            block->merge = next->merge;
+
+            // The block is left behind without any edge leading to it.
+            predecessors[next_index] = 0;
+            next->terminator = TERMINATOR_HALT;
+            next->merge = -1;
+            changed = true;
+        }
+    }
+
+    free(predecessors);
+    free(merges);
+    if (changed)
+        Cfg_remove_unreachable(cfg);
+    return changed;
+}
+
+#define CFG_UNSWITCH_MAX_STATEMENTS 64
+#define CFG_UNSWITCH_MAX_COUNT 16
+
+// Collects the blocks of the loop with header 'header': every block that can be reached
+// from the body without going through the header again. 'position' maps every block of the
+// loop to its index in 'blocks' and every other block to -1. Gives up and returns -1 when the
+// loop holds more than 'max_statements' statements.
+int Cfg_loop_blocks(struct Cfg *cfg, int header, int *position, int *blocks, int max_statements)
+{
+    int count = 0;
+    int statement_count = 0;
+    position[header] = count;
+    blocks[count++] = header;
+    for (int i = 0; i < count && statement_count <= max_statements; i++)
+    {
+        struct Block *block = Cfg_block(cfg, blocks[i]);
+        statement_count += block->statements.length;
+        Cfg_for_each_successor(block, successor, {
+            if (position[successor] == -1 && !(blocks[i] == header && successor == block->merge))
+            {
+                position[successor] = count;
+                blocks[count++] = successor;
+            }
+        });
+    }
+    if (statement_count <= max_statements)
+        return count;
+
+    for (int i = 0; i < count; i++)
+        position[blocks[i]] = -1;
+    return -1;
+}
+
+// Whether 'condition' always gives the same value inside the loop made of 'blocks'. It
+// may only read variables that the loop does not write. It must not print or fail either,
+// because the unswitched loop evaluates it once before the loop, even when the loop does not
+// run at all.
+bool Cfg_is_loop_invariant(struct Cfg *cfg, struct Expression *condition, int *blocks, int count)
+{
+    for (int i = 0; i < condition->operations.length; i++)
+    {
+        struct Operation *op = Vec_Operation_get(&condition->operations, i);
+        if (op->type == OPERATION_TYPE_INTRINSIC &&
+            (op->intrinsic.type == INTRINSIC_TYPE_MODULO || op->intrinsic.type == INTRINSIC_TYPE_PRINT))
+            return false;
+        if (op->type != OPERATION_TYPE_IDENTIFIER)
+            continue;
+
+        for (int j = 0; j < count; j++)
+        {
+            struct Block *block = Cfg_block(cfg, blocks[j]);
+            for (int k = 0; k < block->statements.length; k++)
+            {
+                struct Statement *statement = Cfg_statement(block, k);
+                if (statement->type == STATEMENT_TYPE_VAR && statement->var.identifier.identifier.slot == op->identifier.slot)
+                    return false;
+                if (statement->type == STATEMENT_TYPE_SET && statement->set.identifier.identifier.slot == op->identifier.slot)
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Copies the loop made of 'blocks' and moves the branch in block 'branch' in front of it:
+//     while c do ... if k do A end ... end
+// becomes
+//     if k do while c do ... A ... end end else while c do ... end end
+void Cfg_unswitch(struct Cfg *cfg, int header, int branch, int *position, int *blocks, int count)
+{
+    // Copy the loop. Edges that stay inside of the loop lead to the copies.
+    int first_copy = cfg->blocks.length;
+    for (int i = 0; i < count; i++)
+        Cfg_add_block(cfg);
+    for (int i = 0; i < count; i++)
+    {
+        struct Block *original = Cfg_block(cfg, blocks[i]);
+        struct Block *copy = Cfg_block(cfg, first_copy + i);
+        Vec(Statement_pointer) statements = copy->statements;
+        *copy = *original;
+        copy->statements = statements;
+        for (int j = 0; j < original->statements.length; j++)
+            Cfg_add_statement(cfg, copy, Cfg_statement(original, j));
+        if (copy->target != -1 && position[copy->target] != -1)
+            copy->target = first_copy + position[copy->target];
+        if (copy->else_target != -1 && position[copy->else_target] != -1)
+            copy->else_target = first_copy + position[copy->else_target];
+        if (copy->merge != -1 && position[copy->merge] != -1)
+            copy->merge = first_copy + position[copy->merge];
+    }
+
+    // The original loop only takes the branch, the copy never does.
+    struct Block *taken = Cfg_block(cfg, branch);
+    struct Expression *condition = taken->condition;
+    taken->terminator = TERMINATOR_JUMP;
+    taken->merge = -1;
+    struct Block *not_taken = Cfg_block(cfg, first_copy + position[branch]);
+    not_taken->terminator = TERMINATOR_JUMP;
+    not_taken->target = not_taken->else_target;
+    not_taken->merge = -1;
+
+    // Everything that entered the loop now enters the test in front of it.
+    int test = Cfg_add_block(cfg);
+    for (int i = 0; i < first_copy; i++)
+    {
+        if (position[i] != -1)
+            continue;
+        struct Block *block = Cfg_block(cfg, i);
+        if (block->target == header)
+            block->target = test;
+        if (block->else_target == header)
+            block->else_target = test;
+        if (block->merge == header)
+            block->merge = test;
+    }
+
+    // Both loops leave through a new block of their own. That way no two branches share their
+    // merge block, not even when one of the loops is unswitched again.
+    int exit = Cfg_block(cfg, header)->merge;
+    int join = exit;
+    if (exit != -1)
+    {
+        join = Cfg_add_block(cfg);
+        Cfg_jump(cfg, join, exit);
+        int loop_headers[2] = {header, first_copy + position[header]};
+        for (int i = 0; i < 2; i++)
+        {
+            struct Block *loop_header = Cfg_block(cfg, loop_headers[i]);
+            if (loop_header->else_target == exit)
+                loop_header->else_target = join;
+            loop_header->merge = join;
+        }
+    }
+    Cfg_branch(cfg, test, condition, header, first_copy, join);
+}
+
+// Unswitches loops that hold a branch whose condition does not change inside of them. Every
+// unswitched loop is copied, so only small loops are unswitched and at most
+// CFG_UNSWITCH_MAX_COUNT of them. Returns whether a loop was unswitched.
+bool Cfg_unswitch_loops(struct Cfg *cfg)
+{
+    int capacity = 0;
+    int *position = NULL;
+    int *blocks = NULL;
+
+    int unswitched = 0;
+    for (int header = 0; header < cfg->blocks.length && unswitched < CFG_UNSWITCH_MAX_COUNT; header++)
+    {
+        if (!Cfg_block(cfg, header)->is_loop_header)
+            continue;
+
+        // Copies are added behind the existing blocks, so the scratch arrays grow with them.
+        if (capacity < cfg->blocks.length)
+        {
+            capacity = cfg->blocks.length * 2;
+            free(position);
+            free(blocks);
+            position = malloc(sizeof(int) * capacity);
+            blocks = malloc(sizeof(int) * capacity);
+            if (position == NULL || blocks == NULL)
+            {
+                fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+                exit(1);
+            }
+            for (int i = 0; i < capacity; i++)
+                position[i] = -1;
+        }
+
+        int count = Cfg_loop_blocks(cfg, header, position, blocks, CFG_UNSWITCH_MAX_STATEMENTS);
+        if (count == -1)
+            continue;
+
+        int branch = -1;
+        for (int i = 1; i < count && branch == -1; i++)
+        {
+            struct Block *block = Cfg_block(cfg, blocks[i]);
+            if (block->terminator == TERMINATOR_BRANCH && !block->is_loop_header &&
+                Cfg_is_loop_invariant(cfg, block->condition, blocks, count))
+                branch = blocks[i];
+        }
+        if (branch != -1)
+        {
+            Cfg_unswitch(cfg, header, branch, position, blocks, count);
+            unswitched++;
+            // The loop may hold another branch that can be moved out.
+            header--;
+        }
+        for (int i = 0; i < count; i++)
+            position[blocks[i]] = -1;
+    }
+
+    free(position);
+    free(blocks);
+    return unswitched > 0;
+}
+
+// Runs the control flow passes. Unswitching leaves jumps behind that the other passes clean up.
+void Cfg_optimize(struct Cfg *cfg)
+{
+    Cfg_fold_branches(cfg);
+    Cfg_remove_unreachable(cfg);
+    Cfg_merge_blocks(cfg);
+    if (Cfg_unswitch_loops(cfg))
+    {
+        Cfg_fold_branches(cfg);
+        Cfg_remove_unreachable(cfg);
+        Cfg_merge_blocks(cfg);
+    }
+}
+
+#endif
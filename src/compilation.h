@@ -1,290 +1,410 @@
 #pragma once
 
-#include "array.h"
-#include "expression.h"
-#include "statement.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 
-#define com_error(location, ...)                                                                 \
-    {                                                                                            \
-        fprintf(stderr, "%s:%d:%d ERROR: ", location.filename, location.line, location.collumn); \
-        fprintf(stderr, __VA_ARGS__);                                                            \
-        exit(1);                                                                                 \
+#include "cfg.h"
+#include "evaluation.h"
+#include "ir.h"
+
+#define com_error(location, ...)                                                                                   \
+    {                                                                                                              \
+        struct Location error_location = (location);                                                               \
+        fprintf(stderr, "%s:%d:%d ERROR: ", error_location.filename, error_location.line, error_location.collumn); \
+        fprintf(stderr, __VA_ARGS__);                                                                              \
+        exit(1);                                                                                                   \
     }
 
-#define fprintf_i(file, indent, ...)       \
-    fprintf(file, "%*s", indent * 4, " "); \
+// Code that is nested deeper than this is not indented any further, so the output of deeply
+// nested programs stays linear in their size.
+#define COMPILE_MAX_INDENT 32
+
+#define fprintf_i(file, indent, ...)                                                                 \
+    fprintf(file, "%*s", ((indent) < COMPILE_MAX_INDENT ? (indent) : COMPILE_MAX_INDENT) * 4, " "); \
     fprintf(file, __VA_ARGS__);
 
-struct Com_identifier
+// Values of type int are computed with the same 64 bit unsigned arithmetic the simulator uses,
+// so both give the same results when a number overflows or is compared with a negative one.
+char *compile_type(enum Type_info type)
 {
-    struct Operation *identifier;
-    enum Type_info type;
-};
+    _Static_assert(TYPE_INFO_COUNT == 2, "Exhaustive handling of all types.");
+    switch (type)
+    {
+    case TYPE_INFO_INT:
+        return "uint64_t";
+    case TYPE_INFO_BOOL:
+        return "bool";
+    default:
+        fprintf(stderr, "ERROR: Type '%d' is not yet implemented in 'compile_type'.\n", type);
+        exit(1);
+    }
+}
+
+void compile_operation(FILE *output, struct Ir *ir, int v, bool nested);
+
+// Writes the C expression for 'v'. A value that is only used once is written out where it is
+// used, every other value is read from its variable 'v<index>'.
+void compile_value(FILE *output, struct Ir *ir, int v, bool nested)
+{
+    struct Ir_value *value = Ir_get(ir, v);
+    if (value->opcode != IR_OPCODE_CONSTANT)
+    {
+        if (Ir_is_inlined(ir, v))
+            compile_operation(output, ir, v, nested);
+        else
+            fprintf(output, "v%d", v);
+    }
+    else if (value->type == TYPE_INFO_BOOL)
+        fprintf(output, value->constant ? "true" : "false");
+    // The literal 2147483648 does not fit into a 32 bit long.
+    else if (value->constant == INT32_MIN)
+        fprintf(output, "(-2147483647 - 1)");
+    else if (value->constant < 0)
+        fprintf(output, "(%d)", value->constant);
+    else
+        fprintf(output, "%d", value->constant);
+}
+
+// Writes the operation that computes 'v', in parentheses when it is part of a bigger expression.
+void compile_operation(FILE *output, struct Ir *ir, int v, bool nested)
+{
+    struct Ir_value *value = Ir_get(ir, v);
+    char *symbol;
+    _Static_assert(IR_OPCODE_COUNT == 9, "Exhaustive handling of IR opcodes");
+    switch (value->opcode)
+    {
+    case IR_OPCODE_PLUS:
+        symbol = "+";
+        break;
+    case IR_OPCODE_MINUS:
+        symbol = "-";
+        break;
+    case IR_OPCODE_GT:
+        symbol = ">";
+        break;
+    case IR_OPCODE_MODULO:
+        symbol = "%";
+        break;
+    case IR_OPCODE_EQUAL:
+        symbol = "==";
+        break;
+    case IR_OPCODE_OR:
+        symbol = "||";
+        break;
+    default:
+        fprintf(stderr, "ERROR: IR opcode '%d' is not yet implemented in 'compile_operation'.\n", value->opcode);
+        exit(1);
+    }
 
-struct Com_identifier *get_com_identifier(struct Array *identifiers, char *id)
+    if (nested)
+        fprintf(output, "(");
+    // Two literals would be computed with the 32 bit arithmetic of C.
+    struct Ir_value *l = Ir_get(ir, value->operands[0]);
+    struct Ir_value *r = Ir_get(ir, value->operands[1]);
+    if (l->opcode == IR_OPCODE_CONSTANT && r->opcode == IR_OPCODE_CONSTANT && l->type == TYPE_INFO_INT)
+        fprintf(output, "(uint64_t)");
+    compile_value(output, ir, value->operands[0], true);
+    fprintf(output, " %s ", symbol);
+    compile_value(output, ir, value->operands[1], true);
+    if (nested)
+        fprintf(output, ")");
+}
+
+// Writes the values of 'block' that are not written out where they are used. When the
+// variables of the block are 'declared' already, they are only assigned.
+void compile_block(FILE *output, int indent, struct Ir *ir, int block, bool declared)
 {
-    for (int i = 0; i < identifiers->length; i++)
+    for (int v = ir->blocks[block].first; v != -1; v = Ir_get(ir, v)->next)
     {
-        struct Com_identifier *element = Array_get(identifiers, i);
-        if (strcmp(element->identifier->token, id) == 0)
+        struct Ir_value *value = Ir_get(ir, v);
+        if (value->opcode == IR_OPCODE_PHI || Ir_is_inlined(ir, v))
+            continue;
+
+        if (value->opcode == IR_OPCODE_PRINT)
+        {
+            struct Ir_value *printed = Ir_get(ir, value->operands[0]);
+            fprintf_i(output, indent, "printf(\"%%d\\n\", ");
+            if (printed->type == TYPE_INFO_INT)
+                fprintf(output, "(int32_t)");
+            compile_value(output, ir, value->operands[0], printed->type == TYPE_INFO_INT);
+            fprintf(output, ");\n");
+        }
+        // Only a modulo that may divide by zero is kept without being used.
+        else if (ir->use_counts[v] == 0)
+        {
+            fprintf_i(output, indent, "(void)");
+            compile_operation(output, ir, v, true);
+            fprintf(output, ";\n");
+        }
+        else
         {
-            return element;
+            if (declared)
+            {
+                fprintf_i(output, indent, "v%d = ", v);
+            }
+            else
+            {
+                fprintf_i(output, indent, "%s v%d = ", compile_type(value->type), v);
+            }
+            compile_operation(output, ir, v, false);
+            fprintf(output, ";\n");
         }
     }
-    return NULL;
 }
 
-void compile_expression(FILE *output, int indent, struct Expression exp, int *max_stack_size, struct Array *identifiers)
+// Gives the phis of block 'to' their values for the edge that comes from block 'from'. When
+// an operand reads a phi that would already be written, every operand is read first.
+void compile_edge(FILE *output, int indent, struct Ir *ir, int from, int to)
 {
-    struct Array type_info_stack;
-    Array_init(&type_info_stack, sizeof(enum Type_info));
+    if (to == -1 || !Ir_has_phis(ir, to))
+        return;
+    int edge = Ir_predecessor_index(ir, to, from);
 
-    for (int j = 0; j < exp.operations.length; j++)
+    bool temporaries = !Ir_phi_copies_in_order(ir, to, edge);
+    if (temporaries)
+    {
+        fprintf_i(output, indent, "{\n");
+        indent++;
+    }
+    for (int phi = ir->blocks[to].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
+    {
+        int operand = *Ir_phi_operand(ir, Ir_get(ir, phi), edge);
+        if (operand == phi)
+            continue;
+        if (temporaries)
+        {
+            fprintf_i(output, indent, "%s copy_%d = ", compile_type(Ir_get(ir, phi)->type), phi);
+        }
+        else
+        {
+            fprintf_i(output, indent, "v%d = ", phi);
+        }
+        compile_value(output, ir, operand, false);
+        fprintf(output, ";\n");
+    }
+    if (temporaries)
     {
-        struct Operation *op = Array_get(&exp.operations, j);
-        //_Static_assert(OPERATION_TYPE_COUNT == 3, "Exhaustive handling of Operations");
-        enum TypeInfo *r, *l;
-        switch (op->type)
+        for (int phi = ir->blocks[to].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
         {
-        case OPERATION_TYPE_INTRINSIC:
-            switch (op->intrinsic.type)
+            if (*Ir_phi_operand(ir, Ir_get(ir, phi), edge) != phi)
             {
-            case INTRINSIC_TYPE_PRINT:
-                if (type_info_stack.length < 1)
-                {
-                    fprintf(stderr, "%s:%d:%d ERROR: Not enough values for the print intrinsic\n",
-                            op->loc.filename, op->loc.line, op->loc.collumn);
-                    exit(1);
-                }
-                enum Type_info *print_type = Array_pop(&type_info_stack);
-                switch (*print_type)
-                {
-                case TYPE_INFO_INT:
-                    fprintf_i(output, indent, "printf(\"%%d\\n\", (int32_t)stack_%03d);\n", type_info_stack.length);
-                    break;
-                default:
-                    com_error(op->loc, "Print intrinsic not applicable for type %d.\n", *print_type);
-                    break;
-                }
-                break;
-            case INTRINSIC_TYPE_PLUS:
-                if (type_info_stack.length < 2)
-                {
-                    fprintf(stderr, "%s:%d:%d ERROR: Not enough values for the plus intrinsic\n",
-                            op->loc.filename, op->loc.line, op->loc.collumn);
-                    exit(1);
-                }
-                // TODO: type check
-                r = Array_pop(&type_info_stack);
-                l = Array_pop(&type_info_stack);
-                Array_add(&type_info_stack, l);
-                fprintf_i(output, indent, "stack_%03d = stack_%03d + stack_%03d;\n",
-                          type_info_stack.length - 1, type_info_stack.length - 1, type_info_stack.length);
-                break;
-            case INTRINSIC_TYPE_MINUS:
-                if (type_info_stack.length < 2)
-                {
-                    fprintf(stderr, "%s:%d:%d ERROR: Not enough values for the minus intrinsic\n",
-                            op->loc.filename, op->loc.line, op->loc.collumn);
-                    exit(1);
-                }
-                // TODO: type check
-                r = Array_pop(&type_info_stack);
-                l = Array_pop(&type_info_stack);
-                Array_add(&type_info_stack, l);
-                fprintf_i(output, indent, "stack_%03d = stack_%03d - stack_%03d;\n",
-                          type_info_stack.length - 1, type_info_stack.length - 1, type_info_stack.length);
-                break;
-            case INTRINSIC_TYPE_GT:
-                if (type_info_stack.length < 2)
-                {
-                    fprintf(stderr, "%s:%d:%d ERROR: Not enough values for the greater than intrinsic\n",
-                            op->loc.filename, op->loc.line, op->loc.collumn);
-                    exit(1);
-                }
-                // TODO: type check
-                r = Array_pop(&type_info_stack);
-                l = Array_pop(&type_info_stack);
-                Array_add(&type_info_stack, l);
-                fprintf_i(output, indent, "stack_%03d = stack_%03d > stack_%03d;\n",
-                          type_info_stack.length - 1, type_info_stack.length - 1, type_info_stack.length);
-                break;
-            case INTRINSIC_TYPE_MODULO:
-                if (type_info_stack.length < 2)
+                fprintf_i(output, indent, "v%d = copy_%d;\n", phi, phi);
+            }
+        }
+        indent--;
+        fprintf_i(output, indent, "}\n");
+    }
+}
+
+// A counted loop becomes a for loop when its header computes nothing but the condition, so the
+// C compiler sees the counter, its bound and its step.
+bool compile_is_for_loop(struct Ir *ir, int header)
+{
+    if (ir->counted_loops[header].counter == -1 || ir->use_counts[ir->blocks[header].condition] != 1)
+        return false;
+    for (int v = ir->blocks[header].first; v != -1; v = Ir_get(ir, v)->next)
+    {
+        enum Ir_opcode opcode = Ir_get(ir, v)->opcode;
+        if (opcode != IR_OPCODE_PHI && opcode != IR_OPCODE_CONSTANT && v != ir->blocks[header].condition)
+            return false;
+    }
+    return true;
+}
+
+// A loop or a branch whose nested region is being compiled. 'stop' and 'indent' belong to the
+// region around it.
+struct Compile_frame
+{
+    int block;
+    int stop;
+    int indent;
+    bool for_loop;
+    bool in_else;
+};
+
+Vec_declare(Compile_frame, struct Compile_frame);
+Vec_define(Compile_frame, struct Compile_frame)
+
+// Compiles the blocks from 'index' on until control reaches 'stop' back into nested C
+// statements.
+void compile_region(FILE *output, int indent, struct Ir *ir, int index, int stop)
+{
+    // The loops and branches whose nested regions are being compiled wait here instead of the
+    // C stack.
+    Vec(Compile_frame) frames;
+    Vec_Compile_frame_init(&frames);
+    for (;;)
+    {
+        while (index != stop && index != -1)
+        {
+            struct Block *block = Cfg_block(ir->cfg, index);
+            struct Compile_frame frame = {.block = index, .stop = stop, .indent = indent};
+            if (block->is_loop_header && compile_is_for_loop(ir, index))
+            {
+                struct Ir_counted_loop *loop = &ir->counted_loops[index];
+                fprintf_i(output, indent, "for (; ");
+                compile_value(output, ir, loop->bound, true);
+                fprintf(output, " > v%d; v%d = ", loop->counter, loop->counter);
+                // The next value is computed again here, its variable would be out of scope.
+                compile_operation(output, ir, loop->next, false);
+                fprintf(output, ")\n");
+                fprintf_i(output, indent, "{\n");
+                // The counter gets its next value in the for loop, not at the end of the body.
+                *Ir_phi_operand(ir, Ir_get(ir, loop->counter), loop->back) = loop->counter;
+                frame.for_loop = true;
+                Vec_Compile_frame_add(&frames, frame);
+                indent++;
+                stop = index;
+                index = block->target;
+                continue;
+            }
+            if (block->is_loop_header)
+            {
+                fprintf_i(output, indent, "while (1)\n");
+                fprintf_i(output, indent, "{\n");
+                // The header is left by 'break', the values it computes are declared in front of the loop.
+                compile_block(output, indent + 1, ir, index, true);
+                if (block->terminator == TERMINATOR_BRANCH)
                 {
-                    fprintf(stderr, "%s:%d:%d ERROR: Not enough values for the modulo intrinsic\n",
-                            op->loc.filename, op->loc.line, op->loc.collumn);
-                    exit(1);
+                    fprintf_i(output, (indent + 1), "if (!");
+                    compile_value(output, ir, ir->blocks[index].condition, true);
+                    fprintf(output, ")\n");
+                    fprintf_i(output, (indent + 1), "{\n");
+                    compile_edge(output, indent + 2, ir, index, block->merge);
+                    fprintf_i(output, (indent + 2), "break;\n");
+                    fprintf_i(output, (indent + 1), "}\n");
                 }
-                // TODO: type check
-                r = Array_pop(&type_info_stack);
-                l = Array_pop(&type_info_stack);
-                Array_add(&type_info_stack, l);
-                fprintf_i(output, indent, "stack_%03d = stack_%03d %% stack_%03d;\n",
-                          type_info_stack.length - 1, type_info_stack.length - 1, type_info_stack.length);
+                Vec_Compile_frame_add(&frames, frame);
+                indent++;
+                stop = index;
+                index = block->target;
+                continue;
+            }
+
+            compile_block(output, indent, ir, index, false);
+            _Static_assert(TERMINATOR_COUNT == 3, "Exhaustive handling of terminators");
+            switch (block->terminator)
+            {
+            case TERMINATOR_JUMP:
+                compile_edge(output, indent, ir, index, block->target);
+                index = block->target;
                 break;
-            case INTRINSIC_TYPE_EQUAL:
-                if (type_info_stack.length < 2)
-                {
-                    fprintf(stderr, "%s:%d:%d ERROR: Not enough values for the equal intrinsic\n",
-                            op->loc.filename, op->loc.line, op->loc.collumn);
-                    exit(1);
-                }
-                // TODO: type check
-                r = Array_pop(&type_info_stack);
-                l = Array_pop(&type_info_stack);
-                Array_add(&type_info_stack, l);
-                fprintf_i(output, indent, "stack_%03d = stack_%03d == stack_%03d;\n",
-                          type_info_stack.length - 1, type_info_stack.length - 1, type_info_stack.length);
+            case TERMINATOR_BRANCH:
+                fprintf_i(output, indent, "if (");
+                compile_value(output, ir, ir->blocks[index].condition, false);
+                fprintf(output, ")\n");
+                fprintf_i(output, indent, "{\n");
+                compile_edge(output, indent + 1, ir, index, block->target);
+                Vec_Compile_frame_add(&frames, frame);
+                indent++;
+                stop = block->merge;
+                index = block->target;
                 break;
-            case INTRINSIC_TYPE_OR:
-                if (type_info_stack.length < 2)
-                {
-                    fprintf(stderr, "%s:%d:%d ERROR: Not enough values for the or intrinsic\n",
-                            op->loc.filename, op->loc.line, op->loc.collumn);
-                    exit(1);
-                }
-                // TODO: type check
-                r = Array_pop(&type_info_stack);
-                l = Array_pop(&type_info_stack);
-                Array_add(&type_info_stack, l);
-                fprintf_i(output, indent, "stack_%03d = stack_%03d || stack_%03d;\n",
-                          type_info_stack.length - 1, type_info_stack.length - 1, type_info_stack.length);
+            case TERMINATOR_HALT:
+                // Only the last block of the program halts, 'compile_program' ends 'main' after it.
+                index = -1;
                 break;
             default:
-                fprintf(stderr, "ERROR: Intrinsic of type '%d' is not yet implemented in 'compile_expression'.\n",
-                        op->intrinsic.type);
+                fprintf(stderr, "ERROR: Terminator type '%d' not implemented yet in 'compile_region'\n", block->terminator);
                 exit(1);
-                break;
             }
-            break;
-        case OPERATION_TYPE_VALUE:
-            fprintf_i(output, indent, "%sstack_%03d = %d;\n",
-                      (type_info_stack.length == *max_stack_size) ? "uint64_t " : "",
-                      type_info_stack.length, (int32_t)op->literal.value);
-            Array_add(&type_info_stack, &op->literal.typeInfo);
-            break;
-        case OPERATION_TYPE_IDENTIFIER:
-            fprintf_i(output, indent, "%sstack_%03d = %s;\n",
-                      (type_info_stack.length == *max_stack_size) ? "uint64_t " : "",
-                      type_info_stack.length, op->token);
-            struct Com_identifier *id_id = get_com_identifier(identifiers, op->token);
-            if (id_id == NULL)
-                com_error(op->loc, "Unknown identifier '%s'.\n", op->token);
-            Array_add(&type_info_stack, &id_id->type);
-            break;
-        default:
-            fprintf(stderr, "ERROR: Operation type '%d' is not yet implemented in 'compile_expression'.\n",
-                    op->type);
-            exit(1);
         }
-        if (type_info_stack.length > *max_stack_size)
-            *max_stack_size = type_info_stack.length;
-    }
-    Array_free(&type_info_stack);
-}
+        if (frames.length == 0)
+            break;
 
-void compile_statement(FILE *output, int indent, struct Statement *statement, int *max_stack_size, struct Array *identifiers)
-{
-    switch (statement->type)
-    {
-    case STATEMENT_TYPE_EXP:
-        struct Expression exp = statement->expression;
-        compile_expression(output, indent, exp, max_stack_size, identifiers);
-        break;
-    case STATEMENT_TYPE_IF:
-        compile_expression(output, indent, statement->iff.condition, max_stack_size, identifiers);
-        fprintf_i(output, indent, "if (stack_000 != 0)\n");
-        compile_statement(output, indent, statement->iff.action, max_stack_size, identifiers);
-        break;
-    case STATEMENT_TYPE_WHILE:
-        fprintf_i(output, indent, "while (1)\n");
-        fprintf_i(output, indent, "{\n");
-        compile_expression(output, indent + 1, statement->whilee.condition, max_stack_size, identifiers);
-        fprintf_i(output, (indent + 1), "if(stack_000 == 0)\n");
-        fprintf_i(output, (indent + 2), "break;\n");
-        compile_statement(output, indent + 1, statement->whilee.action, max_stack_size, identifiers);
+        // The nested region is done, the loop or branch it belongs to carries on.
+        struct Compile_frame *frame = Vec_Compile_frame_top(&frames);
+        index = frame->block;
+        stop = frame->stop;
+        indent = frame->indent;
+        struct Block *block = Cfg_block(ir->cfg, index);
         fprintf_i(output, indent, "}\n");
-        break;
-    case STATEMENT_TYPE_VAR:
-        compile_expression(output, indent, statement->var.assignment, max_stack_size, identifiers);
-        struct Com_identifier var_id;
-        var_id.identifier = &statement->var.identifier;
-        // TODO: get type from variable declaration
-        var_id.type = TYPE_INFO_INT;
-        Array_add(identifiers, &var_id);
-        switch (var_id.type)
+        if (frame->for_loop)
         {
-        case TYPE_INFO_INT:
-            fprintf_i(output, indent, "int32_t %s = stack_000;\n", statement->var.identifier.token);
-            break;
-        default:
-            fprintf(stderr, "Type %d not implemented yet in 'compile_statement' 'STATEMENT_TYPE_VAR'.\n", var_id.type);
-            exit(1);
+            struct Ir_counted_loop *loop = &ir->counted_loops[index];
+            *Ir_phi_operand(ir, Ir_get(ir, loop->counter), loop->back) = loop->next;
+            compile_edge(output, indent, ir, index, block->merge);
+            index = block->merge;
         }
-        break;
-    case STATEMENT_TYPE_SET:
-        compile_expression(output, indent, statement->set.assignment, max_stack_size, identifiers);
-        struct Com_identifier *set_id = get_com_identifier(identifiers, statement->set.identifier.token);
-        if (set_id == NULL)
-            com_error(statement->set.identifier.loc, "Unknown identifier '%s'.\n", statement->set.identifier.token);
-        switch (set_id->type)
+        else if (block->is_loop_header)
+            index = block->terminator == TERMINATOR_BRANCH ? block->merge : -1;
+        else if (!frame->in_else && (block->else_target != block->merge || (block->merge != -1 && Ir_has_phis(ir, block->merge))))
         {
-        case TYPE_INFO_INT:
-            fprintf_i(output, indent, "%s = (int32_t)stack_000;\n", statement->set.identifier.token);
-            break;
-        default:
-            fprintf(stderr, "Type %d not implemented yet in 'compile_statement' 'STATEMENT_TYPE_VAR'.\n", set_id->type);
-            exit(1);
+            fprintf_i(output, indent, "else\n");
+            fprintf_i(output, indent, "{\n");
+            compile_edge(output, indent + 1, ir, index, block->else_target);
+            frame->in_else = true;
+            indent++;
+            stop = block->merge;
+            index = block->else_target;
+            continue;
         }
-        break;
-    case STATEMENT_TYPE_BLOCK:
-        fprintf_i(output, indent, "{\n");
-        int prev_stack_size = *max_stack_size;
-        int prev_identifier_length = identifiers->length;
-        for (int i = 0; i < statement->block.statements.length; i++)
-        {
-            struct Statement *block_statement = Array_get(&statement->block.statements, i);
-            compile_statement(output, indent + 1, block_statement, max_stack_size, identifiers);
-        }
-        fprintf_i(output, indent, "}\n");
-        *max_stack_size = prev_stack_size;
-        identifiers->length = prev_identifier_length;
-        break;
-    default:
-        fprintf(stderr, "ERROR: Statement type '%d' not implemented yet in 'compile_program'\n", statement->type);
-        exit(1);
+        else
+            index = block->merge;
+        Vec_Compile_frame_pop(&frames);
     }
+    Vec_Compile_frame_free(&frames);
 }
 
-void compile_program(struct Array *program)
+// Compiles the program into the C file 'path'. With an 'evaluation' the part of the program that
+// already ran only prints its numbers, and the values it computed are the initial values of the
+// variables.
+void compile_program(struct Ir *ir, struct Evaluation *evaluation, const char *path)
 {
     FILE *output;
-    if (fopen_s(&output, "out.c", "w"))
+#ifdef _WIN32
+    if (fopen_s(&output, path, "w"))
+#else
+    if ((output = fopen(path, "w")) == NULL)
+#endif
     {
-        fprintf(stderr, "ERROR: cannot open 'out.c' for writing\n");
+        fprintf(stderr, "ERROR: cannot open '%s' for writing\n", path);
         exit(1);
     }
 
-    struct Array identifiers;
-    Array_init(&identifiers, sizeof(struct Com_identifier));
-
+    fprintf(output, "#include <stdbool.h>\n");
     fprintf(output, "#include <stdio.h>\n");
     fprintf(output, "#include <stdint.h>\n");
     fprintf(output, "#include <inttypes.h>\n");
     fprintf(output, "\n");
     fprintf(output, "int main(int argc, char *argv[])\n");
     fprintf(output, "{\n");
-    int maximum_stack_size = 0;
-    for (int i = 0; i < program->length; i++)
+    Ir_count_uses(ir);
+    Ir_find_counted_loops(ir);
+    // Phis, the values a loop header computes in front of its 'break' and the values the
+    // evaluation computed are declared at the top, every other value where it is computed. When
+    // the whole program was evaluated, no value is left to compute.
+    bool finished = evaluation != NULL && evaluation->resume == -1;
+    for (int b = 0; b < ir->cfg->blocks.length && !finished; b++)
     {
-        struct Statement *statement = Array_get(program, i);
-        compile_statement(output, 1, statement, &maximum_stack_size, &identifiers);
+        bool in_header = Cfg_block(ir->cfg, b)->is_loop_header && !compile_is_for_loop(ir, b);
+        for (int v = ir->blocks[b].first; v != -1; v = Ir_get(ir, v)->next)
+        {
+            struct Ir_value *value = Ir_get(ir, v);
+            bool evaluated = evaluation != NULL && evaluation->evaluated[v];
+            if (value->opcode != IR_OPCODE_PHI && (!Ir_is_binary(value->opcode) || Ir_is_inlined(ir, v) || ir->use_counts[v] == 0 || !(in_header || evaluated)))
+                continue;
+            fprintf(output, "    %s v%d = ", compile_type(value->type), v);
+            if (!evaluated)
+                fprintf(output, value->type == TYPE_INFO_BOOL ? "false;\n" : "0;\n");
+            else if (value->type == TYPE_INFO_BOOL)
+                fprintf(output, evaluation->values[v] ? "true;\n" : "false;\n");
+            else
+                fprintf(output, "%" PRIu64 "u;\n", evaluation->values[v]);
+        }
+    }
+    if (evaluation == NULL)
+        compile_region(output, 1, ir, 0, -1);
+    else
+    {
+        for (int i = 0; i < evaluation->output.length; i++)
+            fprintf(output, "    puts(\"%d\");\n", *Vec_int32_t_get(&evaluation->output, i));
+        if (evaluation->resume != -1)
+            compile_region(output, 1, ir, evaluation->resume, -1);
     }
     fprintf(output, "    return 0;\n");
     fprintf(output, "}\n");
     fclose(output);
-
-    Array_free(&identifiers);
-    return;
-}
\ No newline at end of file
+}
@@ -0,0 +1,210 @@
+#ifndef EVALUATION_H
+#define EVALUATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "cfg.h"
+#include "ir.h"
+
+// Partial evaluation runs the start of a program while it is compiled. A program reads no
+// input, so every run of it computes the same values and prints the same numbers. The compiled
+// program only has to print those numbers and can carry on where the evaluation stopped.
+//
+// The evaluation only stops at the top level of the program, in front of a statement that is
+// not nested in an if or a loop. The values that were computed up to there are the values
+// every later block sees.
+Vec_declare(int32_t, int32_t);
+Vec_define(int32_t, int32_t)
+
+struct Evaluation
+{
+    // The top level block the compiled program carries on with, -1 when the whole program ran.
+    int resume;
+    // The value every IR value had when the evaluation stopped, 'evaluated' tells which ones
+    // were computed at all.
+    uint64_t *values;
+    bool *evaluated;
+    // The numbers the evaluated part of the program printed.
+    Vec(int32_t) output;
+};
+
+// Computes the values of block 'block'. Every computed value takes a step. Returns false when
+// the steps run out or a modulo divides by zero, which is left to the compiled program.
+bool Evaluation_run_block(struct Evaluation *evaluation, struct Ir *ir, int block, long *steps)
+{
+    uint64_t *values = evaluation->values;
+    for (int v = ir->blocks[block].first; v != -1; v = Ir_get(ir, v)->next)
+    {
+        struct Ir_value *value = Ir_get(ir, v);
+        if (value->opcode == IR_OPCODE_PHI)
+            continue;
+        if (*steps == 0)
+            return false;
+        (*steps)--;
+
+        uint64_t result;
+        _Static_assert(IR_OPCODE_COUNT == 9, "Exhaustive handling of IR opcodes");
+        switch (value->opcode)
+        {
+        case IR_OPCODE_CONSTANT:
+            result = (uint64_t)(int64_t)value->constant;
+            break;
+        case IR_OPCODE_PLUS:
+            result = values[value->operands[0]] + values[value->operands[1]];
+            break;
+        case IR_OPCODE_MINUS:
+            result = values[value->operands[0]] - values[value->operands[1]];
+            break;
+        case IR_OPCODE_GT:
+            result = values[value->operands[0]] > values[value->operands[1]];
+            break;
+        case IR_OPCODE_MODULO:
+            if (values[value->operands[1]] == 0)
+                return false;
+            result = values[value->operands[0]] % values[value->operands[1]];
+            break;
+        case IR_OPCODE_EQUAL:
+            result = values[value->operands[0]] == values[value->operands[1]];
+            break;
+        case IR_OPCODE_OR:
+            result = values[value->operands[0]] || values[value->operands[1]];
+            break;
+        case IR_OPCODE_PRINT:
+            result = 0;
+            int32_t printed = (int32_t)values[value->operands[0]];
+            Vec_int32_t_add(&evaluation->output, printed);
+            break;
+        default:
+            fprintf(stderr, "ERROR: IR opcode '%d' is not yet implemented in 'Evaluation_run_block'.\n", value->opcode);
+            exit(1);
+        }
+        values[v] = result;
+        evaluation->evaluated[v] = true;
+    }
+    return true;
+}
+
+// Gives the phis of block 'to' their values for the edge from block 'from'. All operands are
+// read before any phi is written, 'pending' holds them in between.
+void Evaluation_take_edge(struct Evaluation *evaluation, struct Ir *ir, int from, int to, uint64_t *pending)
+{
+    if (!Ir_has_phis(ir, to))
+        return;
+    int edge = Ir_predecessor_index(ir, to, from);
+    for (int phi = ir->blocks[to].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
+        pending[phi] = evaluation->values[*Ir_phi_operand(ir, Ir_get(ir, phi), edge)];
+    for (int phi = ir->blocks[to].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
+    {
+        evaluation->values[phi] = pending[phi];
+        evaluation->evaluated[phi] = true;
+    }
+}
+
+// Runs the program from its start. 'order' numbers the top level blocks in the order control
+// reaches them and is -1 for every other block. The run ends when it reaches the top level
+// block with number 'stop', when the program halts or when something stops 'Evaluation_run_block'.
+// Returns the number of the last top level block that was reached, 'count' when the program
+// halted.
+int Evaluation_run(struct Evaluation *evaluation, struct Ir *ir, int *order, int count, int stop, long steps, uint64_t *pending)
+{
+    memset(evaluation->evaluated, 0, sizeof(bool) * ir->values.length);
+    evaluation->output.length = 0;
+
+    int reached = 0;
+    int block = 0;
+    while (reached != stop)
+    {
+        if (!Evaluation_run_block(evaluation, ir, block, &steps))
+            return reached;
+
+        struct Block *cfg_block = Cfg_block(ir->cfg, block);
+        int next;
+        _Static_assert(TERMINATOR_COUNT == 3, "Exhaustive handling of terminators");
+        switch (cfg_block->terminator)
+        {
+        case TERMINATOR_JUMP:
+            next = cfg_block->target;
+            break;
+        case TERMINATOR_BRANCH:
+            next = evaluation->values[ir->blocks[block].condition] != 0 ? cfg_block->target : cfg_block->else_target;
+            break;
+        case TERMINATOR_HALT:
+            return count;
+        default:
+            fprintf(stderr, "ERROR: Terminator type '%d' not implemented yet in 'Evaluation_run'\n", cfg_block->terminator);
+            exit(1);
+        }
+
+        // Loops without any values in them still use up steps.
+        if (steps == 0)
+            return reached;
+        steps--;
+
+        Evaluation_take_edge(evaluation, ir, block, next, pending);
+        if (order[next] > reached)
+            reached = order[next];
+        block = next;
+    }
+    return reached;
+}
+
+// Evaluates as much of the program as 'steps' computed values allow.
+void Evaluation_run_program(struct Evaluation *evaluation, struct Ir *ir, long steps)
+{
+    int block_count = ir->cfg->blocks.length;
+    evaluation->values = calloc(ir->values.length + 1, sizeof(uint64_t));
+    evaluation->evaluated = calloc(ir->values.length + 1, sizeof(bool));
+    uint64_t *pending = malloc(sizeof(uint64_t) * (ir->values.length + 1));
+    int *order = malloc(sizeof(int) * (block_count + 1));
+    int *top_level = malloc(sizeof(int) * (block_count + 1));
+    if (evaluation->values == NULL || evaluation->evaluated == NULL || pending == NULL || order == NULL || top_level == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    Vec_int32_t_init(&evaluation->output);
+
+    // Walk the top level of the program the way the backends do.
+    for (int i = 0; i < block_count; i++)
+        order[i] = -1;
+    int count = 0;
+    for (int index = 0; index != -1;)
+    {
+        order[index] = count;
+        top_level[count++] = index;
+        struct Block *block = Cfg_block(ir->cfg, index);
+        if (block->is_loop_header)
+            index = block->terminator == TERMINATOR_BRANCH ? block->merge : -1;
+        else if (block->terminator == TERMINATOR_JUMP)
+            index = block->target;
+        else if (block->terminator == TERMINATOR_BRANCH)
+            index = block->merge;
+        else
+            index = -1;
+    }
+
+    // The first run finds out how far the program gets. The values it leaves behind can belong
+    // to a later block than that, so the second run stops right at it.
+    int reached = Evaluation_run(evaluation, ir, order, count, -1, steps, pending);
+    if (reached < count)
+        Evaluation_run(evaluation, ir, order, count, reached, steps, pending);
+    evaluation->resume = reached < count ? top_level[reached] : -1;
+
+    free(pending);
+    free(order);
+    free(top_level);
+}
+
+void Evaluation_free(struct Evaluation *evaluation)
+{
+    free(evaluation->values);
+    free(evaluation->evaluated);
+    Vec_int32_t_free(&evaluation->output);
+}
+
+#endif
@@ -1,31 +1,26 @@
 #ifndef EXPRESSION_H
 #define EXPRESSION_H
 
+#include "arena.h"
 #include "array.h"
 #include "operation.h"
-#include "iterator.h"
 #include "typeInfo.h"
 
+Vec_declare(Operation, struct Operation);
+Vec_define(Operation, struct Operation)
+Vec_declare(Type_info, enum Type_info);
+Vec_define(Type_info, enum Type_info)
+
 struct Expression
 {
-    struct Array operations;
-    struct Array outputs;
+    Vec(Operation) operations;
+    Vec(Type_info) outputs;
     int nr_outputs;
 };
 
-void Expression_init(struct Expression *exp)
-{
-    Array_init(&exp->operations, sizeof(struct Operation));
-    Array_init(&exp->outputs, sizeof(enum Type_info));
-}
-
-void Expression_free(struct Expression *exp)
+void Expression_init(struct Expression *exp, struct Arena *arena)
 {
-    for (int i = 0; i < exp->operations.length; i++)
-    {
-        Operation_free(Array_get(&exp->operations, i));
-    }
-    Array_free(&exp->operations);
-    Array_free(&exp->outputs);
+    Vec_Operation_init_arena(&exp->operations, arena);
+    Vec_Type_info_init_arena(&exp->outputs, arena);
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,336 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "ir.h"
+#include "simulation.h"
+
+// A program image is the bytecode of a program that was already parsed, type checked,
+// optimized and lowered, so 'betsy run' can start simulating it right away. 'betsy pack' writes
+// it. The image is a header followed by the instructions exactly as the simulator keeps them in
+// memory, so running it maps the file and simulates the instructions where they are. Jumps are
+// instruction indices and literals are operands of PUSH, so nothing in the image depends on
+// where it is mapped and there is no constant pool to load.
+//
+// Images are written in the byte order and layout of the machine that packs them and only run
+// on machines that share both. Loops are not counted in an image, since compiling hot loops
+// needs the IR, which is not in it.
+#if !defined(_WIN32)
+#define IMAGE_MAPPED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define IMAGE_MAGIC "BETSYIMG"
+#define IMAGE_VERSION 1
+// Reads back as another number on a machine with a different byte order.
+#define IMAGE_BYTE_ORDER 0x01020304u
+
+struct Image_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t instruction_size;
+    uint32_t instruction_count;
+    uint32_t frame_size;
+    uint32_t max_stack_size;
+};
+
+_Static_assert(sizeof(struct Image_header) % 8 == 0, "The instructions of an image have to stay aligned");
+
+struct Image
+{
+    // The whole file, mapped or read into memory.
+    void *data;
+    size_t size;
+    // Its instructions are the ones in 'data'.
+    struct Bytecode bytecode;
+};
+
+void image_error(const char *message, const char *path)
+{
+    fprintf(stderr, "ERROR: %s '%s'.\n", message, path);
+    exit(1);
+}
+
+// Writes the bytecode of a program as an image. Padding is written as zeros, so the same
+// program always packs into the same image.
+void Image_write(struct Bytecode *bytecode, const char *path)
+{
+    FILE *output;
+#ifdef _WIN32
+    if (fopen_s(&output, path, "wb"))
+#else
+    if ((output = fopen(path, "wb")) == NULL)
+#endif
+        image_error("Cannot open for writing", path);
+
+    struct Image_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.instruction_size = sizeof(struct Instruction);
+    header.instruction_count = bytecode->instructions.length;
+    header.frame_size = bytecode->frame_size;
+    header.max_stack_size = bytecode->max_stack_size;
+    bool written = fwrite(&header, sizeof(header), 1, output) == 1;
+    for (int i = 0; i < bytecode->instructions.length && written; i++)
+    {
+        struct Instruction instruction;
+        memset(&instruction, 0, sizeof(instruction));
+        instruction.opcode = bytecode->instructions.data[i].opcode;
+        instruction.operand = bytecode->instructions.data[i].operand;
+        written = fwrite(&instruction, sizeof(instruction), 1, output) == 1;
+    }
+    if (fclose(output) != 0 || !written)
+        image_error("Cannot write", path);
+}
+
+// Lowers the program the way the simulator does and writes it as an image.
+void pack_program(struct Ir *ir, const char *path)
+{
+    struct Bytecode bytecode;
+    Bytecode_init(&bytecode);
+    int *slots = lower_program(&bytecode, ir);
+    Image_write(&bytecode, path);
+    free(slots);
+    Bytecode_free(&bytecode);
+}
+
+// Whether the instructions can be simulated: every opcode exists, every jump stays inside of
+// the program, every slot inside of the frame and the program ends with a HALT. A damaged image
+// is refused instead of taking the simulator somewhere else.
+bool Image_check(struct Bytecode *bytecode)
+{
+    int count = bytecode->instructions.length;
+    if (count == 0 || bytecode->instructions.data[count - 1].opcode != OPCODE_HALT)
+        return false;
+    for (int i = 0; i < count; i++)
+    {
+        struct Instruction *instruction = &bytecode->instructions.data[i];
+        _Static_assert(OPCODE_COUNT == 16, "Exhaustive handling of opcodes");
+        switch (instruction->opcode)
+        {
+        case OPCODE_PUSH:
+        case OPCODE_PLUS:
+        case OPCODE_MINUS:
+        case OPCODE_GT:
+        case OPCODE_MODULO:
+        case OPCODE_EQUAL:
+        case OPCODE_OR:
+        case OPCODE_PRINT:
+        case OPCODE_HALT:
+            break;
+        case OPCODE_LOAD:
+        case OPCODE_STORE:
+            if (instruction->operand < 0 || instruction->operand >= bytecode->frame_size)
+                return false;
+            break;
+        case OPCODE_POP:
+            if (instruction->operand < 0 || instruction->operand > bytecode->max_stack_size)
+                return false;
+            break;
+        case OPCODE_JUMP:
+        case OPCODE_JUMP_IF_ZERO:
+        case OPCODE_JUMP_IF_NOT_ZERO:
+            if (instruction->operand < 0 || instruction->operand >= count)
+                return false;
+            break;
+        default:
+            // LOOP included, images do not count loops.
+            return false;
+        }
+    }
+    return true;
+}
+
+// A min-heap of instruction indices in 'heap', for the jumps 'Image_check_stack' still has to
+// meet.
+static void image_heap_push(Vec(int) *heap, int value)
+{
+    Vec_int_add(heap, value);
+    int i = heap->length - 1;
+    while (i > 0 && heap->data[(i - 1) / 2] > heap->data[i])
+    {
+        int parent = (i - 1) / 2;
+        int swap = heap->data[parent];
+        heap->data[parent] = heap->data[i];
+        heap->data[i] = swap;
+        i = parent;
+    }
+}
+
+static void image_heap_pop(Vec(int) *heap)
+{
+    heap->data[0] = Vec_int_pop(heap);
+    int i = 0;
+    while (true)
+    {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < heap->length && heap->data[left] < heap->data[smallest])
+            smallest = left;
+        if (right < heap->length && heap->data[right] < heap->data[smallest])
+            smallest = right;
+        if (smallest == i)
+            return;
+        int swap = heap->data[smallest];
+        heap->data[smallest] = heap->data[i];
+        heap->data[i] = swap;
+        i = smallest;
+    }
+}
+
+// Whether the stack stays inside of the one the simulator allocates. Packed programs keep the
+// stack empty between statements, so an image is only accepted when it does too: the stack is
+// empty behind every jump and HALT and in front of every jump target. The depth of any other
+// instruction then follows from the instructions since the last jump, and must never drop below
+// the values the instruction takes or rise above 'max_stack_size'. Nothing is kept per
+// instruction; the first pass meets the forward jump targets and the second, going backwards, the
+// backward ones, holding only the jumps that are still open, which are as many as the loops and
+// conditions nest. Only called once 'Image_check' passed.
+bool Image_check_stack(struct Bytecode *bytecode)
+{
+    int count = bytecode->instructions.length;
+    Vec(int) targets;
+    Vec_int_init(&targets);
+    bool valid = true;
+
+    int depth = 0;
+    for (int i = 0; i < count && valid; i++)
+    {
+        struct Instruction *instruction = &bytecode->instructions.data[i];
+        enum Opcode opcode = instruction->opcode;
+        for (; targets.length > 0 && targets.data[0] == i; image_heap_pop(&targets))
+            valid &= depth == 0;
+        valid &= depth >= Opcode_input_count(opcode, instruction->operand);
+        depth += Opcode_stack_effect(opcode, instruction->operand);
+        valid &= depth <= bytecode->max_stack_size;
+        if (opcode == OPCODE_JUMP || opcode == OPCODE_JUMP_IF_ZERO || opcode == OPCODE_JUMP_IF_NOT_ZERO ||
+            opcode == OPCODE_HALT)
+        {
+            valid &= depth == 0;
+            if (opcode != OPCODE_HALT && instruction->operand > i)
+                image_heap_push(&targets, instruction->operand);
+            // Past a JUMP or HALT, only jumps lead on, and those find an empty stack.
+            depth = 0;
+        }
+    }
+
+    // The depth in front of an instruction, counted back from the next jump or HALT. Where the
+    // first pass passed, it is the depth that pass followed.
+    targets.length = 0;
+    depth = 0;
+    for (int i = count - 1; i >= 0 && valid; i--)
+    {
+        struct Instruction *instruction = &bytecode->instructions.data[i];
+        enum Opcode opcode = instruction->opcode;
+        bool jump = opcode == OPCODE_JUMP || opcode == OPCODE_JUMP_IF_ZERO || opcode == OPCODE_JUMP_IF_NOT_ZERO;
+        if (jump || opcode == OPCODE_HALT)
+            depth = 0;
+        depth -= Opcode_stack_effect(opcode, instruction->operand);
+        // Negated, so that the heap hands out the latest target first.
+        if (jump && instruction->operand <= i)
+            image_heap_push(&targets, -instruction->operand);
+        for (; targets.length > 0 && targets.data[0] == -i; image_heap_pop(&targets))
+            valid &= depth == 0;
+    }
+    Vec_int_free(&targets);
+    return valid;
+}
+
+// Maps the image 'path' and checks it. Nothing is copied, the instructions are read from the
+// file where the simulator needs them.
+void Image_open(struct Image *image, const char *path)
+{
+#ifdef IMAGE_MAPPED
+    int fd = open(path, O_RDONLY);
+    struct stat file_stat;
+    if (fd == -1 || fstat(fd, &file_stat) == -1)
+        image_error("Cannot open the image", path);
+    image->size = file_stat.st_size;
+    image->data = NULL;
+    if (image->size >= sizeof(struct Image_header))
+    {
+        image->data = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image->data == MAP_FAILED)
+            image_error("Cannot map the image", path);
+    }
+    close(fd);
+#else
+    FILE *input;
+    if (fopen_s(&input, path, "rb"))
+        image_error("Cannot open the image", path);
+    fseek(input, 0, SEEK_END);
+    image->size = ftell(input);
+    rewind(input);
+    image->data = malloc(image->size + 1);
+    if (image->data == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    image->size = fread(image->data, 1, image->size, input);
+    fclose(input);
+#endif
+    if (image->data == NULL)
+        image_error("Not a program image", path);
+
+    struct Image_header *header = image->data;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0)
+        image_error("Not a program image", path);
+    if (header->version != IMAGE_VERSION)
+        image_error("The image was packed by another version of betsy", path);
+    if (header->byte_order != IMAGE_BYTE_ORDER || header->instruction_size != sizeof(struct Instruction))
+        image_error("The image was packed on a different kind of machine", path);
+    if (header->instruction_count > (image->size - sizeof(struct Image_header)) / sizeof(struct Instruction) ||
+        image->size != sizeof(struct Image_header) + header->instruction_count * sizeof(struct Instruction) ||
+        header->frame_size >= INT32_MAX || header->max_stack_size >= INT32_MAX)
+        image_error("The image is damaged", path);
+
+    struct Bytecode *bytecode = &image->bytecode;
+    memset(bytecode, 0, sizeof(*bytecode));
+    bytecode->instructions.data = (struct Instruction *)(header + 1);
+    bytecode->instructions.length = (int)header->instruction_count;
+    bytecode->instructions.capacity = (int)header->instruction_count;
+    bytecode->frame_size = (int)header->frame_size;
+    bytecode->max_stack_size = (int)header->max_stack_size;
+    if (!Image_check(bytecode) || !Image_check_stack(bytecode))
+        image_error("The image is damaged", path);
+}
+
+// The bytecode of an image belongs to the image and must not be freed on its own.
+void Image_close(struct Image *image)
+{
+#ifdef IMAGE_MAPPED
+    if (image->data != NULL)
+        munmap(image->data, image->size);
+#else
+    free(image->data);
+#endif
+}
+
+// Simulates the image 'path'. With 'count_allocations', the allocations made while the program
+// ran are reported.
+void run_image(const char *path, bool count_allocations)
+{
+    struct Image image;
+    Image_open(&image, path);
+    long allocations = simulate_bytecode(&image.bytecode, NULL);
+    if (count_allocations)
+        fprintf(stderr, "Allocations while running: %ld\n", allocations);
+    Image_close(&image);
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+#include "array.h"
+
+uint32_t String_hash(const char *text, int length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+struct Interned_string
+{
+    char *text;
+    int length;
+    uint32_t hash;
+};
+
+Vec_declare(Interned_string, struct Interned_string);
+Vec_define(Interned_string, struct Interned_string)
+
+// Maps every distinct spelling to a small integer id so that later stages can compare names
+// by id. Ids are handed out in order starting at 0 and the strings live in the arena.
+struct Interner
+{
+    Vec(Interned_string) strings;
+    // Open addressing table of string ids, -1 marks an empty bucket.
+    int *buckets;
+    int bucket_count;
+    struct Arena *arena;
+};
+
+void Interner_rehash(struct Interner *interner, int bucket_count)
+{
+    int *buckets = malloc(sizeof(int) * bucket_count);
+    if (buckets == NULL)
+    {
+        fprintf(stderr, "ERROR: Interner allocation error.\n");
+        exit(1);
+    }
+    for (int i = 0; i < bucket_count; i++)
+        buckets[i] = -1;
+
+    for (int i = 0; i < interner->strings.length; i++)
+    {
+        struct Interned_string *string = Vec_Interned_string_get(&interner->strings, i);
+        int bucket = string->hash & (bucket_count - 1);
+        while (buckets[bucket] != -1)
+            bucket = (bucket + 1) & (bucket_count - 1);
+        buckets[bucket] = i;
+    }
+
+    free(interner->buckets);
+    interner->buckets = buckets;
+    interner->bucket_count = bucket_count;
+}
+
+void Interner_init(struct Interner *interner, struct Arena *arena)
+{
+    Vec_Interned_string_init(&interner->strings);
+    interner->buckets = NULL;
+    interner->arena = arena;
+    Interner_rehash(interner, 256);
+}
+
+void Interner_free(struct Interner *interner)
+{
+    Vec_Interned_string_free(&interner->strings);
+    free(interner->buckets);
+}
+
+int Interner_intern(struct Interner *interner, const char *text, int length)
+{
+    uint32_t hash = String_hash(text, length);
+    int bucket = hash & (interner->bucket_count - 1);
+    while (interner->buckets[bucket] != -1)
+    {
+        struct Interned_string *string = Vec_Interned_string_get(&interner->strings, interner->buckets[bucket]);
+        if (string->hash == hash && string->length == length && memcmp(string->text, text, length) == 0)
+            return interner->buckets[bucket];
+        bucket = (bucket + 1) & (interner->bucket_count - 1);
+    }
+
+    struct Interned_string string = {
+        .text = Arena_alloc(interner->arena, length + 1),
+        .length = length,
+        .hash = hash,
+    };
+    memcpy(string.text, text, length);
+    string.text[length] = 0;
+
+    int id = interner->strings.length;
+    Vec_Interned_string_add(&interner->strings, string);
+    interner->buckets[bucket] = id;
+
+    if (interner->strings.length * 4 > interner->bucket_count * 3)
+        Interner_rehash(interner, interner->bucket_count * 2);
+    return id;
+}
+
+char *Interner_name(struct Interner *interner, int id)
+{
+    struct Interned_string *string = Vec_Interned_string_get(&interner->strings, id);
+    return string->text;
+}
+
+#endif
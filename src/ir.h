@@ -0,0 +1,1346 @@
+#ifndef IR_H
+#define IR_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "array.h"
+#include "cfg.h"
+#include "expression.h"
+#include "operation.h"
+#include "statement.h"
+#include "typeInfo.h"
+
+// The middle end of the compiler. Both the simulator and the C backend are generated from it.
+//
+// Every value is computed exactly once (static single assignment). Variables do not exist
+// anymore: reading a variable gives the value that was last assigned to it, and where control
+// flow comes together a phi picks the value of the edge that was taken. Phis have one operand
+// per predecessor of their block, in the order of 'predecessors'.
+enum Ir_opcode
+{
+    IR_OPCODE_CONSTANT,
+    IR_OPCODE_PHI,
+    IR_OPCODE_PLUS,
+    IR_OPCODE_MINUS,
+    IR_OPCODE_GT,
+    IR_OPCODE_MODULO,
+    IR_OPCODE_EQUAL,
+    IR_OPCODE_OR,
+    IR_OPCODE_PRINT,
+    IR_OPCODE_COUNT
+};
+
+struct Ir_value
+{
+    enum Ir_opcode opcode;
+    enum Type_info type;
+    int block;
+    // The next value in the same block, -1 for the last one. Phis come first.
+    int next;
+    union
+    {
+        int32_t constant;
+        // 'print' only uses the first operand.
+        int operands[2];
+        struct
+        {
+            int first;
+            int slot;
+        } phi;
+    };
+};
+
+Vec_declare(Ir_value, struct Ir_value);
+Vec_define(Ir_value, struct Ir_value)
+
+struct Ir_block
+{
+    int first;
+    int last;
+    // The value a branch tests.
+    int condition;
+};
+
+// A loop that counts a phi of its header up by a constant step for as long as it stays below a
+// bound that does not change inside of the loop:
+//     while > bound i do ... set i + i step end
+struct Ir_counted_loop
+{
+    int counter;
+    int bound;
+    int step;
+    // The value the counter has in the next iteration.
+    int next;
+    // The indices of the edge that enters the loop and of the edge that comes back from its end.
+    int entry;
+    int back;
+};
+
+struct Ir
+{
+    struct Cfg *cfg;
+    Vec(Ir_value) values;
+    Vec(int) phi_operands;
+    struct Ir_block *blocks;
+    // The predecessors of block b are predecessors[predecessor_start[b]] up to
+    // predecessors[predecessor_start[b + 1]].
+    int *predecessor_start;
+    int *predecessors;
+    // Filled in by 'Ir_count_uses'. 'use_blocks' is the block of the last use. Phi operands
+    // are used at the end of the predecessor they belong to. 'inline_depths' is how deeply the
+    // operations inlined into a value nest, 0 for the values that are not inlined.
+    int *use_counts;
+    int *use_blocks;
+    int *inline_depths;
+    // Filled in by 'Ir_find_counted_loops', indexed by the header of a loop.
+    struct Ir_counted_loop *counted_loops;
+};
+
+struct Ir_value *Ir_get(struct Ir *ir, int value)
+{
+    return Vec_Ir_value_get(&ir->values, value);
+}
+
+int Ir_predecessor_count(struct Ir *ir, int block)
+{
+    return ir->predecessor_start[block + 1] - ir->predecessor_start[block];
+}
+
+int Ir_predecessor_index(struct Ir *ir, int block, int predecessor)
+{
+    for (int i = ir->predecessor_start[block]; i < ir->predecessor_start[block + 1]; i++)
+    {
+        if (ir->predecessors[i] == predecessor)
+            return i - ir->predecessor_start[block];
+    }
+    fprintf(stderr, "ERROR: Block %d is not a predecessor of block %d.\n", predecessor, block);
+    exit(1);
+}
+
+int *Ir_phi_operand(struct Ir *ir, struct Ir_value *phi, int index)
+{
+    return Vec_int_get(&ir->phi_operands, phi->phi.first + index);
+}
+
+bool Ir_has_phis(struct Ir *ir, int block)
+{
+    int first = ir->blocks[block].first;
+    return first != -1 && Ir_get(ir, first)->opcode == IR_OPCODE_PHI;
+}
+
+bool Ir_is_binary(enum Ir_opcode opcode)
+{
+    return opcode >= IR_OPCODE_PLUS && opcode <= IR_OPCODE_OR;
+}
+
+// A modulo fails when it divides by zero, unless the divisor is known not to be zero.
+bool Ir_may_trap(struct Ir *ir, struct Ir_value *value)
+{
+    if (value->opcode != IR_OPCODE_MODULO)
+        return false;
+    struct Ir_value *divisor = Ir_get(ir, value->operands[1]);
+    return divisor->opcode != IR_OPCODE_CONSTANT || divisor->constant == 0;
+}
+
+// Values without side effects can be moved, merged or dropped.
+bool Ir_is_pure(struct Ir *ir, struct Ir_value *value)
+{
+    return value->opcode != IR_OPCODE_PHI && value->opcode != IR_OPCODE_PRINT && !Ir_may_trap(ir, value);
+}
+
+// Appends a value to the end of 'block'.
+int Ir_add(struct Ir *ir, int block, struct Ir_value value)
+{
+    int index = ir->values.length;
+    value.block = block;
+    value.next = -1;
+    Vec_Ir_value_add(&ir->values, value);
+
+    struct Ir_block *ir_block = &ir->blocks[block];
+    if (ir_block->last == -1)
+        ir_block->first = index;
+    else
+        Ir_get(ir, ir_block->last)->next = index;
+    ir_block->last = index;
+    return index;
+}
+
+int Ir_add_constant(struct Ir *ir, int block, int32_t constant, enum Type_info type)
+{
+    struct Ir_value value = {.opcode = IR_OPCODE_CONSTANT, .type = type, .constant = constant};
+    return Ir_add(ir, block, value);
+}
+
+int Ir_add_operation(struct Ir *ir, int block, enum Ir_opcode opcode, enum Type_info type, int l, int r)
+{
+    struct Ir_value value = {.opcode = opcode, .type = type, .operands = {l, r}};
+    return Ir_add(ir, block, value);
+}
+
+// Adds a phi for variable 'slot' to 'block', which must not hold anything but phis yet. Its
+// operands are filled in once the values on the incoming edges are known.
+int Ir_add_phi(struct Ir *ir, int block, int slot, enum Type_info type)
+{
+    struct Ir_value value = {.opcode = IR_OPCODE_PHI, .type = type, .phi = {.first = ir->phi_operands.length, .slot = slot}};
+    for (int i = 0; i < Ir_predecessor_count(ir, block); i++)
+        Vec_int_add(&ir->phi_operands, -1);
+    return Ir_add(ir, block, value);
+}
+
+// Building
+
+struct Ir_definition
+{
+    int slot;
+    int value;
+};
+
+Vec_declare(Ir_definition, struct Ir_definition);
+Vec_define(Ir_definition, struct Ir_definition)
+
+struct Ir_builder
+{
+    // The value every variable slot holds at the point that is being built, -1 for none.
+    int *definitions;
+    // The previous definitions, so leaving a branch or a loop can restore them.
+    Vec(Ir_definition) undo;
+    Vec(int) stack;
+    // The values of the variables at the end of a branch of an if, until both branches are built.
+    Vec(Ir_definition) changes;
+    // Scratch space to find every variable only once. An entry is valid when 'slot_generation'
+    // matches the current generation.
+    int *slot_generation;
+    int *slot_value;
+    int generation;
+    // Scratch space to find the blocks of a loop.
+    int *position;
+    int *loop_blocks;
+    // Variables are zero before they are declared, like the frame of the simulator.
+    int zero;
+};
+
+int Ir_read(struct Ir_builder *builder, int slot)
+{
+    int value = builder->definitions[slot];
+    return value == -1 ? builder->zero : value;
+}
+
+void Ir_define(struct Ir_builder *builder, int slot, int value)
+{
+    struct Ir_definition previous = {.slot = slot, .value = builder->definitions[slot]};
+    Vec_Ir_definition_add(&builder->undo, previous);
+    builder->definitions[slot] = value;
+}
+
+void Ir_undo(struct Ir_builder *builder, int mark)
+{
+    while (builder->undo.length > mark)
+    {
+        struct Ir_definition previous = Vec_Ir_definition_pop(&builder->undo);
+        builder->definitions[previous.slot] = previous.value;
+    }
+}
+
+void Ir_build_expression(struct Ir *ir, struct Ir_builder *builder, int block, struct Expression *exp)
+{
+    for (int i = 0; i < exp->operations.length; i++)
+    {
+        struct Operation *op = Vec_Operation_get(&exp->operations, i);
+        int value;
+        _Static_assert(OPERATION_TYPE_COUNT == 4, "Exhaustive handling of operation types");
+        switch (op->type)
+        {
+        case OPERATION_TYPE_VALUE:
+            value = Ir_add_constant(ir, block, op->literal.value, op->literal.typeInfo);
+            Vec_int_add(&builder->stack, value);
+            break;
+        case OPERATION_TYPE_IDENTIFIER:
+            value = Ir_read(builder, op->identifier.slot);
+            Vec_int_add(&builder->stack, value);
+            break;
+        case OPERATION_TYPE_INTRINSIC:
+            if (op->intrinsic.type == INTRINSIC_TYPE_PRINT)
+            {
+                int printed = Vec_int_pop(&builder->stack);
+                Ir_add_operation(ir, block, IR_OPCODE_PRINT, Ir_get(ir, printed)->type, printed, -1);
+                break;
+            }
+            int r = Vec_int_pop(&builder->stack);
+            int l = Vec_int_pop(&builder->stack);
+            _Static_assert(INTRINSIC_TYPE_COUNT == 7, "Exhaustive handling of intrinsic types");
+            switch (op->intrinsic.type)
+            {
+            case INTRINSIC_TYPE_PLUS:
+                value = Ir_add_operation(ir, block, IR_OPCODE_PLUS, TYPE_INFO_INT, l, r);
+                break;
+            case INTRINSIC_TYPE_MINUS:
+                value = Ir_add_operation(ir, block, IR_OPCODE_MINUS, TYPE_INFO_INT, l, r);
+                break;
+            case INTRINSIC_TYPE_GT:
+                value = Ir_add_operation(ir, block, IR_OPCODE_GT, TYPE_INFO_BOOL, l, r);
+                break;
+            case INTRINSIC_TYPE_MODULO:
+                value = Ir_add_operation(ir, block, IR_OPCODE_MODULO, TYPE_INFO_INT, l, r);
+                break;
+            case INTRINSIC_TYPE_EQUAL:
+                value = Ir_add_operation(ir, block, IR_OPCODE_EQUAL, TYPE_INFO_BOOL, l, r);
+                break;
+            case INTRINSIC_TYPE_OR:
+                value = Ir_add_operation(ir, block, IR_OPCODE_OR, TYPE_INFO_BOOL, l, r);
+                break;
+            default:
+                fprintf(stderr, "ERROR: Intrinsic type '%d' not implemented yet in 'Ir_build_expression'.\n", op->intrinsic.type);
+                exit(1);
+            }
+            Vec_int_add(&builder->stack, value);
+            break;
+        default:
+            fprintf(stderr, "ERROR: Operation type '%d' not implemented yet in 'Ir_build_expression'.\n", op->type);
+            exit(1);
+        }
+    }
+}
+
+void Ir_build_statement(struct Ir *ir, struct Ir_builder *builder, int block, struct Statement *statement)
+{
+    _Static_assert(STATEMENT_TYPE_COUNT == 6, "Exhaustive handling of statement types");
+    switch (statement->type)
+    {
+    case STATEMENT_TYPE_EXP:
+        Ir_build_expression(ir, builder, block, &statement->expression);
+        break;
+    case STATEMENT_TYPE_VAR:
+        Ir_build_expression(ir, builder, block, &statement->var.assignment);
+        Ir_define(builder, statement->var.identifier.identifier.slot, Vec_int_pop(&builder->stack));
+        break;
+    case STATEMENT_TYPE_SET:
+        Ir_build_expression(ir, builder, block, &statement->set.assignment);
+        Ir_define(builder, statement->set.identifier.identifier.slot, Vec_int_pop(&builder->stack));
+        break;
+    default:
+        fprintf(stderr, "ERROR: Statement type '%d' not implemented yet in 'Ir_build_statement'.\n", statement->type);
+        exit(1);
+    }
+    // Values that are left over by an expression statement are never used.
+    builder->stack.length = 0;
+}
+
+// Gives every variable that the loop with header 'header' assigns a phi in the header.
+void Ir_build_loop_phis(struct Ir *ir, struct Ir_builder *builder, int header, int entry)
+{
+    int count = Cfg_loop_blocks(ir->cfg, header, builder->position, builder->loop_blocks, INT_MAX);
+    int generation = ++builder->generation;
+    for (int i = 0; i < count; i++)
+    {
+        struct Block *block = Cfg_block(ir->cfg, builder->loop_blocks[i]);
+        builder->position[builder->loop_blocks[i]] = -1;
+        for (int j = 0; j < block->statements.length; j++)
+        {
+            struct Statement *statement = Cfg_statement(block, j);
+            int slot;
+            if (statement->type == STATEMENT_TYPE_VAR)
+                slot = statement->var.identifier.identifier.slot;
+            else if (statement->type == STATEMENT_TYPE_SET)
+                slot = statement->set.identifier.identifier.slot;
+            else
+                continue;
+            if (builder->slot_generation[slot] == generation)
+                continue;
+            builder->slot_generation[slot] = generation;
+
+            int initial = Ir_read(builder, slot);
+            int phi = Ir_add_phi(ir, header, slot, Ir_get(ir, initial)->type);
+            *Ir_phi_operand(ir, Ir_get(ir, phi), entry) = initial;
+            Ir_define(builder, slot, phi);
+        }
+    }
+}
+
+// Gives 'slot' its value after an if. Control reaches the merge block from 'then_end' with
+// 'then_value' and from 'else_end' with 'else_value', an end of -1 never gets there.
+void Ir_join(struct Ir *ir, struct Ir_builder *builder, int merge, int then_end, int else_end, int slot, int then_value, int else_value)
+{
+    if (then_end == -1)
+        Ir_define(builder, slot, else_value);
+    else if (else_end == -1 || then_value == else_value)
+        Ir_define(builder, slot, then_value);
+    else
+    {
+        int phi = Ir_add_phi(ir, merge, slot, Ir_get(ir, then_value)->type);
+        struct Ir_value *phi_value = Ir_get(ir, phi);
+        *Ir_phi_operand(ir, phi_value, Ir_predecessor_index(ir, merge, then_end)) = then_value;
+        *Ir_phi_operand(ir, phi_value, Ir_predecessor_index(ir, merge, else_end)) = else_value;
+        Ir_define(builder, slot, phi);
+    }
+}
+
+// Joins the variables that either branch of an if assigned in block 'merge'. The changes of
+// the then branch start at 'then_start' in 'changes', the ones of the else branch at
+// 'else_start'. The definitions are the ones from before the if again.
+void Ir_build_merge(struct Ir *ir, struct Ir_builder *builder, int merge, int then_end, int else_end, int then_start, int else_start)
+{
+    int then_generation = ++builder->generation;
+    int done_generation = ++builder->generation;
+    struct Ir_definition *changes = builder->changes.data;
+    for (int i = then_start; i < else_start; i++)
+    {
+        builder->slot_generation[changes[i].slot] = then_generation;
+        builder->slot_value[changes[i].slot] = changes[i].value;
+    }
+
+    for (int i = else_start; i < builder->changes.length; i++)
+    {
+        int slot = changes[i].slot;
+        if (builder->slot_generation[slot] == done_generation)
+            continue;
+        int then_value = builder->slot_generation[slot] == then_generation ? builder->slot_value[slot] : Ir_read(builder, slot);
+        builder->slot_generation[slot] = done_generation;
+        Ir_join(ir, builder, merge, then_end, else_end, slot, then_value, changes[i].value);
+    }
+    for (int i = then_start; i < else_start; i++)
+    {
+        int slot = changes[i].slot;
+        if (builder->slot_generation[slot] == done_generation)
+            continue;
+        builder->slot_generation[slot] = done_generation;
+        Ir_join(ir, builder, merge, then_end, else_end, slot, changes[i].value, Ir_read(builder, slot));
+    }
+}
+
+// Records the current value of every variable that was assigned since 'mark' in 'changes'.
+void Ir_record_changes(struct Ir_builder *builder, int mark)
+{
+    for (int i = mark; i < builder->undo.length; i++)
+    {
+        struct Ir_definition *previous = Vec_Ir_definition_get(&builder->undo, i);
+        struct Ir_definition change = {.slot = previous->slot, .value = builder->definitions[previous->slot]};
+        Vec_Ir_definition_add(&builder->changes, change);
+    }
+}
+
+// A loop or a branch whose nested region is being built. 'stop' belongs to the region around
+// it, 'mark' is the length of the undo list in front of the nested region.
+struct Ir_build_frame
+{
+    int block;
+    int stop;
+    int mark;
+    bool in_else;
+    int then_end;
+    int then_start;
+};
+
+Vec_declare(Ir_build_frame, struct Ir_build_frame);
+Vec_define(Ir_build_frame, struct Ir_build_frame)
+
+// Builds the blocks from 'index' on until control reaches 'stop', following the structure the
+// control flow graph was built with. Control enters 'index' from block 'from'. Returns the
+// block that enters 'stop', or -1 when control never gets there. The loops and branches whose
+// nested regions are being built wait in 'frames' instead of the C stack.
+int Ir_build_region(struct Ir *ir, struct Ir_builder *builder, int index, int from, int stop, Vec(Ir_build_frame) *frames)
+{
+    int base = frames->length;
+    for (;;)
+    {
+        while (index != stop && index != -1)
+        {
+            struct Block *block = Cfg_block(ir->cfg, index);
+            for (int i = 0; i < block->statements.length; i++)
+                Ir_build_statement(ir, builder, index, Cfg_statement(block, i));
+
+            if (block->is_loop_header)
+            {
+                Ir_build_loop_phis(ir, builder, index, Ir_predecessor_index(ir, index, from));
+                struct Ir_build_frame frame = {.block = index, .stop = stop, .mark = builder->undo.length};
+                if (block->terminator == TERMINATOR_BRANCH)
+                {
+                    Ir_build_expression(ir, builder, index, block->condition);
+                    ir->blocks[index].condition = Vec_int_pop(&builder->stack);
+                    builder->stack.length = 0;
+                }
+                Vec_Ir_build_frame_add(frames, frame);
+                from = index;
+                stop = index;
+                index = block->target;
+                continue;
+            }
+
+            _Static_assert(TERMINATOR_COUNT == 3, "Exhaustive handling of terminators");
+            switch (block->terminator)
+            {
+            case TERMINATOR_JUMP:
+                from = index;
+                index = block->target;
+                break;
+            case TERMINATOR_BRANCH:
+                Ir_build_expression(ir, builder, index, block->condition);
+                ir->blocks[index].condition = Vec_int_pop(&builder->stack);
+                builder->stack.length = 0;
+
+                Vec_Ir_build_frame_add(frames, (struct Ir_build_frame){.block = index, .stop = stop, .mark = builder->undo.length});
+                from = index;
+                stop = block->merge;
+                index = block->target;
+                break;
+            case TERMINATOR_HALT:
+                from = -1;
+                index = -1;
+                break;
+            default:
+                fprintf(stderr, "ERROR: Terminator type '%d' not implemented yet in 'Ir_build_region'.\n", block->terminator);
+                exit(1);
+            }
+        }
+        int end = index == stop ? from : -1;
+        if (frames->length == base)
+            return end;
+
+        // The nested region ended, the loop or branch it belongs to carries on.
+        struct Ir_build_frame *frame = Vec_Ir_build_frame_top(frames);
+        index = frame->block;
+        struct Block *block = Cfg_block(ir->cfg, index);
+        if (block->is_loop_header)
+        {
+            if (end != -1)
+            {
+                int back_index = Ir_predecessor_index(ir, index, end);
+                for (int phi = ir->blocks[index].first; phi != -1; phi = Ir_get(ir, phi)->next)
+                {
+                    struct Ir_value *phi_value = Ir_get(ir, phi);
+                    if (phi_value->opcode != IR_OPCODE_PHI)
+                        break;
+                    *Ir_phi_operand(ir, phi_value, back_index) = Ir_read(builder, phi_value->phi.slot);
+                }
+            }
+            // Once the loop is left the variables hold the values of the phis.
+            Ir_undo(builder, frame->mark);
+            stop = frame->stop;
+            Vec_Ir_build_frame_pop(frames);
+
+            if (block->terminator != TERMINATOR_BRANCH)
+            {
+                from = -1;
+                index = -1;
+                continue;
+            }
+            from = index;
+            index = block->merge;
+            continue;
+        }
+
+        int merge = block->merge;
+        if (!frame->in_else)
+        {
+            frame->in_else = true;
+            frame->then_end = end;
+            frame->then_start = builder->changes.length;
+            Ir_record_changes(builder, frame->mark);
+            Ir_undo(builder, frame->mark);
+            if (block->else_target != merge)
+            {
+                from = index;
+                stop = merge;
+                index = block->else_target;
+                continue;
+            }
+            end = index;
+        }
+        int else_start = builder->changes.length;
+        Ir_record_changes(builder, frame->mark);
+        Ir_undo(builder, frame->mark);
+
+        if (merge != -1)
+            Ir_build_merge(ir, builder, merge, frame->then_end, end, frame->then_start, else_start);
+        builder->changes.length = frame->then_start;
+        stop = frame->stop;
+        // Nothing that follows can see from which branch control came, unless the region ends.
+        from = merge == stop ? (frame->then_end != -1 ? frame->then_end : end) : -1;
+        index = merge;
+        Vec_Ir_build_frame_pop(frames);
+    }
+}
+
+void Ir_build(struct Ir *ir, struct Cfg *cfg)
+{
+    int block_count = cfg->blocks.length;
+    ir->cfg = cfg;
+    Vec_Ir_value_init(&ir->values);
+    Vec_int_init(&ir->phi_operands);
+    ir->blocks = malloc(sizeof(struct Ir_block) * block_count);
+    ir->predecessor_start = calloc(block_count + 2, sizeof(int));
+    ir->use_counts = NULL;
+    ir->use_blocks = NULL;
+    ir->inline_depths = NULL;
+    ir->counted_loops = NULL;
+    if (ir->blocks == NULL || ir->predecessor_start == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < block_count; i++)
+        ir->blocks[i] = (struct Ir_block){.first = -1, .last = -1, .condition = -1};
+
+    // Count the predecessors first and then fill them in.
+    for (int i = 0; i < block_count; i++)
+        Cfg_for_each_successor(Cfg_block(cfg, i), successor, ir->predecessor_start[successor + 2]++);
+    for (int i = 0; i < block_count; i++)
+        ir->predecessor_start[i + 2] += ir->predecessor_start[i + 1];
+    ir->predecessors = malloc(sizeof(int) * (ir->predecessor_start[block_count + 1] + 1));
+    if (ir->predecessors == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < block_count; i++)
+        Cfg_for_each_successor(Cfg_block(cfg, i), successor, ir->predecessors[ir->predecessor_start[successor + 1]++] = i);
+
+    struct Ir_builder builder;
+    int slot_count = cfg->frame_size + 1;
+    builder.definitions = malloc(sizeof(int) * slot_count);
+    builder.slot_generation = calloc(slot_count, sizeof(int));
+    builder.slot_value = malloc(sizeof(int) * slot_count);
+    builder.position = malloc(sizeof(int) * block_count);
+    builder.loop_blocks = malloc(sizeof(int) * block_count);
+    if (builder.definitions == NULL || builder.slot_generation == NULL || builder.slot_value == NULL ||
+        builder.position == NULL || builder.loop_blocks == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < slot_count; i++)
+        builder.definitions[i] = -1;
+    for (int i = 0; i < block_count; i++)
+        builder.position[i] = -1;
+    builder.generation = 0;
+    Vec_Ir_definition_init(&builder.undo);
+    Vec_int_init(&builder.stack);
+    Vec_Ir_definition_init(&builder.changes);
+    builder.zero = Ir_add_constant(ir, 0, 0, TYPE_INFO_INT);
+
+    Vec(Ir_build_frame) frames;
+    Vec_Ir_build_frame_init(&frames);
+    Ir_build_region(ir, &builder, 0, -1, -1, &frames);
+    Vec_Ir_build_frame_free(&frames);
+
+    // Edges that control never takes did not give their phi operand a value.
+    for (int i = 0; i < ir->phi_operands.length; i++)
+    {
+        int *operand = Vec_int_get(&ir->phi_operands, i);
+        if (*operand == -1)
+            *operand = builder.zero;
+    }
+
+    free(builder.definitions);
+    free(builder.slot_generation);
+    free(builder.slot_value);
+    free(builder.position);
+    free(builder.loop_blocks);
+    Vec_Ir_definition_free(&builder.undo);
+    Vec_int_free(&builder.stack);
+    Vec_Ir_definition_free(&builder.changes);
+}
+
+void Ir_free(struct Ir *ir)
+{
+    Vec_Ir_value_free(&ir->values);
+    Vec_int_free(&ir->phi_operands);
+    free(ir->blocks);
+    free(ir->predecessor_start);
+    free(ir->predecessors);
+    free(ir->use_counts);
+    free(ir->use_blocks);
+    free(ir->inline_depths);
+    free(ir->counted_loops);
+}
+
+// Calls 'visit' with a pointer to every operand of 'value'.
+#define Ir_for_each_operand(ir, value, operand, visit)                                       \
+    {                                                                                        \
+        int *operand;                                                                        \
+        if ((value)->opcode == IR_OPCODE_PHI)                                                \
+        {                                                                                    \
+            for (int operand##_i = 0; operand##_i < Ir_predecessor_count((ir), (value)->block); operand##_i++) \
+            {                                                                                \
+                operand = Ir_phi_operand((ir), (value), operand##_i);                        \
+                visit;                                                                       \
+            }                                                                                \
+        }                                                                                    \
+        else if ((value)->opcode == IR_OPCODE_PRINT)                                         \
+        {                                                                                    \
+            operand = &(value)->operands[0];                                                 \
+            visit;                                                                           \
+        }                                                                                    \
+        else if (Ir_is_binary((value)->opcode))                                              \
+        {                                                                                    \
+            operand = &(value)->operands[0];                                                 \
+            visit;                                                                           \
+            operand = &(value)->operands[1];                                                 \
+            visit;                                                                           \
+        }                                                                                    \
+    }
+
+// Optimizations. Values that are replaced by another value are recorded in 'replacements'
+// and every operand is pointed at the final replacement at the end of a pass.
+
+int Ir_resolve(int *replacements, int value)
+{
+    int resolved = value;
+    while (replacements[resolved] != -1)
+        resolved = replacements[resolved];
+    while (replacements[value] != -1)
+    {
+        int next = replacements[value];
+        replacements[value] = resolved;
+        value = next;
+    }
+    return resolved;
+}
+
+int *Ir_new_replacements(struct Ir *ir)
+{
+    int *replacements = malloc(sizeof(int) * (ir->values.length + 1));
+    if (replacements == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < ir->values.length; i++)
+        replacements[i] = -1;
+    return replacements;
+}
+
+// Points every operand and condition at the value that replaced it and drops the replaced
+// values from their blocks.
+void Ir_apply_replacements(struct Ir *ir, int *replacements)
+{
+    for (int i = 0; i < ir->values.length; i++)
+    {
+        struct Ir_value *value = Ir_get(ir, i);
+        Ir_for_each_operand(ir, value, operand, *operand = Ir_resolve(replacements, *operand));
+    }
+    for (int b = 0; b < ir->cfg->blocks.length; b++)
+    {
+        struct Ir_block *block = &ir->blocks[b];
+        if (block->condition != -1)
+            block->condition = Ir_resolve(replacements, block->condition);
+
+        int last = -1;
+        for (int v = block->first; v != -1; v = Ir_get(ir, v)->next)
+        {
+            if (replacements[v] != -1)
+                continue;
+            if (last == -1)
+                block->first = v;
+            else
+                Ir_get(ir, last)->next = v;
+            last = v;
+        }
+        if (last == -1)
+            block->first = -1;
+        else
+            Ir_get(ir, last)->next = -1;
+        block->last = last;
+    }
+}
+
+// A phi whose operands are all the same value, or the phi itself, is just a copy of that value.
+// Replacing it can turn other phis into copies, so this repeats until nothing changes.
+void Ir_propagate_copies(struct Ir *ir)
+{
+    int *replacements = Ir_new_replacements(ir);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < ir->values.length; i++)
+        {
+            struct Ir_value *value = Ir_get(ir, i);
+            if (value->opcode != IR_OPCODE_PHI || replacements[i] != -1)
+                continue;
+
+            int same = -1;
+            bool is_copy = true;
+            Ir_for_each_operand(ir, value, operand, {
+                int resolved = Ir_resolve(replacements, *operand);
+                if (resolved != i && resolved != same)
+                {
+                    if (same != -1)
+                        is_copy = false;
+                    same = resolved;
+                }
+            });
+            if (is_copy && same != -1)
+            {
+                replacements[i] = same;
+                changed = true;
+            }
+        }
+    }
+    Ir_apply_replacements(ir, replacements);
+    free(replacements);
+}
+
+// A hash table from an operation and its operands to the value that computed it first. The
+// entries of a branch or a loop are removed again when it is left, so a value is only reused
+// where it is known to be computed already.
+struct Ir_number_entry
+{
+    int value;
+    int next;
+};
+
+Vec_declare(Ir_number_entry, struct Ir_number_entry);
+Vec_define(Ir_number_entry, struct Ir_number_entry)
+
+struct Ir_numbering
+{
+    int *buckets;
+    int bucket_count;
+    Vec(Ir_number_entry) entries;
+    int *replacements;
+};
+
+uint32_t Ir_hash(struct Ir_value *value)
+{
+    uint32_t hash = value->opcode * 31u + value->type;
+    if (value->opcode == IR_OPCODE_CONSTANT)
+        return hash * 2654435761u + (uint32_t)value->constant;
+    hash = hash * 2654435761u + (uint32_t)value->operands[0];
+    return hash * 2654435761u + (uint32_t)value->operands[1];
+}
+
+bool Ir_same_computation(struct Ir_value *a, struct Ir_value *b)
+{
+    if (a->opcode != b->opcode || a->type != b->type)
+        return false;
+    if (a->opcode == IR_OPCODE_CONSTANT)
+        return a->constant == b->constant;
+    return a->operands[0] == b->operands[0] && a->operands[1] == b->operands[1];
+}
+
+void Ir_number_block(struct Ir *ir, struct Ir_numbering *numbering, int block)
+{
+    for (int v = ir->blocks[block].first; v != -1; v = Ir_get(ir, v)->next)
+    {
+        struct Ir_value *value = Ir_get(ir, v);
+        if (value->opcode != IR_OPCODE_CONSTANT && !Ir_is_binary(value->opcode))
+            continue;
+        if (Ir_is_binary(value->opcode))
+        {
+            value->operands[0] = Ir_resolve(numbering->replacements, value->operands[0]);
+            value->operands[1] = Ir_resolve(numbering->replacements, value->operands[1]);
+            // The order of the operands does not matter for these.
+            bool commutative = value->opcode == IR_OPCODE_PLUS || value->opcode == IR_OPCODE_EQUAL || value->opcode == IR_OPCODE_OR;
+            if (commutative && value->operands[0] > value->operands[1])
+            {
+                int swap = value->operands[0];
+                value->operands[0] = value->operands[1];
+                value->operands[1] = swap;
+            }
+        }
+
+        int *bucket = &numbering->buckets[Ir_hash(value) & (numbering->bucket_count - 1)];
+        int found = -1;
+        for (int e = *bucket; e != -1 && found == -1; e = Vec_Ir_number_entry_get(&numbering->entries, e)->next)
+        {
+            int candidate = Vec_Ir_number_entry_get(&numbering->entries, e)->value;
+            if (Ir_same_computation(Ir_get(ir, candidate), value))
+                found = candidate;
+        }
+        if (found != -1)
+        {
+            numbering->replacements[v] = found;
+            continue;
+        }
+
+        struct Ir_number_entry entry = {.value = v, .next = *bucket};
+        *bucket = numbering->entries.length;
+        Vec_Ir_number_entry_add(&numbering->entries, entry);
+    }
+}
+
+// Removes the entries that were added since 'mark'. Entries leave in the opposite order in
+// which they were added, so each one is at the head of its bucket.
+void Ir_number_leave(struct Ir *ir, struct Ir_numbering *numbering, int mark)
+{
+    while (numbering->entries.length > mark)
+    {
+        struct Ir_number_entry entry = Vec_Ir_number_entry_pop(&numbering->entries);
+        numbering->buckets[Ir_hash(Ir_get(ir, entry.value)) & (numbering->bucket_count - 1)] = entry.next;
+    }
+}
+
+// A loop or a branch whose nested region is being numbered. 'stop' belongs to the region
+// around it and 'mark' is the number of entries in front of the nested region.
+struct Ir_number_frame
+{
+    int block;
+    int stop;
+    int mark;
+    bool in_else;
+};
+
+Vec_declare(Ir_number_frame, struct Ir_number_frame);
+Vec_define(Ir_number_frame, struct Ir_number_frame)
+
+void Ir_number_region(struct Ir *ir, struct Ir_numbering *numbering, int index, int stop)
+{
+    // The loops and branches whose nested regions are being numbered wait here instead of the
+    // C stack.
+    Vec(Ir_number_frame) frames;
+    Vec_Ir_number_frame_init(&frames);
+    for (;;)
+    {
+        while (index != stop && index != -1)
+        {
+            struct Block *block = Cfg_block(ir->cfg, index);
+            Ir_number_block(ir, numbering, index);
+
+            if (block->is_loop_header || block->terminator == TERMINATOR_BRANCH)
+            {
+                Vec_Ir_number_frame_add(&frames, (struct Ir_number_frame){.block = index, .stop = stop, .mark = numbering->entries.length});
+                stop = block->is_loop_header ? index : block->merge;
+                index = block->target;
+            }
+            else if (block->terminator == TERMINATOR_JUMP)
+                index = block->target;
+            else
+                index = -1;
+        }
+        if (frames.length == 0)
+            break;
+
+        struct Ir_number_frame *frame = Vec_Ir_number_frame_top(&frames);
+        struct Block *block = Cfg_block(ir->cfg, frame->block);
+        Ir_number_leave(ir, numbering, frame->mark);
+        if (!block->is_loop_header && !frame->in_else)
+        {
+            frame->in_else = true;
+            stop = block->merge;
+            index = block->else_target;
+            continue;
+        }
+        stop = frame->stop;
+        index = block->terminator == TERMINATOR_BRANCH ? block->merge : -1;
+        Vec_Ir_number_frame_pop(&frames);
+    }
+    Vec_Ir_number_frame_free(&frames);
+}
+
+// Common subexpression elimination: a computation that was already done on every path to it
+// reuses the earlier value.
+void Ir_eliminate_common_subexpressions(struct Ir *ir)
+{
+    struct Ir_numbering numbering;
+    numbering.bucket_count = 1024;
+    while (numbering.bucket_count < ir->values.length)
+        numbering.bucket_count *= 2;
+    numbering.buckets = malloc(sizeof(int) * numbering.bucket_count);
+    if (numbering.buckets == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < numbering.bucket_count; i++)
+        numbering.buckets[i] = -1;
+    Vec_Ir_number_entry_init(&numbering.entries);
+    numbering.replacements = Ir_new_replacements(ir);
+
+    Ir_number_region(ir, &numbering, 0, -1);
+    Ir_apply_replacements(ir, numbering.replacements);
+
+    free(numbering.buckets);
+    free(numbering.replacements);
+    Vec_Ir_number_entry_free(&numbering.entries);
+}
+
+// Moves the values of the loop with header 'header' that give the same result in every
+// iteration to the end of 'preheader', the block in front of the loop.
+void Ir_hoist_loop(struct Ir *ir, int header, int preheader, int *position, int *blocks)
+{
+    int count = Cfg_loop_blocks(ir->cfg, header, position, blocks, INT_MAX);
+    // The blocks come in an order where every block comes after the blocks that dominate it,
+    // so the operands of a value are hoisted before the value itself.
+    for (int i = 0; i < count; i++)
+    {
+        struct Ir_block *block = &ir->blocks[blocks[i]];
+        int last = -1;
+        int v = block->first;
+        block->first = -1;
+        while (v != -1)
+        {
+            struct Ir_value *value = Ir_get(ir, v);
+            int next = value->next;
+
+            bool invariant = (value->opcode == IR_OPCODE_CONSTANT || Ir_is_binary(value->opcode)) && Ir_is_pure(ir, value);
+            if (invariant)
+                Ir_for_each_operand(ir, value, operand, {
+                    if (position[Ir_get(ir, *operand)->block] != -1)
+                        invariant = false;
+                });
+
+            if (invariant)
+            {
+                struct Ir_block *target = &ir->blocks[preheader];
+                value->block = preheader;
+                value->next = -1;
+                if (target->last == -1)
+                    target->first = v;
+                else
+                    Ir_get(ir, target->last)->next = v;
+                target->last = v;
+            }
+            else
+            {
+                if (last == -1)
+                    block->first = v;
+                else
+                    Ir_get(ir, last)->next = v;
+                value->next = -1;
+                last = v;
+            }
+            v = next;
+        }
+        block->last = last;
+    }
+    for (int i = 0; i < count; i++)
+        position[blocks[i]] = -1;
+}
+
+// A loop or a branch whose nested region is being hoisted from. 'from' is the block that
+// enters the loop and 'stop' belongs to the region around it.
+struct Ir_hoist_frame
+{
+    int block;
+    int from;
+    int stop;
+    bool in_else;
+};
+
+Vec_declare(Ir_hoist_frame, struct Ir_hoist_frame);
+Vec_define(Ir_hoist_frame, struct Ir_hoist_frame)
+
+void Ir_hoist_region(struct Ir *ir, int index, int from, int stop, int *position, int *blocks)
+{
+    // The loops and branches whose nested regions are being hoisted from wait here instead of
+    // the C stack.
+    Vec(Ir_hoist_frame) frames;
+    Vec_Ir_hoist_frame_init(&frames);
+    for (;;)
+    {
+        while (index != stop && index != -1)
+        {
+            struct Block *block = Cfg_block(ir->cfg, index);
+            // Inner loops first, what they hoist may be invariant in the loops around them as well.
+            if (block->is_loop_header || block->terminator == TERMINATOR_BRANCH)
+            {
+                Vec_Ir_hoist_frame_add(&frames, (struct Ir_hoist_frame){.block = index, .from = from, .stop = stop});
+                stop = block->is_loop_header ? index : block->merge;
+                from = index;
+                index = block->target;
+            }
+            else if (block->terminator == TERMINATOR_JUMP)
+            {
+                from = index;
+                index = block->target;
+            }
+            else
+                index = -1;
+        }
+        if (frames.length == 0)
+            break;
+
+        struct Ir_hoist_frame *frame = Vec_Ir_hoist_frame_top(&frames);
+        index = frame->block;
+        struct Block *block = Cfg_block(ir->cfg, index);
+        if (block->is_loop_header)
+            Ir_hoist_loop(ir, index, frame->from, position, blocks);
+        else if (!frame->in_else)
+        {
+            frame->in_else = true;
+            from = index;
+            stop = block->merge;
+            index = block->else_target;
+            continue;
+        }
+        stop = frame->stop;
+        from = block->is_loop_header ? index : -1;
+        index = block->terminator == TERMINATOR_BRANCH ? block->merge : -1;
+        Vec_Ir_hoist_frame_pop(&frames);
+    }
+    Vec_Ir_hoist_frame_free(&frames);
+}
+
+// Loop invariant code motion.
+void Ir_hoist_loop_invariants(struct Ir *ir)
+{
+    int block_count = ir->cfg->blocks.length;
+    int *position = malloc(sizeof(int) * block_count);
+    int *blocks = malloc(sizeof(int) * block_count);
+    if (position == NULL || blocks == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < block_count; i++)
+        position[i] = -1;
+
+    Ir_hoist_region(ir, 0, -1, -1, position, blocks);
+
+    free(position);
+    free(blocks);
+}
+
+// Recognizes the loop with header 'header' as a counted loop. 'position' has to be set for the
+// blocks of the loop.
+bool Ir_find_counted_loop(struct Ir *ir, int header, int *position, struct Ir_counted_loop *loop)
+{
+    struct Block *block = Cfg_block(ir->cfg, header);
+    if (!block->is_loop_header || block->terminator != TERMINATOR_BRANCH || Ir_predecessor_count(ir, header) != 2)
+        return false;
+    int first_predecessor = ir->predecessors[ir->predecessor_start[header]];
+    loop->back = position[first_predecessor] != -1 ? 0 : 1;
+    loop->entry = 1 - loop->back;
+
+    struct Ir_value *condition = Ir_get(ir, ir->blocks[header].condition);
+    if (condition->opcode != IR_OPCODE_GT)
+        return false;
+    loop->bound = condition->operands[0];
+    loop->counter = condition->operands[1];
+    struct Ir_value *counter = Ir_get(ir, loop->counter);
+    struct Ir_value *bound = Ir_get(ir, loop->bound);
+    if (counter->opcode != IR_OPCODE_PHI || counter->block != header)
+        return false;
+    if (bound->opcode != IR_OPCODE_CONSTANT && position[bound->block] != -1)
+        return false;
+
+    loop->next = *Ir_phi_operand(ir, counter, loop->back);
+    struct Ir_value *next = Ir_get(ir, loop->next);
+    if (next->opcode != IR_OPCODE_PLUS)
+        return false;
+    if (next->operands[0] == loop->counter)
+        loop->step = next->operands[1];
+    else if (next->operands[1] == loop->counter)
+        loop->step = next->operands[0];
+    else
+        return false;
+    return Ir_get(ir, loop->step)->opcode == IR_OPCODE_CONSTANT;
+}
+
+// Finds the counted loops of the program for the backends. The counter of a block that is not
+// the header of a counted loop is -1.
+void Ir_find_counted_loops(struct Ir *ir)
+{
+    int block_count = ir->cfg->blocks.length;
+    free(ir->counted_loops);
+    ir->counted_loops = malloc(sizeof(struct Ir_counted_loop) * (block_count + 1));
+    int *position = malloc(sizeof(int) * (block_count + 1));
+    int *blocks = malloc(sizeof(int) * (block_count + 1));
+    if (ir->counted_loops == NULL || position == NULL || blocks == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    for (int i = 0; i < block_count; i++)
+        position[i] = -1;
+
+    for (int header = 0; header < block_count; header++)
+    {
+        ir->counted_loops[header].counter = -1;
+        if (!Cfg_block(ir->cfg, header)->is_loop_header)
+            continue;
+        int count = Cfg_loop_blocks(ir->cfg, header, position, blocks, INT_MAX);
+        if (!Ir_find_counted_loop(ir, header, position, &ir->counted_loops[header]))
+            ir->counted_loops[header].counter = -1;
+        for (int i = 0; i < count; i++)
+            position[blocks[i]] = -1;
+    }
+    free(position);
+    free(blocks);
+}
+
+// Drops every value that nothing depends on. Assignments to variables that are never read
+// again disappear with them. Prints, conditions and modulos that may fail are always kept.
+void Ir_eliminate_dead_code(struct Ir *ir)
+{
+    bool *live = calloc(ir->values.length + 1, sizeof(bool));
+    int *work = malloc(sizeof(int) * (ir->values.length + 1));
+    if (live == NULL || work == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+
+    int work_size = 0;
+    for (int b = 0; b < ir->cfg->blocks.length; b++)
+    {
+        int condition = ir->blocks[b].condition;
+        if (condition != -1 && !live[condition])
+        {
+            live[condition] = true;
+            work[work_size++] = condition;
+        }
+        for (int v = ir->blocks[b].first; v != -1; v = Ir_get(ir, v)->next)
+        {
+            struct Ir_value *value = Ir_get(ir, v);
+            if (!live[v] && (value->opcode == IR_OPCODE_PRINT || Ir_may_trap(ir, value)))
+            {
+                live[v] = true;
+                work[work_size++] = v;
+            }
+        }
+    }
+    while (work_size > 0)
+    {
+        struct Ir_value *value = Ir_get(ir, work[--work_size]);
+        Ir_for_each_operand(ir, value, operand, {
+            if (!live[*operand])
+            {
+                live[*operand] = true;
+                work[work_size++] = *operand;
+            }
+        });
+    }
+
+    for (int b = 0; b < ir->cfg->blocks.length; b++)
+    {
+        struct Ir_block *block = &ir->blocks[b];
+        int last = -1;
+        for (int v = block->first; v != -1; v = Ir_get(ir, v)->next)
+        {
+            if (!live[v])
+                continue;
+            if (last == -1)
+                block->first = v;
+            else
+                Ir_get(ir, last)->next = v;
+            last = v;
+        }
+        if (last == -1)
+            block->first = -1;
+        else
+            Ir_get(ir, last)->next = -1;
+        block->last = last;
+    }
+
+    free(live);
+    free(work);
+}
+
+void Ir_optimize(struct Ir *ir)
+{
+    Ir_propagate_copies(ir);
+    Ir_eliminate_common_subexpressions(ir);
+    Ir_propagate_copies(ir);
+    Ir_hoist_loop_invariants(ir);
+    Ir_eliminate_dead_code(ir);
+}
+
+// Inlined operations nest at most this deeply. The backends compute an inlined value with a
+// recursion over its operands, and a long chain of operations gets a place of its own for
+// every so many of them.
+#define IR_MAX_INLINE_DEPTH 64
+
+// Counts how often every value is used, for the backends to decide which values need a place
+// of their own.
+void Ir_count_uses(struct Ir *ir)
+{
+    free(ir->use_counts);
+    free(ir->use_blocks);
+    free(ir->inline_depths);
+    ir->use_counts = calloc(ir->values.length + 1, sizeof(int));
+    ir->use_blocks = malloc(sizeof(int) * (ir->values.length + 1));
+    ir->inline_depths = calloc(ir->values.length + 1, sizeof(int));
+    if (ir->use_counts == NULL || ir->use_blocks == NULL || ir->inline_depths == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+
+    for (int b = 0; b < ir->cfg->blocks.length; b++)
+    {
+        struct Ir_block *block = &ir->blocks[b];
+        if (block->condition != -1)
+        {
+            ir->use_counts[block->condition]++;
+            ir->use_blocks[block->condition] = b;
+        }
+        for (int v = block->first; v != -1; v = Ir_get(ir, v)->next)
+        {
+            struct Ir_value *value = Ir_get(ir, v);
+            if (value->opcode == IR_OPCODE_PHI)
+            {
+                for (int i = 0; i < Ir_predecessor_count(ir, b); i++)
+                {
+                    int operand = *Ir_phi_operand(ir, value, i);
+                    ir->use_counts[operand]++;
+                    ir->use_blocks[operand] = ir->predecessors[ir->predecessor_start[b] + i];
+                }
+                continue;
+            }
+            Ir_for_each_operand(ir, value, operand, {
+                ir->use_counts[*operand]++;
+                ir->use_blocks[*operand] = b;
+            });
+        }
+    }
+
+    // A value that is used once, in the block that computes it, can be computed right where it
+    // is used. Moving it there must not change what the program does, so it has to be pure.
+    // Blocks compute the operands of a value before the value, so their depths are known.
+    for (int b = 0; b < ir->cfg->blocks.length; b++)
+    {
+        for (int v = ir->blocks[b].first; v != -1; v = Ir_get(ir, v)->next)
+        {
+            struct Ir_value *value = Ir_get(ir, v);
+            if (!Ir_is_binary(value->opcode) || !Ir_is_pure(ir, value) || ir->use_counts[v] != 1 || ir->use_blocks[v] != b)
+                continue;
+            int depth = 1;
+            Ir_for_each_operand(ir, value, operand, {
+                if (ir->inline_depths[*operand] >= depth)
+                    depth = ir->inline_depths[*operand] + 1;
+            });
+            if (depth <= IR_MAX_INLINE_DEPTH)
+                ir->inline_depths[v] = depth;
+        }
+    }
+}
+
+bool Ir_is_inlined(struct Ir *ir, int v)
+{
+    return Ir_get(ir, v)->opcode == IR_OPCODE_CONSTANT || ir->inline_depths[v] > 0;
+}
+
+// Whether computing 'v' where it is used reads 'target'.
+bool Ir_reads(struct Ir *ir, int v, int target)
+{
+    if (v == target)
+        return true;
+    struct Ir_value *value = Ir_get(ir, v);
+    if (!Ir_is_binary(value->opcode) || !Ir_is_inlined(ir, v))
+        return false;
+    return Ir_reads(ir, value->operands[0], target) || Ir_reads(ir, value->operands[1], target);
+}
+
+// Whether the phis of 'block' can take their operands for the edge with index 'edge' one after
+// the other. They cannot when an operand reads a phi that was already written.
+bool Ir_phi_copies_in_order(struct Ir *ir, int block, int edge)
+{
+    for (int phi = ir->blocks[block].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
+    {
+        int operand = *Ir_phi_operand(ir, Ir_get(ir, phi), edge);
+        for (int written = ir->blocks[block].first; written != phi; written = Ir_get(ir, written)->next)
+        {
+            if (*Ir_phi_operand(ir, Ir_get(ir, written), edge) != written && Ir_reads(ir, operand, written))
+                return false;
+        }
+    }
+    return true;
+}
+
+#endif
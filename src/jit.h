@@ -0,0 +1,81 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "native.h"
+
+#if defined(__linux__) && defined(__x86_64__)
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef JIT_SUPPORTED
+// Names the runtime functions and the program in /tmp/perf-<pid>.map, so 'perf' can tell
+// where the samples that land in the JIT code belong.
+void jit_write_perf_map(struct Native *native, uint8_t *code)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    FILE *map = fopen(path, "w");
+    if (map == NULL)
+        return;
+    fprintf(map, "%" PRIxPTR " %x betsy_flush\n", (uintptr_t)(code + native->flush), native->print - native->flush);
+    fprintf(map, "%" PRIxPTR " %x betsy_print\n", (uintptr_t)(code + native->print), native->entry - native->print);
+    fprintf(map, "%" PRIxPTR " %x betsy_program\n", (uintptr_t)(code + native->entry), native->code.length - native->entry);
+    fclose(map);
+}
+#endif
+
+// Runs the program as machine code instead of bytecode. The code is the same the native backend
+// writes into an executable, except that it is called like a C function and returns when the
+// program halts. Returns false when the JIT cannot run here, the simulator runs the program then.
+bool jit_program(struct Ir *ir)
+{
+#ifdef JIT_SUPPORTED
+    uint8_t *buffer = calloc(8 + NATIVE_BUFFER_SIZE, 1);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    struct Native native = {.buffer = (uint64_t)(uintptr_t)buffer, .jit = true};
+    native_compile(&native, ir);
+
+    // The code is written while the memory is writable and only runs once it is executable.
+    size_t size = native.code.length;
+    uint8_t *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool mapped = code != MAP_FAILED;
+    if (mapped)
+    {
+        memcpy(code, native.code.data, size);
+        mapped = mprotect(code, size, PROT_READ | PROT_EXEC) == 0;
+        if (!mapped)
+            munmap(code, size);
+    }
+    if (mapped)
+    {
+        jit_write_perf_map(&native, code);
+        // The program writes to stdout on its own, after everything that is still buffered.
+        fflush(stdout);
+        void (*run)(void) = (void (*)(void))(code + native.entry);
+        run();
+        munmap(code, size);
+    }
+    Native_free(&native);
+    free(buffer);
+    return mapped;
+#else
+    (void)ir;
+    return false;
+#endif
+}
+
+#endif
@@ -0,0 +1,601 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>
+
+#include "arena.h"
+#include "intern.h"
+#include "operation.h"
+#include "sourceFile.h"
+#include "stringView.h"
+#include "tokenStream.h"
+
+// The vectorized word scanner classifies the source text in windows of 64 bytes. For every
+// window it builds bit masks (one bit per byte) of the printable bytes and the newlines, derives
+// where words start and removes the ones that lie inside of comments. Finding the next word is
+// then a matter of taking the lowest bit of a mask. SSE2 classifies 16 bytes per instruction and
+// is there on every x86-64 CPU. AVX2 classifies 32. GCC and Clang build the AVX2 classifier next
+// to the SSE2 one and pick it when the CPU has it, MSVC only builds it with /arch:AVX2. Without
+// SSE2 the byte by byte scanner is used.
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LEXER_VECTORIZED
+#if defined(__GNUC__)
+#include <immintrin.h>
+#define LEXER_AVX2
+#define LEXER_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define LEXER_AVX2
+#define LEXER_AVX2_TARGET
+#endif
+#endif
+
+struct FileIterator
+{
+    int start;
+    int length;
+#ifdef LEXER_VECTORIZED
+    // The current window ends at 'window_end'. The masks only contain the bits that have not
+    // been consumed yet.
+    int window_end;
+    uint64_t starts;
+    uint64_t graph;
+    bool graph_carry;
+    bool comment_carry;
+#endif
+};
+
+bool find_next_word_scalar(struct Source_file *source, struct FileIterator *iter)
+{
+    char *file_text = source->text;
+    int file_length = (int)source->length;
+    int pos = iter->start + iter->length;
+    // find start of the next word
+    while (1)
+    {
+        if (pos >= file_length)
+        {
+            return false;
+        }
+        else if (file_text[pos] == '#')
+        {
+            while (pos < file_length && file_text[pos] != '\n')
+                pos++;
+            pos--;
+        }
+        else if (isgraph((unsigned char)file_text[pos]))
+        {
+            iter->start = pos;
+            break;
+        }
+        pos++;
+    }
+
+    // find end of the current word
+    while (pos < file_length && isgraph((unsigned char)file_text[pos]))
+        pos++;
+    iter->length = pos - iter->start;
+    return true;
+}
+
+#ifdef LEXER_VECTORIZED
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define LEXER_WINDOW_SIZE 64
+
+int Bits_lowest(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// One bit per byte of the window, the lowest bit belongs to the first byte.
+struct Lexer_window
+{
+    uint64_t graph;
+    uint64_t newline;
+    uint64_t hash;
+};
+
+// A byte is printable (isgraph in the C locale) when it lies in 0x21..0x7E. As signed bytes
+// everything from 0x80 upwards is negative, so two signed compares are enough.
+struct Lexer_window Lexer_classify_window_sse2(char *text)
+{
+    struct Lexer_window window = {0};
+    for (int i = 0; i < LEXER_WINDOW_SIZE; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i graph = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x20)),
+                                      _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7F)));
+        window.graph |= (uint64_t)(uint32_t)_mm_movemask_epi8(graph) << i;
+        window.newline |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))) << i;
+        window.hash |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('#'))) << i;
+    }
+    return window;
+}
+
+#ifdef LEXER_AVX2
+
+LEXER_AVX2_TARGET struct Lexer_window Lexer_classify_window_avx2(char *text)
+{
+    struct Lexer_window window = {0};
+    for (int i = 0; i < LEXER_WINDOW_SIZE; i += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i graph = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(0x20)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7F), bytes));
+        window.graph |= (uint64_t)(uint32_t)_mm256_movemask_epi8(graph) << i;
+        window.newline |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'))) << i;
+        window.hash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('#'))) << i;
+    }
+    return window;
+}
+
+#endif
+
+// Whether windows are classified with AVX2. Set by Lexer_select_scanner, before any file is
+// lexed.
+#if defined(LEXER_AVX2) && !defined(__GNUC__)
+bool lexer_use_avx2 = true;
+#else
+bool lexer_use_avx2 = false;
+#endif
+
+// Uses AVX2 when the CPU has it.
+void Lexer_select_scanner(void)
+{
+#if defined(LEXER_AVX2) && defined(__GNUC__)
+    __builtin_cpu_init();
+    lexer_use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+struct Lexer_window Lexer_classify_window(char *text)
+{
+#ifdef LEXER_AVX2
+    if (lexer_use_avx2)
+        return Lexer_classify_window_avx2(text);
+#endif
+    return Lexer_classify_window_sse2(text);
+}
+
+void Lexer_load_window(struct Source_file *source, struct FileIterator *iter)
+{
+    int base = iter->window_end;
+    struct Lexer_window window;
+    if (base + LEXER_WINDOW_SIZE <= (int)source->length)
+        window = Lexer_classify_window(source->text + base);
+    else
+    {
+        // Zeros are neither printable nor newlines, so padding the last window ends its last word.
+        char padded[LEXER_WINDOW_SIZE] = {0};
+        memcpy(padded, source->text + base, source->length - base);
+        window = Lexer_classify_window(padded);
+    }
+
+    // A word starts at a printable byte that does not follow another one.
+    uint64_t starts = window.graph & ~((window.graph << 1) | (uint64_t)iter->graph_carry);
+
+    // A comment starts with a word that begins with '#' and reaches up to the next newline.
+    uint64_t comment_starts = (starts & window.hash) | (uint64_t)iter->comment_carry;
+    uint64_t comments = 0;
+    iter->comment_carry = false;
+    while (comment_starts != 0)
+    {
+        uint64_t from = comment_starts & (0 - comment_starts);
+        uint64_t after = window.newline & ~(from - 1);
+        uint64_t to = after & (0 - after);
+        if (to == 0)
+        {
+            comments |= ~(from - 1);
+            iter->comment_carry = true;
+            break;
+        }
+        comments |= to - from;
+        comment_starts &= ~(to | (to - 1));
+    }
+
+    iter->starts = starts & ~comments;
+    iter->graph = window.graph;
+    iter->graph_carry = window.graph >> (LEXER_WINDOW_SIZE - 1);
+    iter->window_end = base + LEXER_WINDOW_SIZE;
+}
+
+bool find_next_word(struct Source_file *source, struct FileIterator *iter)
+{
+    while (iter->starts == 0)
+    {
+        if (iter->window_end >= (int)source->length)
+            return false;
+        Lexer_load_window(source, iter);
+    }
+
+    int index = Bits_lowest(iter->starts);
+    uint64_t start = iter->starts & (0 - iter->starts);
+    iter->starts ^= start;
+    iter->start = iter->window_end - LEXER_WINDOW_SIZE + index;
+
+    // find end of the current word
+    uint64_t word_end = ~iter->graph & ~(start - 1);
+    if (word_end != 0)
+    {
+        iter->length = Bits_lowest(word_end) - index;
+        return true;
+    }
+    int pos = iter->window_end;
+    while (pos < (int)source->length && isgraph((unsigned char)source->text[pos]))
+        pos++;
+    iter->length = pos - iter->start;
+    return true;
+}
+
+#else
+
+void Lexer_select_scanner(void)
+{
+}
+
+bool find_next_word(struct Source_file *source, struct FileIterator *iter)
+{
+    return find_next_word_scalar(source, iter);
+}
+
+#endif
+
+bool tryParseInteger(struct String_view word, int32_t *out)
+{
+    int32_t i = 0;
+    int32_t sign = 1;
+    if (word.data[0] == '-')
+    {
+        sign = -1;
+        i++;
+    }
+    int32_t value = 0;
+    for (; i < word.length; i++)
+    {
+        if (word.data[i] == '_')
+            continue;
+
+        if (word.data[i] < '0' || word.data[i] > '9')
+        {
+            return false;
+        }
+        // Test overflow
+        int8_t unit = word.data[i] - '0';
+        if (value > INT32_MAX / 10 - unit)
+            return false; // TODO: Give error message?
+        value = value * 10 + unit;
+    }
+    *out = value * sign;
+    return true;
+}
+
+// Keywords and intrinsics are recognized with a perfect hash over the first character, the last
+// character and the length of a word, so every word costs one hash and at most one comparison.
+// The table is filled from the list below before the first file is lexed.
+#define KEYWORD_TABLE_SIZE 32
+#define KEYWORD_HASH(first, last, length) (((first) + 8 * (last) + 2 * (length)) & (KEYWORD_TABLE_SIZE - 1))
+#define KEYWORD(word, operation) {word, sizeof(word) - 1, &operation}
+
+struct Keyword
+{
+    char *word;
+    int length;
+    const struct Operation *op;
+};
+
+_Static_assert(INTRINSIC_TYPE_COUNT == 7, "Exhaustive handling of intrinsic types");
+_Static_assert(KEYWORD_TYPE_COUNT == 7, "Exhaustive handling of keyword types");
+const struct Keyword KEYWORDS[] = {
+    // INTRINSICS
+    KEYWORD("print", OP_INTRINSIC_PRINT),
+    KEYWORD("+", OP_INTRINSIC_PLUS),
+    KEYWORD("-", OP_INTRINSIC_MINUS),
+    KEYWORD(">", OP_INTRINSIC_GT),
+    KEYWORD("%", OP_INTRINSIC_MODULO),
+    KEYWORD("=", OP_INTRINSIC_EQUAL),
+    KEYWORD("or", OP_INTRINSIC_OR),
+    // KEYWORDS
+    KEYWORD("if", OP_KEYWORD_IF),
+    KEYWORD("var", OP_KEYWORD_VAR),
+    KEYWORD("do", OP_KEYWORD_DO),
+    KEYWORD("end", OP_KEYWORD_END),
+    KEYWORD("set", OP_KEYWORD_SET),
+    KEYWORD("while", OP_KEYWORD_WHILE),
+    KEYWORD("with", OP_KEYWORD_WITH),
+};
+
+#define KEYWORD_COUNT (int)(sizeof(KEYWORDS) / sizeof(KEYWORDS[0]))
+_Static_assert(sizeof(KEYWORDS) / sizeof(KEYWORDS[0]) == INTRINSIC_TYPE_COUNT + KEYWORD_TYPE_COUNT,
+               "Every intrinsic and keyword has to be in the keyword list");
+
+// The keyword of every hash, NULL where there is none.
+const struct Keyword *keyword_table[KEYWORD_TABLE_SIZE];
+
+// Fills the keyword table. Two words with the same hash would overwrite each other, so the hash
+// is checked on every start and not only in debug builds.
+void Keyword_table_init(void)
+{
+    for (int i = 0; i < KEYWORD_COUNT; i++)
+    {
+        const struct Keyword *keyword = &KEYWORDS[i];
+        int hash = KEYWORD_HASH(keyword->word[0], keyword->word[keyword->length - 1], keyword->length);
+        if (keyword_table[hash] != NULL && keyword_table[hash] != keyword)
+        {
+            fprintf(stderr, "ERROR: The keywords '%s' and '%s' have the same hash.\n", keyword_table[hash]->word, keyword->word);
+            exit(1);
+        }
+        keyword_table[hash] = keyword;
+    }
+}
+
+const struct Operation *find_keyword(char *word, int length)
+{
+    const struct Keyword *keyword = keyword_table[KEYWORD_HASH(word[0], word[length - 1], length)];
+    if (keyword != NULL && keyword->length == length && memcmp(keyword->word, word, length) == 0)
+        return keyword->op;
+    return NULL;
+}
+
+// Finds the next word of 'source' and turns it into an operation. 'offset' is the position of
+// the text in the file, so that a piece of a file can be lexed on its own.
+bool lex_word(struct Source_file *source, struct FileIterator *iter, uint32_t offset, struct Interner *interner, struct Operation *op)
+{
+    if (!find_next_word(source, iter))
+        return false;
+
+    char *word = source->text + iter->start;
+    int32_t value32;
+    const struct Operation *keyword = find_keyword(word, iter->length);
+    // INTRINSICS and KEYWORDS
+    if (keyword != NULL)
+        *op = *keyword;
+    // VALUES
+    else if (tryParseInteger((struct String_view){word, iter->length}, &value32))
+    {
+        *op = OP_VALUE_INT;
+        op->literal.value = value32;
+    }
+    else
+    {
+        *op = OP_IDENTIFIER;
+        op->identifier.name = Interner_intern(interner, word, iter->length);
+    }
+    op->offset = offset + (uint32_t)iter->start;
+    return true;
+}
+
+void lex_text(struct Token_stream *tokens, struct Source_file *source, uint32_t offset, struct Interner *interner)
+{
+    struct FileIterator iter = {0};
+    struct Operation op;
+    while (lex_word(source, &iter, offset, interner, &op))
+        Token_stream_add(tokens, &op);
+}
+
+// Comments end at a newline and words never contain one, so a file that is cut right after
+// newlines can be lexed in pieces. Every chunk is lexed by its own thread into its own token
+// stream and with its own interner.
+#define LEXER_MAX_THREADS 64
+#define LEXER_MIN_CHUNK_SIZE (1024 * 1024)
+
+struct Lexer_chunk
+{
+    struct Source_file text;
+    uint32_t offset;
+    struct Arena arena;
+    struct Interner interner;
+    struct Token_stream tokens;
+};
+
+int Lexer_chunk_run(void *data)
+{
+    struct Lexer_chunk *chunk = data;
+    lex_text(&chunk->tokens, &chunk->text, chunk->offset, &chunk->interner);
+    return 0;
+}
+
+// Appends the tokens of a chunk. The names of the chunk are interned again in the order they
+// were first seen, so the ids come out the same as when the whole file is lexed at once.
+void Lexer_chunk_merge(struct Token_stream *tokens, struct Interner *interner, struct Lexer_chunk *chunk)
+{
+    int *names = malloc(sizeof(int) * (chunk->interner.strings.length + 1));
+    if (names == NULL)
+    {
+        fprintf(stderr, "ERROR: Lexer allocation error.\n");
+        exit(1);
+    }
+    for (int i = 0; i < chunk->interner.strings.length; i++)
+    {
+        struct Interned_string *string = Vec_Interned_string_get(&chunk->interner.strings, i);
+        names[i] = Interner_intern(interner, string->text, string->length);
+    }
+
+    int length = chunk->tokens.length;
+    if (tokens->length + length > tokens->capacity)
+        Token_stream_reserve(tokens, tokens->length + length);
+    memcpy(tokens->kinds + tokens->length, chunk->tokens.kinds, sizeof(uint8_t) * length);
+    memcpy(tokens->offsets + tokens->length, chunk->tokens.offsets, sizeof(uint32_t) * length);
+    for (int i = 0; i < length; i++)
+    {
+        int32_t payload = chunk->tokens.payloads[i];
+        if (chunk->tokens.kinds[i] == OPERATION_TYPE_IDENTIFIER)
+            payload = names[payload];
+        tokens->payloads[tokens->length + i] = payload;
+    }
+    tokens->length += length;
+    free(names);
+}
+
+void Lexer_check_file(struct Source_file *source)
+{
+    Keyword_table_init();
+    Lexer_select_scanner();
+    if (source->length > INT32_MAX)
+    {
+        fprintf(stderr, "ERROR: File '%s' is too large.\n", source->filename);
+        exit(1);
+    }
+}
+
+void parse_file(struct Token_stream *tokens, struct Interner *interner, int thread_count)
+{
+    struct Source_file *source = tokens->source;
+    Lexer_check_file(source);
+
+    int chunk_count = thread_count;
+    if (chunk_count > LEXER_MAX_THREADS)
+        chunk_count = LEXER_MAX_THREADS;
+    if ((size_t)chunk_count > source->length / LEXER_MIN_CHUNK_SIZE)
+        chunk_count = (int)(source->length / LEXER_MIN_CHUNK_SIZE);
+    if (chunk_count <= 1)
+    {
+        lex_text(tokens, source, 0, interner);
+        return;
+    }
+
+    // Cut the file into pieces of about the same size that end right after a newline.
+    struct Lexer_chunk chunks[LEXER_MAX_THREADS];
+    size_t chunk_start = 0;
+    int chunk_index = 0;
+    while (chunk_start < source->length)
+    {
+        size_t chunk_end = source->length;
+        if (chunk_index < chunk_count - 1)
+        {
+            chunk_end = source->length / chunk_count * (chunk_index + 1);
+            if (chunk_end < chunk_start)
+                chunk_end = chunk_start;
+            char *newline = memchr(source->text + chunk_end, '\n', source->length - chunk_end);
+            chunk_end = newline == NULL ? source->length : (size_t)(newline - source->text) + 1;
+        }
+
+        struct Lexer_chunk *chunk = &chunks[chunk_index++];
+        chunk->text.filename = source->filename;
+        chunk->text.text = source->text + chunk_start;
+        chunk->text.length = chunk_end - chunk_start;
+        chunk->offset = (uint32_t)chunk_start;
+        Arena_init(&chunk->arena);
+        Interner_init(&chunk->interner, &chunk->arena);
+        Token_stream_init(&chunk->tokens, source);
+        chunk_start = chunk_end;
+    }
+    chunk_count = chunk_index;
+
+    // The first chunk is lexed on this thread. A chunk whose thread cannot be started is
+    // lexed here as well.
+    thrd_t threads[LEXER_MAX_THREADS];
+    bool started[LEXER_MAX_THREADS] = {0};
+    for (int i = 1; i < chunk_count; i++)
+        started[i] = thrd_create(&threads[i], Lexer_chunk_run, &chunks[i]) == thrd_success;
+    Lexer_chunk_run(&chunks[0]);
+
+    int token_count = 0;
+    for (int i = 0; i < chunk_count; i++)
+    {
+        if (i > 0 && started[i])
+            thrd_join(threads[i], NULL);
+        else if (i > 0)
+            Lexer_chunk_run(&chunks[i]);
+        token_count += chunks[i].tokens.length;
+    }
+
+    if (tokens->length + token_count > tokens->capacity)
+        Token_stream_reserve(tokens, tokens->length + token_count);
+    for (int i = 0; i < chunk_count; i++)
+    {
+        Lexer_chunk_merge(tokens, interner, &chunks[i]);
+        Token_stream_free(&chunks[i].tokens);
+        Interner_free(&chunks[i].interner);
+        Arena_free(&chunks[i].arena);
+    }
+}
+
+// The parser pulls its operations from a token source one at a time. By default the words are
+// lexed on demand, so only the next operation is held at any time. A source can also read
+// from a token stream that was lexed ahead of time, for example by several threads.
+struct Token_source
+{
+    struct Source_file *source;
+    struct Interner *interner;
+    struct FileIterator iter;
+    // NULL when lexing on demand.
+    struct Token_stream *tokens;
+    int index;
+    bool has_next;
+    struct Operation next;
+    // The operation that was returned last, for errors that happen after it.
+    struct Operation previous;
+};
+
+void Token_source_advance(struct Token_source *tokens)
+{
+    if (tokens->tokens == NULL)
+        tokens->has_next = lex_word(tokens->source, &tokens->iter, 0, tokens->interner, &tokens->next);
+    else
+    {
+        tokens->has_next = tokens->index < tokens->tokens->length;
+        if (tokens->has_next)
+            tokens->next = Token_stream_get(tokens->tokens, tokens->index++);
+    }
+}
+
+void Token_source_init(struct Token_source *tokens, struct Source_file *source, struct Interner *interner)
+{
+    Lexer_check_file(source);
+    memset(tokens, 0, sizeof(*tokens));
+    tokens->source = source;
+    tokens->interner = interner;
+    Token_source_advance(tokens);
+}
+
+void Token_source_init_stream(struct Token_source *tokens, struct Token_stream *stream)
+{
+    memset(tokens, 0, sizeof(*tokens));
+    tokens->source = stream->source;
+    tokens->tokens = stream;
+    Token_source_advance(tokens);
+}
+
+bool Token_source_hasNext(struct Token_source *tokens)
+{
+    return tokens->has_next;
+}
+
+struct Operation Token_source_next(struct Token_source *tokens)
+{
+    if (!tokens->has_next)
+    {
+        fprintf(stderr, "ERROR: Read past the end of the token source.\n");
+        exit(1);
+    }
+    tokens->previous = tokens->next;
+    Token_source_advance(tokens);
+    return tokens->previous;
+}
+
+struct Operation Token_source_peekNext(struct Token_source *tokens)
+{
+    if (!tokens->has_next)
+    {
+        fprintf(stderr, "ERROR: Read past the end of the token source.\n");
+        exit(1);
+    }
+    return tokens->next;
+}
+
+#endif
@@ -0,0 +1,978 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include "array.h"
+#include "cfg.h"
+#include "ir.h"
+
+// The native backend writes a static x86-64 Linux executable straight from the IR, without a C
+// compiler or a C library. The program is laid out the way 'lower_region' lays out bytecode.
+// Every value that is not computed where it is used lives in a register or in a stack slot,
+// the ones used most inside of loops get the registers. Expressions are computed in rax, with
+// r11 and the stack holding the left operand while the right one is computed.
+//
+// 'print' formats its number into an output buffer of its own, which is written to stdout with
+// a system call when it is full and when the program halts.
+//
+// The JIT in 'jit.h' runs the same code in memory.
+
+enum Native_register
+{
+    NATIVE_RAX,
+    NATIVE_RCX,
+    NATIVE_RDX,
+    NATIVE_RBX,
+    NATIVE_RSP,
+    NATIVE_RBP,
+    NATIVE_RSI,
+    NATIVE_RDI,
+    NATIVE_R8,
+    NATIVE_R9,
+    NATIVE_R10,
+    NATIVE_R11,
+    NATIVE_R12,
+    NATIVE_R13,
+    NATIVE_R14,
+    NATIVE_R15,
+};
+
+// Registers values can live in. rax, rdx and r11 are used to compute expressions, and the
+// runtime functions save every register they touch.
+static const enum Native_register native_registers[] = {
+    NATIVE_RBX, NATIVE_R12, NATIVE_R13, NATIVE_R14, NATIVE_R15, NATIVE_RSI,
+    NATIVE_RDI, NATIVE_R8, NATIVE_R9, NATIVE_R10, NATIVE_RCX};
+#define NATIVE_REGISTER_COUNT (int)(sizeof(native_registers) / sizeof(native_registers[0]))
+
+// The condition codes of the jumps that are used, as the second byte of a 'jcc rel32'.
+enum Native_condition
+{
+    NATIVE_ALWAYS = 0,
+    NATIVE_BELOW = 0x82,
+    NATIVE_NOT_BELOW = 0x83,
+    NATIVE_ZERO = 0x84,
+    NATIVE_NOT_ZERO = 0x85,
+    NATIVE_NOT_ABOVE = 0x86,
+    NATIVE_ABOVE = 0x87,
+    NATIVE_NOT_SIGN = 0x89,
+};
+
+#define NATIVE_TEXT_ADDRESS 0x400000
+#define NATIVE_HEADER_SIZE (64 + 2 * 56)
+// The output buffer starts with the number of bytes in it. It lies far enough behind the code
+// that large programs do not run into it.
+#define NATIVE_BUFFER_ADDRESS 0x80000000
+#define NATIVE_BUFFER_SIZE 8192
+
+struct Native_location
+{
+    bool in_register;
+    enum Native_register reg;
+    int slot;
+};
+
+Vec_declare(uint8_t, uint8_t);
+Vec_define(uint8_t, uint8_t)
+
+struct Native
+{
+    struct Ir *ir;
+    // The machine code.
+    Vec(uint8_t) code;
+    struct Native_location *locations;
+    int slot_count;
+    // Offsets of the runtime functions and of the program in 'code'.
+    int print;
+    int flush;
+    int entry;
+    // Where the output buffer is when the code runs.
+    uint64_t buffer;
+    // Code for the JIT is called like a C function and returns when the program halts.
+    bool jit;
+};
+
+void Native_bytes(struct Native *native, const uint8_t *bytes, int count)
+{
+    for (int i = 0; i < count; i++)
+        Vec_uint8_t_add(&native->code, bytes[i]);
+}
+
+#define Native_emit(native, ...) Native_bytes((native), (uint8_t[]){__VA_ARGS__}, sizeof((uint8_t[]){__VA_ARGS__}))
+
+void Native_int32(struct Native *native, int32_t value)
+{
+    Native_emit(native, (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24));
+}
+
+void Native_int64(struct Native *native, uint64_t value)
+{
+    Native_int32(native, (int32_t)value);
+    Native_int32(native, (int32_t)(value >> 32));
+}
+
+struct Native_location Native_register(enum Native_register reg)
+{
+    struct Native_location location = {.in_register = true, .reg = reg, .slot = -1};
+    return location;
+}
+
+// Emits a 64 bit instruction with a ModRM byte. 'reg' is a register or the extension of the
+// opcode, 'rm' a register or a stack slot below rbp.
+void Native_modrm(struct Native *native, uint8_t opcode, int reg, struct Native_location rm)
+{
+    if (rm.in_register)
+    {
+        Native_emit(native, 0x48 | (reg >> 3) << 2 | rm.reg >> 3, opcode, 0xC0 | (reg & 7) << 3 | (rm.reg & 7));
+    }
+    else
+    {
+        Native_emit(native, 0x48 | (reg >> 3) << 2, opcode, 0x80 | (reg & 7) << 3 | NATIVE_RBP);
+        Native_int32(native, -8 * (rm.slot + 1));
+    }
+}
+
+void Native_load(struct Native *native, enum Native_register reg, struct Native_location from)
+{
+    if (!from.in_register || from.reg != reg)
+        Native_modrm(native, 0x8B, reg, from);
+}
+
+void Native_store(struct Native *native, struct Native_location to, enum Native_register reg)
+{
+    if (!to.in_register || to.reg != reg)
+        Native_modrm(native, 0x89, reg, to);
+}
+
+// mov to, imm32 with the immediate sign extended, which is how the simulator reads literals.
+void Native_load_constant(struct Native *native, struct Native_location to, int32_t constant)
+{
+    Native_modrm(native, 0xC7, 0, to);
+    Native_int32(native, constant);
+}
+
+void Native_push(struct Native *native, enum Native_register reg)
+{
+    if (reg >= NATIVE_R8)
+        Native_emit(native, 0x41);
+    Native_emit(native, 0x50 + (reg & 7));
+}
+
+void Native_pop(struct Native *native, enum Native_register reg)
+{
+    if (reg >= NATIVE_R8)
+        Native_emit(native, 0x41);
+    Native_emit(native, 0x58 + (reg & 7));
+}
+
+// Emits a jump and returns where its target goes, for 'Native_patch'.
+int Native_jump(struct Native *native, enum Native_condition condition)
+{
+    if (condition == NATIVE_ALWAYS)
+        Native_emit(native, 0xE9);
+    else
+        Native_emit(native, 0x0F, condition);
+    Native_int32(native, 0);
+    return native->code.length - 4;
+}
+
+void Native_patch(struct Native *native, int at, int target)
+{
+    int32_t relative = target - (at + 4);
+    uint8_t *code = native->code.data;
+    for (int i = 0; i < 4; i++)
+        code[at + i] = (uint8_t)(relative >> (8 * i));
+}
+
+void Native_call(struct Native *native, int function)
+{
+    Native_emit(native, 0xE8);
+    Native_int32(native, 0);
+    Native_patch(native, native->code.length - 4, function);
+}
+
+// Writes the output buffer to stdout and empties it.
+void native_flush_function(struct Native *native)
+{
+    native->flush = native->code.length;
+    Native_push(native, NATIVE_RAX);
+    Native_push(native, NATIVE_RCX);
+    Native_push(native, NATIVE_RDX);
+    Native_push(native, NATIVE_RSI);
+    Native_push(native, NATIVE_RDI);
+    Native_push(native, NATIVE_R11);
+    // mov rsi, buffer; mov rdx, [rsi]; add rsi, 8
+    Native_emit(native, 0x48, 0xBE);
+    Native_int64(native, native->buffer);
+    Native_emit(native, 0x48, 0x8B, 0x16);
+    Native_emit(native, 0x48, 0x83, 0xC6, 0x08);
+    // write(1, rsi, rdx); mov qword [rsi - 8], 0
+    Native_emit(native, 0xB8, 1, 0, 0, 0);
+    Native_emit(native, 0xBF, 1, 0, 0, 0);
+    Native_emit(native, 0x0F, 0x05);
+    Native_emit(native, 0x48, 0xC7, 0x46, 0xF8);
+    Native_int32(native, 0);
+    Native_pop(native, NATIVE_R11);
+    Native_pop(native, NATIVE_RDI);
+    Native_pop(native, NATIVE_RSI);
+    Native_pop(native, NATIVE_RDX);
+    Native_pop(native, NATIVE_RCX);
+    Native_pop(native, NATIVE_RAX);
+    Native_emit(native, 0xC3);
+}
+
+// Appends eax as a signed decimal number and a newline to the output buffer. The digits are
+// written backwards below the stack pointer and then copied over.
+void native_print_function(struct Native *native)
+{
+    native->print = native->code.length;
+    Native_push(native, NATIVE_RCX);
+    Native_push(native, NATIVE_RSI);
+    Native_push(native, NATIVE_RDI);
+    Native_push(native, NATIVE_RDX);
+    Native_push(native, NATIVE_R11);
+    // movsxd rax, eax; mov rcx, rax; mov rdi, rsp; sub rsp, 32
+    Native_emit(native, 0x48, 0x63, 0xC0);
+    Native_emit(native, 0x48, 0x89, 0xC1);
+    Native_emit(native, 0x48, 0x89, 0xE7);
+    Native_emit(native, 0x48, 0x83, 0xEC, 0x20);
+    // dec rdi; mov byte [rdi], '\n'
+    Native_emit(native, 0x48, 0xFF, 0xCF);
+    Native_emit(native, 0xC6, 0x07, '\n');
+    // test rax, rax; jns positive; neg rax
+    Native_emit(native, 0x48, 0x85, 0xC0);
+    int positive = Native_jump(native, NATIVE_NOT_SIGN);
+    Native_emit(native, 0x48, 0xF7, 0xD8);
+    Native_patch(native, positive, native->code.length);
+    // mov r11d, 10
+    Native_emit(native, 0x41, 0xBB, 10, 0, 0, 0);
+    // digit: dec rdi; xor edx, edx; div r11; add dl, '0'; mov [rdi], dl; test rax, rax; jnz digit
+    int digit = native->code.length;
+    Native_emit(native, 0x48, 0xFF, 0xCF);
+    Native_emit(native, 0x31, 0xD2);
+    Native_emit(native, 0x49, 0xF7, 0xF3);
+    Native_emit(native, 0x80, 0xC2, '0');
+    Native_emit(native, 0x88, 0x17);
+    Native_emit(native, 0x48, 0x85, 0xC0);
+    Native_patch(native, Native_jump(native, NATIVE_NOT_ZERO), digit);
+    // test rcx, rcx; jns unsigned; dec rdi; mov byte [rdi], '-'
+    Native_emit(native, 0x48, 0x85, 0xC9);
+    int is_unsigned = Native_jump(native, NATIVE_NOT_SIGN);
+    Native_emit(native, 0x48, 0xFF, 0xCF);
+    Native_emit(native, 0xC6, 0x07, '-');
+    Native_patch(native, is_unsigned, native->code.length);
+    // lea rcx, [rsp + 32]; mov r11, buffer; mov rsi, [r11]
+    Native_emit(native, 0x48, 0x8D, 0x4C, 0x24, 0x20);
+    Native_emit(native, 0x49, 0xBB);
+    Native_int64(native, native->buffer);
+    Native_emit(native, 0x49, 0x8B, 0x33);
+    // copy: mov al, [rdi]; mov [r11 + rsi + 8], al; inc rsi; inc rdi; cmp rdi, rcx; jb copy
+    int copy = native->code.length;
+    Native_emit(native, 0x8A, 0x07);
+    Native_emit(native, 0x41, 0x88, 0x44, 0x33, 0x08);
+    Native_emit(native, 0x48, 0xFF, 0xC6);
+    Native_emit(native, 0x48, 0xFF, 0xC7);
+    Native_emit(native, 0x48, 0x39, 0xCF);
+    Native_patch(native, Native_jump(native, NATIVE_BELOW), copy);
+    // mov [r11], rsi; add rsp, 32
+    Native_emit(native, 0x49, 0x89, 0x33);
+    Native_emit(native, 0x48, 0x83, 0xC4, 0x20);
+    // Flush once the next number might not fit anymore.
+    Native_emit(native, 0x48, 0x81, 0xFE);
+    Native_int32(native, NATIVE_BUFFER_SIZE - 16);
+    int fits = Native_jump(native, NATIVE_BELOW);
+    Native_call(native, native->flush);
+    Native_patch(native, fits, native->code.length);
+    Native_pop(native, NATIVE_R11);
+    Native_pop(native, NATIVE_RDX);
+    Native_pop(native, NATIVE_RDI);
+    Native_pop(native, NATIVE_RSI);
+    Native_pop(native, NATIVE_RCX);
+    Native_emit(native, 0xC3);
+}
+
+bool native_is_leaf(struct Ir *ir, int v)
+{
+    return Ir_get(ir, v)->opcode == IR_OPCODE_CONSTANT || !Ir_is_inlined(ir, v);
+}
+
+void native_value(struct Native *native, int v);
+
+// Computes the left operand of 'v' into rax. Returns the right operand when it can be used
+// as it is, or -1 when it was computed into r11. A constant goes to the right where the
+// instruction takes it as an immediate, 'swapped' tells whether the operands changed places.
+int native_operands(struct Native *native, int v, bool *swapped)
+{
+    struct Ir *ir = native->ir;
+    struct Ir_value *value = Ir_get(ir, v);
+    int l = value->operands[0];
+    int r = value->operands[1];
+    *swapped = value->opcode != IR_OPCODE_MINUS && value->opcode != IR_OPCODE_MODULO &&
+               Ir_get(ir, l)->opcode == IR_OPCODE_CONSTANT && Ir_get(ir, r)->opcode != IR_OPCODE_CONSTANT;
+    if (*swapped)
+    {
+        l = value->operands[1];
+        r = value->operands[0];
+    }
+    if (native_is_leaf(ir, r))
+    {
+        native_value(native, l);
+        return r;
+    }
+    if (native_is_leaf(ir, l))
+    {
+        native_value(native, r);
+        Native_store(native, Native_register(NATIVE_R11), NATIVE_RAX);
+        native_value(native, l);
+        return -1;
+    }
+    native_value(native, l);
+    Native_push(native, NATIVE_RAX);
+    native_value(native, r);
+    Native_store(native, Native_register(NATIVE_R11), NATIVE_RAX);
+    Native_pop(native, NATIVE_RAX);
+    return -1;
+}
+
+// Emits the instruction 'opcode' rax, r or the one that takes an immediate with 'extension'.
+void native_arithmetic(struct Native *native, uint8_t opcode, int extension, int r)
+{
+    if (r == -1)
+        Native_modrm(native, opcode, NATIVE_RAX, Native_register(NATIVE_R11));
+    else if (Ir_get(native->ir, r)->opcode == IR_OPCODE_CONSTANT)
+    {
+        Native_modrm(native, 0x81, extension, Native_register(NATIVE_RAX));
+        Native_int32(native, Ir_get(native->ir, r)->constant);
+    }
+    else
+        Native_modrm(native, opcode, NATIVE_RAX, native->locations[r]);
+}
+
+// Finds the multiplier 'magic' for which (n * magic) >> (64 + shift) is n / divisor for every
+// 64 bit n, after Hacker's Delight, 'magicu'. When the multiplier needs 65 bits, 'add' is set
+// and 'magic' holds its lower 64 bits. Only uses 64 bit arithmetic.
+void Native_magic(uint64_t divisor, uint64_t *magic, int *shift, bool *add)
+{
+    uint64_t top = (uint64_t)1 << 63;
+    uint64_t nc = (uint64_t)-1 - (0 - divisor) % divisor;
+    uint64_t q1 = top / nc;
+    uint64_t r1 = top - q1 * nc;
+    uint64_t q2 = (top - 1) / divisor;
+    uint64_t r2 = (top - 1) - q2 * divisor;
+    uint64_t delta;
+    int p = 63;
+    *add = false;
+    do
+    {
+        p++;
+        if (r1 >= nc - r1)
+        {
+            q1 = 2 * q1 + 1;
+            r1 = 2 * r1 - nc;
+        }
+        else
+        {
+            q1 = 2 * q1;
+            r1 = 2 * r1;
+        }
+        if (r2 + 1 >= divisor - r2)
+        {
+            if (q2 >= top - 1)
+                *add = true;
+            q2 = 2 * q2 + 1;
+            r2 = 2 * r2 + 1 - divisor;
+        }
+        else
+        {
+            if (q2 >= top)
+                *add = true;
+            q2 = 2 * q2;
+            r2 = 2 * r2 + 1;
+        }
+        delta = divisor - 1 - r2;
+    } while (p < 128 && (q1 < delta || (q1 == delta && r1 == 0)));
+    *magic = q2 + 1;
+    *shift = p - 64;
+}
+
+// Computes rax % divisor for a positive constant 'divisor' without a division.
+void native_modulo_constant(struct Native *native, int32_t divisor)
+{
+    if ((divisor & (divisor - 1)) == 0)
+    {
+        // and rax, divisor - 1
+        Native_modrm(native, 0x81, 4, Native_register(NATIVE_RAX));
+        Native_int32(native, divisor - 1);
+        return;
+    }
+    uint64_t magic;
+    int shift;
+    bool add;
+    Native_magic((uint64_t)divisor, &magic, &shift, &add);
+    // mov r11, rax; mov rax, magic; mul r11
+    Native_store(native, Native_register(NATIVE_R11), NATIVE_RAX);
+    Native_emit(native, 0x48, 0xB8);
+    Native_int32(native, (int32_t)magic);
+    Native_int32(native, (int32_t)(magic >> 32));
+    Native_modrm(native, 0xF7, 4, Native_register(NATIVE_R11));
+    if (add)
+    {
+        // The quotient is ((n - high) / 2 + high) >> (shift - 1).
+        // mov rax, r11; sub rax, rdx; shr rax, 1; add rdx, rax
+        Native_load(native, NATIVE_RAX, Native_register(NATIVE_R11));
+        Native_modrm(native, 0x2B, NATIVE_RAX, Native_register(NATIVE_RDX));
+        Native_modrm(native, 0xD1, 5, Native_register(NATIVE_RAX));
+        Native_modrm(native, 0x03, NATIVE_RDX, Native_register(NATIVE_RAX));
+        shift--;
+    }
+    if (shift > 0)
+    {
+        // shr rdx, shift
+        Native_modrm(native, 0xC1, 5, Native_register(NATIVE_RDX));
+        Native_emit(native, (uint8_t)shift);
+    }
+    // imul rdx, rdx, divisor; mov rax, r11; sub rax, rdx
+    Native_modrm(native, 0x69, NATIVE_RDX, Native_register(NATIVE_RDX));
+    Native_int32(native, divisor);
+    Native_load(native, NATIVE_RAX, Native_register(NATIVE_R11));
+    Native_modrm(native, 0x2B, NATIVE_RAX, Native_register(NATIVE_RDX));
+}
+
+// Computes the operation 'v' into rax.
+void native_operation(struct Native *native, int v)
+{
+    struct Ir_value *value = Ir_get(native->ir, v);
+    bool swapped;
+    int r = native_operands(native, v, &swapped);
+    _Static_assert(IR_OPCODE_COUNT == 9, "Exhaustive handling of IR opcodes");
+    switch (value->opcode)
+    {
+    case IR_OPCODE_PLUS:
+        native_arithmetic(native, 0x03, 0, r);
+        break;
+    case IR_OPCODE_MINUS:
+        native_arithmetic(native, 0x2B, 5, r);
+        break;
+    case IR_OPCODE_OR:
+        native_arithmetic(native, 0x0B, 1, r);
+        break;
+    case IR_OPCODE_GT:
+    case IR_OPCODE_EQUAL:
+        // cmp; seta, setb or sete al; movzx eax, al
+        native_arithmetic(native, 0x3B, 7, r);
+        if (value->opcode == IR_OPCODE_GT)
+            Native_emit(native, 0x0F, swapped ? 0x92 : 0x97, 0xC0);
+        else
+            Native_emit(native, 0x0F, 0x94, 0xC0);
+        Native_emit(native, 0x0F, 0xB6, 0xC0);
+        break;
+    case IR_OPCODE_MODULO:
+    {
+        // Like in the simulator, a division by zero ends the program with a signal.
+        struct Native_location divisor = Native_register(NATIVE_R11);
+        if (r != -1 && Ir_get(native->ir, r)->opcode == IR_OPCODE_CONSTANT && Ir_get(native->ir, r)->constant > 0)
+        {
+            native_modulo_constant(native, Ir_get(native->ir, r)->constant);
+            break;
+        }
+        if (r != -1 && Ir_get(native->ir, r)->opcode == IR_OPCODE_CONSTANT)
+            Native_load_constant(native, divisor, Ir_get(native->ir, r)->constant);
+        else if (r != -1)
+            divisor = native->locations[r];
+        Native_emit(native, 0x31, 0xD2);
+        Native_modrm(native, 0xF7, 6, divisor);
+        Native_store(native, Native_register(NATIVE_RAX), NATIVE_RDX);
+        break;
+    }
+    default:
+        fprintf(stderr, "ERROR: IR opcode '%d' is not yet implemented in 'native_operation'.\n", value->opcode);
+        exit(1);
+    }
+}
+
+// Computes 'v' into rax.
+void native_value(struct Native *native, int v)
+{
+    struct Ir_value *value = Ir_get(native->ir, v);
+    if (value->opcode == IR_OPCODE_CONSTANT)
+        Native_load_constant(native, Native_register(NATIVE_RAX), value->constant);
+    else if (Ir_is_inlined(native->ir, v))
+        native_operation(native, v);
+    else
+        Native_load(native, NATIVE_RAX, native->locations[v]);
+}
+
+// Emits a jump that is taken when 'condition' is 'when'. A comparison that is only used by
+// the branch jumps on the flags it sets. Returns where the target of the jump goes.
+int native_branch(struct Native *native, int condition, bool when)
+{
+    struct Ir_value *value = Ir_get(native->ir, condition);
+    if (Ir_is_inlined(native->ir, condition) && (value->opcode == IR_OPCODE_GT || value->opcode == IR_OPCODE_EQUAL))
+    {
+        bool swapped;
+        int r = native_operands(native, condition, &swapped);
+        native_arithmetic(native, 0x3B, 7, r);
+        if (value->opcode == IR_OPCODE_GT && swapped)
+            return Native_jump(native, when ? NATIVE_BELOW : NATIVE_NOT_BELOW);
+        if (value->opcode == IR_OPCODE_GT)
+            return Native_jump(native, when ? NATIVE_ABOVE : NATIVE_NOT_ABOVE);
+        return Native_jump(native, when ? NATIVE_ZERO : NATIVE_NOT_ZERO);
+    }
+    native_value(native, condition);
+    Native_emit(native, 0x48, 0x85, 0xC0);
+    return Native_jump(native, when ? NATIVE_NOT_ZERO : NATIVE_ZERO);
+}
+
+// Stores the value of 'v' into 'to'.
+void native_move(struct Native *native, struct Native_location to, int v)
+{
+    struct Ir_value *value = Ir_get(native->ir, v);
+    if (value->opcode == IR_OPCODE_CONSTANT)
+        Native_load_constant(native, to, value->constant);
+    else if (!Ir_is_inlined(native->ir, v) && native->locations[v].in_register)
+        Native_store(native, to, native->locations[v].reg);
+    else
+    {
+        native_value(native, v);
+        Native_store(native, to, NATIVE_RAX);
+    }
+}
+
+void native_block(struct Native *native, int block)
+{
+    struct Ir *ir = native->ir;
+    for (int v = ir->blocks[block].first; v != -1; v = Ir_get(ir, v)->next)
+    {
+        struct Ir_value *value = Ir_get(ir, v);
+        if (value->opcode == IR_OPCODE_PHI || Ir_is_inlined(ir, v))
+            continue;
+        if (value->opcode == IR_OPCODE_PRINT)
+        {
+            native_value(native, value->operands[0]);
+            Native_call(native, native->print);
+            continue;
+        }
+        native_operation(native, v);
+        if (ir->use_counts[v] > 0)
+            Native_store(native, native->locations[v], NATIVE_RAX);
+    }
+}
+
+// Pushes the operands of the phis of block 'to' and then pops them into the phis, like
+// 'lower_phi_copies'.
+void native_phi_copies(struct Native *native, int to, int edge)
+{
+    struct Ir *ir = native->ir;
+    Vec(int) copied;
+    Vec_int_init(&copied);
+    for (int phi = ir->blocks[to].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
+    {
+        int operand = *Ir_phi_operand(ir, Ir_get(ir, phi), edge);
+        if (operand == phi)
+            continue;
+        native_value(native, operand);
+        Native_push(native, NATIVE_RAX);
+        Vec_int_add(&copied, phi);
+    }
+    while (copied.length > 0)
+    {
+        Native_pop(native, NATIVE_RAX);
+        Native_store(native, native->locations[Vec_int_pop(&copied)], NATIVE_RAX);
+    }
+    Vec_int_free(&copied);
+}
+
+// Gives the phis of block 'to' their values for the edge that comes from block 'from'. The
+// copies only go through the stack when they cannot happen one after the other.
+void native_edge(struct Native *native, int from, int to)
+{
+    struct Ir *ir = native->ir;
+    if (to == -1 || !Ir_has_phis(ir, to))
+        return;
+    int edge = Ir_predecessor_index(ir, to, from);
+
+    if (!Ir_phi_copies_in_order(ir, to, edge))
+    {
+        native_phi_copies(native, to, edge);
+        return;
+    }
+    for (int phi = ir->blocks[to].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
+    {
+        int operand = *Ir_phi_operand(ir, Ir_get(ir, phi), edge);
+        if (operand != phi)
+            native_move(native, native->locations[phi], operand);
+    }
+}
+
+// The registers the JIT has to give back to its caller the way it got them.
+static const enum Native_register native_callee_saved[] = {
+    NATIVE_RBX, NATIVE_RBP, NATIVE_R12, NATIVE_R13, NATIVE_R14, NATIVE_R15};
+#define NATIVE_CALLEE_SAVED_COUNT (int)(sizeof(native_callee_saved) / sizeof(native_callee_saved[0]))
+
+void native_halt(struct Native *native)
+{
+    Native_call(native, native->flush);
+    if (native->jit)
+    {
+        // mov rsp, rbp; pop the callee saved registers; ret
+        Native_emit(native, 0x48, 0x89, 0xEC);
+        for (int i = NATIVE_CALLEE_SAVED_COUNT - 1; i >= 0; i--)
+            Native_pop(native, native_callee_saved[i]);
+        Native_emit(native, 0xC3);
+        return;
+    }
+    // mov eax, 60; xor edi, edi; syscall
+    Native_emit(native, 0xB8, 60, 0, 0, 0);
+    Native_emit(native, 0x31, 0xFF);
+    Native_emit(native, 0x0F, 0x05);
+}
+
+// A loop or a branch whose nested region is being compiled, like 'struct Lower_frame'.
+struct Native_frame
+{
+    int block;
+    int stop;
+    int jump;
+    int start;
+    bool in_else;
+};
+
+Vec_declare(Native_frame, struct Native_frame);
+Vec_define(Native_frame, struct Native_frame)
+
+// Compiles the blocks from 'index' on until control reaches 'stop', with the same layout as
+// 'lower_region'.
+void native_region(struct Native *native, int index, int stop)
+{
+    struct Ir *ir = native->ir;
+    Vec(Native_frame) frames;
+    Vec_Native_frame_init(&frames);
+    for (;;)
+    {
+        while (index != stop && index != -1)
+        {
+            struct Block *block = Cfg_block(ir->cfg, index);
+            struct Native_frame frame = {.block = index, .stop = stop};
+            if (block->is_loop_header)
+            {
+                // The condition is placed after the body so every iteration only takes a single jump.
+                if (block->terminator == TERMINATOR_BRANCH)
+                {
+                    frame.jump = Native_jump(native, NATIVE_ALWAYS);
+                    frame.start = native->code.length;
+                }
+                else
+                {
+                    frame.start = native->code.length;
+                    native_block(native, index);
+                }
+                Vec_Native_frame_add(&frames, frame);
+                stop = index;
+                index = block->target;
+                continue;
+            }
+
+            native_block(native, index);
+            _Static_assert(TERMINATOR_COUNT == 3, "Exhaustive handling of terminators");
+            switch (block->terminator)
+            {
+            case TERMINATOR_JUMP:
+                native_edge(native, index, block->target);
+                index = block->target;
+                break;
+            case TERMINATOR_BRANCH:
+                frame.jump = native_branch(native, ir->blocks[index].condition, false);
+                native_edge(native, index, block->target);
+                Vec_Native_frame_add(&frames, frame);
+                stop = block->merge;
+                index = block->target;
+                break;
+            case TERMINATOR_HALT:
+                native_halt(native);
+                index = -1;
+                break;
+            default:
+                fprintf(stderr, "ERROR: Terminator type '%d' not implemented yet in 'native_region'.\n", block->terminator);
+                exit(1);
+            }
+        }
+        if (frames.length == 0)
+            break;
+
+        struct Native_frame *frame = Vec_Native_frame_top(&frames);
+        index = frame->block;
+        stop = frame->stop;
+        struct Block *block = Cfg_block(ir->cfg, index);
+        if (block->is_loop_header && block->terminator == TERMINATOR_BRANCH)
+        {
+            Native_patch(native, frame->jump, native->code.length);
+            native_block(native, index);
+            Native_patch(native, native_branch(native, ir->blocks[index].condition, true), frame->start);
+            native_edge(native, index, block->merge);
+            index = block->merge;
+        }
+        else if (block->is_loop_header)
+        {
+            Native_patch(native, Native_jump(native, NATIVE_ALWAYS), frame->start);
+            index = -1;
+        }
+        else if (!frame->in_else && (block->else_target != block->merge || (block->merge != -1 && Ir_has_phis(ir, block->merge))))
+        {
+            int else_jump = Native_jump(native, NATIVE_ALWAYS);
+            Native_patch(native, frame->jump, native->code.length);
+            native_edge(native, index, block->else_target);
+            frame->jump = else_jump;
+            frame->in_else = true;
+            stop = block->merge;
+            index = block->else_target;
+            continue;
+        }
+        else
+        {
+            Native_patch(native, frame->jump, native->code.length);
+            index = block->merge;
+        }
+        Vec_Native_frame_pop(&frames);
+    }
+    Vec_Native_frame_free(&frames);
+}
+
+// A loop or a branch whose nested region is being walked by 'native_loop_depths'.
+struct Native_depth_frame
+{
+    int block;
+    int stop;
+    bool in_else;
+};
+
+Vec_declare(Native_depth_frame, struct Native_depth_frame);
+Vec_define(Native_depth_frame, struct Native_depth_frame)
+
+// Finds how deeply every block is nested in loops, walking the program like 'native_region'.
+void native_loop_depths(struct Ir *ir, int *depths)
+{
+    Vec(Native_depth_frame) frames;
+    Vec_Native_depth_frame_init(&frames);
+    int index = 0;
+    int stop = -1;
+    int depth = 0;
+    for (;;)
+    {
+        while (index != stop && index != -1)
+        {
+            struct Block *block = Cfg_block(ir->cfg, index);
+            if (block->is_loop_header)
+                depth++;
+            depths[index] = depth;
+            if (block->is_loop_header || block->terminator == TERMINATOR_BRANCH)
+            {
+                Vec_Native_depth_frame_add(&frames, (struct Native_depth_frame){.block = index, .stop = stop});
+                stop = block->is_loop_header ? index : block->merge;
+                index = block->target;
+            }
+            else if (block->terminator == TERMINATOR_JUMP)
+                index = block->target;
+            else
+                index = -1;
+        }
+        if (frames.length == 0)
+            break;
+
+        struct Native_depth_frame *frame = Vec_Native_depth_frame_top(&frames);
+        struct Block *block = Cfg_block(ir->cfg, frame->block);
+        if (!block->is_loop_header && !frame->in_else)
+        {
+            frame->in_else = true;
+            stop = block->merge;
+            index = block->else_target;
+            continue;
+        }
+        if (block->is_loop_header)
+            depth--;
+        stop = frame->stop;
+        index = block->terminator == TERMINATOR_BRANCH ? block->merge : -1;
+        Vec_Native_depth_frame_pop(&frames);
+    }
+    Vec_Native_depth_frame_free(&frames);
+}
+
+// Gives every value that needs a place of its own a register or a stack slot. A use inside of
+// a loop weighs 8 times as much as one outside of it, the heaviest values get the registers.
+void native_allocate(struct Native *native)
+{
+    struct Ir *ir = native->ir;
+    int block_count = ir->cfg->blocks.length;
+    int *depths = calloc(block_count + 1, sizeof(int));
+    uint64_t *weights = calloc(ir->values.length + 1, sizeof(uint64_t));
+    native->locations = malloc(sizeof(struct Native_location) * (ir->values.length + 1));
+    if (depths == NULL || weights == NULL || native->locations == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    native_loop_depths(ir, depths);
+
+    for (int b = 0; b < block_count; b++)
+    {
+        uint64_t weight = (uint64_t)1 << (3 * (depths[b] < 16 ? depths[b] : 16));
+        if (ir->blocks[b].condition != -1)
+            weights[ir->blocks[b].condition] += weight;
+        for (int v = ir->blocks[b].first; v != -1; v = Ir_get(ir, v)->next)
+        {
+            struct Ir_value *value = Ir_get(ir, v);
+            weights[v] += weight;
+            if (value->opcode == IR_OPCODE_PHI)
+            {
+                for (int i = 0; i < Ir_predecessor_count(ir, b); i++)
+                {
+                    int predecessor = ir->predecessors[ir->predecessor_start[b] + i];
+                    weights[*Ir_phi_operand(ir, value, i)] += (uint64_t)1 << (3 * (depths[predecessor] < 16 ? depths[predecessor] : 16));
+                }
+                continue;
+            }
+            Ir_for_each_operand(ir, value, operand, { weights[*operand] += weight; });
+        }
+    }
+
+    // Values without a place of their own have no weight.
+    for (int v = 0; v < ir->values.length; v++)
+    {
+        struct Ir_value *value = Ir_get(ir, v);
+        native->locations[v].in_register = false;
+        native->locations[v].slot = -1;
+        if (value->opcode != IR_OPCODE_PHI && (!Ir_is_binary(value->opcode) || ir->use_counts[v] == 0 || Ir_is_inlined(ir, v)))
+            weights[v] = 0;
+    }
+    for (int i = 0; i < NATIVE_REGISTER_COUNT; i++)
+    {
+        int heaviest = -1;
+        for (int v = 0; v < ir->values.length; v++)
+        {
+            if (weights[v] > 0 && (heaviest == -1 || weights[v] > weights[heaviest]))
+                heaviest = v;
+        }
+        if (heaviest == -1)
+            break;
+        native->locations[heaviest] = Native_register(native_registers[i]);
+        weights[heaviest] = 0;
+    }
+    native->slot_count = 0;
+    for (int v = 0; v < ir->values.length; v++)
+    {
+        if (weights[v] > 0)
+            native->locations[v].slot = native->slot_count++;
+    }
+
+    free(depths);
+    free(weights);
+}
+
+void Native_put(uint8_t *at, uint64_t value, int size)
+{
+    for (int i = 0; i < size; i++)
+        at[i] = (uint8_t)(value >> (8 * i));
+}
+
+// Writes the ELF header and two program headers: one for the header and the code, one for
+// the zero initialized output buffer.
+void native_write_executable(struct Native *native, const char *path)
+{
+    uint8_t header[NATIVE_HEADER_SIZE] = {0x7F, 'E', 'L', 'F', 2, 1, 1};
+    uint64_t code_size = native->code.length;
+    if (NATIVE_TEXT_ADDRESS + NATIVE_HEADER_SIZE + code_size > NATIVE_BUFFER_ADDRESS)
+    {
+        fprintf(stderr, "ERROR: The program is too large for the native backend.\n");
+        exit(1);
+    }
+    Native_put(header + 16, 2, 2);    // e_type: executable
+    Native_put(header + 18, 0x3E, 2); // e_machine: x86-64
+    Native_put(header + 20, 1, 4);    // e_version
+    Native_put(header + 24, NATIVE_TEXT_ADDRESS + NATIVE_HEADER_SIZE + native->entry, 8);
+    Native_put(header + 32, 64, 8); // e_phoff
+    Native_put(header + 52, 64, 2); // e_ehsize
+    Native_put(header + 54, 56, 2); // e_phentsize
+    Native_put(header + 56, 2, 2);  // e_phnum
+
+    uint8_t *text = header + 64;
+    Native_put(text, 1, 4);     // PT_LOAD
+    Native_put(text + 4, 5, 4); // read and execute
+    Native_put(text + 16, NATIVE_TEXT_ADDRESS, 8);
+    Native_put(text + 24, NATIVE_TEXT_ADDRESS, 8);
+    Native_put(text + 32, NATIVE_HEADER_SIZE + code_size, 8);
+    Native_put(text + 40, NATIVE_HEADER_SIZE + code_size, 8);
+    Native_put(text + 48, 0x1000, 8);
+
+    uint8_t *data = header + 64 + 56;
+    Native_put(data, 1, 4);     // PT_LOAD
+    Native_put(data + 4, 6, 4); // read and write
+    Native_put(data + 16, NATIVE_BUFFER_ADDRESS, 8);
+    Native_put(data + 24, NATIVE_BUFFER_ADDRESS, 8);
+    Native_put(data + 40, 8 + NATIVE_BUFFER_SIZE, 8);
+    Native_put(data + 48, 0x1000, 8);
+
+    FILE *output;
+#ifdef _WIN32
+    if (fopen_s(&output, path, "wb"))
+#else
+    if ((output = fopen(path, "wb")) == NULL)
+#endif
+    {
+        fprintf(stderr, "ERROR: cannot open '%s' for writing\n", path);
+        exit(1);
+    }
+    fwrite(header, 1, sizeof(header), output);
+    fwrite(native->code.data, 1, native->code.length, output);
+    fclose(output);
+#ifndef _WIN32
+    chmod(path, 0755);
+#endif
+}
+
+// Compiles the program into 'native->code'. 'buffer' and 'jit' have to be set already.
+void native_compile(struct Native *native, struct Ir *ir)
+{
+    native->ir = ir;
+    Vec_uint8_t_init(&native->code);
+    Ir_count_uses(ir);
+    native_allocate(native);
+
+    native_flush_function(native);
+    native_print_function(native);
+    native->entry = native->code.length;
+
+    if (native->jit)
+    {
+        for (int i = 0; i < NATIVE_CALLEE_SAVED_COUNT; i++)
+            Native_push(native, native_callee_saved[i]);
+    }
+    // mov rbp, rsp; sub rsp, slots
+    Native_emit(native, 0x48, 0x89, 0xE5);
+    Native_emit(native, 0x48, 0x81, 0xEC);
+    Native_int32(native, 8 * native->slot_count);
+    native_region(native, 0, -1);
+    native_halt(native);
+}
+
+void Native_free(struct Native *native)
+{
+    free(native->locations);
+    Vec_uint8_t_free(&native->code);
+}
+
+// Compiles the program into the executable 'path'.
+void native_program(struct Ir *ir, const char *path)
+{
+    struct Native native = {.buffer = NATIVE_BUFFER_ADDRESS, .jit = false};
+    native_compile(&native, ir);
+    native_write_executable(&native, path);
+    Native_free(&native);
+}
+
+#endif
@@ -34,28 +34,21 @@ enum KeywordType
     KEYWORD_TYPE_END,
     KEYWORD_TYPE_SET,
     KEYWORD_TYPE_WHILE,
+    KEYWORD_TYPE_WITH,
     KEYWORD_TYPE_COUNT
 };
 
-struct Location
-{
-    char *filename;
-    int collumn;
-    int line;
-};
-
 struct Operation
 {
-    struct Location loc;
-    char *token;
+    // Offset of the operation's word in the source file. Its location and spelling are
+    // recovered from the source when they are needed.
+    uint32_t offset;
     enum Operation_type type;
     union
     {
         struct
         {
             enum Intrinsic_type type;
-            int nr_outputs;
-            int nr_inputs;
         } intrinsic;
         struct
         {
@@ -63,32 +56,30 @@ struct Operation
         } keyword;
         struct
         {
-            int64_t value;
+            int32_t value;
             enum Type_info typeInfo;
         } literal;
         struct
         {
-            char *word;
+            // Interned id of the identifier's spelling.
+            int name;
+            // Index of the variable in the frame, assigned by the parser.
+            int slot;
         } identifier;
     };
 };
 
-void Operation_free(struct Operation *op)
-{
-    free(op->token);
-}
-
-const struct Operation OP_INTRINSIC_PRINT = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_PRINT, .intrinsic.nr_inputs = 1, .intrinsic.nr_outputs = 0};
-const struct Operation OP_INTRINSIC_PLUS = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_PLUS, .intrinsic.nr_inputs = 2, .intrinsic.nr_outputs = 1};
-const struct Operation OP_INTRINSIC_MINUS = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_MINUS, .intrinsic.nr_inputs = 2, .intrinsic.nr_outputs = 1};
-const struct Operation OP_INTRINSIC_GT = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_GT, .intrinsic.nr_inputs = 2, .intrinsic.nr_outputs = 1};
-const struct Operation OP_INTRINSIC_MODULO = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_MODULO, .intrinsic.nr_inputs = 2, .intrinsic.nr_outputs = 1};
-const struct Operation OP_INTRINSIC_EQUAL = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_EQUAL, .intrinsic.nr_inputs = 2, .intrinsic.nr_outputs = 1};
-const struct Operation OP_INTRINSIC_OR = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_OR, .intrinsic.nr_inputs = 1, .intrinsic.nr_outputs = 1};
+const struct Operation OP_INTRINSIC_PRINT = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_PRINT};
+const struct Operation OP_INTRINSIC_PLUS = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_PLUS};
+const struct Operation OP_INTRINSIC_MINUS = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_MINUS};
+const struct Operation OP_INTRINSIC_GT = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_GT};
+const struct Operation OP_INTRINSIC_MODULO = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_MODULO};
+const struct Operation OP_INTRINSIC_EQUAL = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_EQUAL};
+const struct Operation OP_INTRINSIC_OR = {.type = OPERATION_TYPE_INTRINSIC, .intrinsic.type = INTRINSIC_TYPE_OR};
 
 const struct Operation OP_VALUE_INT = {.type = OPERATION_TYPE_VALUE, .literal.value = 0, .literal.typeInfo = TYPE_INFO_INT};
 
-const struct Operation OP_IDENTIFIER = {.type = OPERATION_TYPE_IDENTIFIER, .identifier.word = NULL};
+const struct Operation OP_IDENTIFIER = {.type = OPERATION_TYPE_IDENTIFIER, .identifier.name = -1, .identifier.slot = -1};
 
 const struct Operation OP_KEYWORD_IF = {.type = OPERATION_TYPE_KEYWORD, .keyword.type = KEYWORD_TYPE_IF};
 const struct Operation OP_KEYWORD_VAR = {.type = OPERATION_TYPE_KEYWORD, .keyword.type = KEYWORD_TYPE_VAR};
@@ -96,5 +87,6 @@ const struct Operation OP_KEYWORD_DO = {.type = OPERATION_TYPE_KEYWORD, .keyword
 const struct Operation OP_KEYWORD_END = {.type = OPERATION_TYPE_KEYWORD, .keyword.type = KEYWORD_TYPE_END};
 const struct Operation OP_KEYWORD_SET = {.type = OPERATION_TYPE_KEYWORD, .keyword.type = KEYWORD_TYPE_SET};
 const struct Operation OP_KEYWORD_WHILE = {.type = OPERATION_TYPE_KEYWORD, .keyword.type = KEYWORD_TYPE_WHILE};
+const struct Operation OP_KEYWORD_WITH = {.type = OPERATION_TYPE_KEYWORD, .keyword.type = KEYWORD_TYPE_WITH};
 
 #endif
@@ -0,0 +1,262 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "array.h"
+#include "expression.h"
+#include "operation.h"
+#include "statement.h"
+
+// The operations of an expression are stored in postfix order, so every value on the stack
+// belongs to a contiguous run of operations. While an expression is rewritten, each value
+// on the stack remembers where its run starts and whether it is a known constant.
+struct Fold_value
+{
+    int start;
+    bool is_constant;
+    uint64_t constant;
+    // The run contains a modulo that can divide by zero. Such a run is never dropped, so
+    // the program still fails where it would have without optimizations.
+    bool may_trap;
+};
+
+// Values are computed with the same 64 bit unsigned arithmetic the simulator uses. A result is
+// only folded into a literal when the literal gives back exactly the same value.
+bool Fold_fits_literal(uint64_t value)
+{
+    return (uint64_t)(int64_t)(int32_t)value == value;
+}
+
+bool Fold_operations_equal(struct Operation *a, struct Operation *b)
+{
+    if (a->type != b->type)
+        return false;
+    _Static_assert(OPERATION_TYPE_COUNT == 4, "Exhaustive handling of operation types");
+    switch (a->type)
+    {
+    case OPERATION_TYPE_INTRINSIC:
+        return a->intrinsic.type == b->intrinsic.type;
+    case OPERATION_TYPE_VALUE:
+        return a->literal.value == b->literal.value && a->literal.typeInfo == b->literal.typeInfo;
+    case OPERATION_TYPE_IDENTIFIER:
+        return a->identifier.slot == b->identifier.slot;
+    default:
+        return false;
+    }
+}
+
+// Two runs compute the same value when they consist of the same operations. Values never
+// have side effects, since 'print' does not produce one.
+bool Fold_runs_equal(Vec(Operation) *operations, struct Fold_value *l, struct Fold_value *r, int end)
+{
+    int length = r->start - l->start;
+    if (end - r->start != length)
+        return false;
+    for (int i = 0; i < length; i++)
+    {
+        if (!Fold_operations_equal(&operations->data[l->start + i], &operations->data[r->start + i]))
+            return false;
+    }
+    return true;
+}
+
+// Replaces the operations from 'start' up to 'end' with a single literal.
+struct Fold_value Fold_literal(Vec(Operation) *operations, int start, struct Operation *op, uint64_t value, enum Type_info type_info)
+{
+    struct Operation literal = OP_VALUE_INT;
+    literal.offset = op->offset;
+    literal.literal.value = (int32_t)value;
+    literal.literal.typeInfo = type_info;
+    operations->data[start] = literal;
+    operations->length = start + 1;
+
+    struct Fold_value folded = {.start = start, .is_constant = true, .constant = value, .may_trap = false};
+    return folded;
+}
+
+// Moves the run of 'value' that ends at 'end' to 'start', dropping everything in between.
+struct Fold_value Fold_keep(Vec(Operation) *operations, int start, struct Fold_value value, int end)
+{
+    memmove(&operations->data[start], &operations->data[value.start], (end - value.start) * sizeof(struct Operation));
+    operations->length = start + end - value.start;
+    value.start = start;
+    return value;
+}
+
+// Folds the intrinsic 'op' that was just appended to the rewritten operations.
+struct Fold_value Fold_binary(Vec(Operation) *operations, struct Operation *op, struct Fold_value l, struct Fold_value r)
+{
+    int end = operations->length;
+    if (l.is_constant && r.is_constant)
+    {
+        _Static_assert(INTRINSIC_TYPE_COUNT == 7, "Exhaustive handling of intrinsic types");
+        switch (op->intrinsic.type)
+        {
+        case INTRINSIC_TYPE_PLUS:
+            if (Fold_fits_literal(l.constant + r.constant))
+                return Fold_literal(operations, l.start, op, l.constant + r.constant, TYPE_INFO_INT);
+            break;
+        case INTRINSIC_TYPE_MINUS:
+            if (Fold_fits_literal(l.constant - r.constant))
+                return Fold_literal(operations, l.start, op, l.constant - r.constant, TYPE_INFO_INT);
+            break;
+        case INTRINSIC_TYPE_GT:
+            return Fold_literal(operations, l.start, op, l.constant > r.constant, TYPE_INFO_BOOL);
+        case INTRINSIC_TYPE_MODULO:
+            // Leave the division by zero to the program.
+            if (r.constant != 0 && Fold_fits_literal(l.constant % r.constant))
+                return Fold_literal(operations, l.start, op, l.constant % r.constant, TYPE_INFO_INT);
+            break;
+        case INTRINSIC_TYPE_EQUAL:
+            return Fold_literal(operations, l.start, op, l.constant == r.constant, TYPE_INFO_BOOL);
+        case INTRINSIC_TYPE_OR:
+            return Fold_literal(operations, l.start, op, l.constant || r.constant, TYPE_INFO_BOOL);
+        default:
+            break;
+        }
+    }
+
+    // Identities
+    bool may_trap = l.may_trap || r.may_trap;
+    _Static_assert(INTRINSIC_TYPE_COUNT == 7, "Exhaustive handling of intrinsic types");
+    switch (op->intrinsic.type)
+    {
+    case INTRINSIC_TYPE_PLUS:
+        if (r.is_constant && r.constant == 0)
+            return Fold_keep(operations, l.start, l, r.start);
+        if (l.is_constant && l.constant == 0)
+            return Fold_keep(operations, l.start, r, end - 1);
+        break;
+    case INTRINSIC_TYPE_MINUS:
+        if (r.is_constant && r.constant == 0)
+            return Fold_keep(operations, l.start, l, r.start);
+        if (!may_trap && Fold_runs_equal(operations, &l, &r, end - 1))
+            return Fold_literal(operations, l.start, op, 0, TYPE_INFO_INT);
+        break;
+    case INTRINSIC_TYPE_GT:
+        if (!may_trap && Fold_runs_equal(operations, &l, &r, end - 1))
+            return Fold_literal(operations, l.start, op, 0, TYPE_INFO_BOOL);
+        break;
+    case INTRINSIC_TYPE_MODULO:
+        if (!l.may_trap && r.is_constant && r.constant == 1)
+            return Fold_literal(operations, l.start, op, 0, TYPE_INFO_INT);
+        if (!r.is_constant || r.constant == 0)
+            may_trap = true;
+        break;
+    case INTRINSIC_TYPE_EQUAL:
+        if (!may_trap && Fold_runs_equal(operations, &l, &r, end - 1))
+            return Fold_literal(operations, l.start, op, 1, TYPE_INFO_BOOL);
+        break;
+    case INTRINSIC_TYPE_OR:
+        if ((l.is_constant && l.constant != 0 && !r.may_trap) || (r.is_constant && r.constant != 0 && !l.may_trap))
+            return Fold_literal(operations, l.start, op, 1, TYPE_INFO_BOOL);
+        if (l.is_constant && l.constant == 0)
+            return Fold_keep(operations, l.start, r, end - 1);
+        if (r.is_constant && r.constant == 0)
+            return Fold_keep(operations, l.start, l, r.start);
+        break;
+    default:
+        break;
+    }
+
+    struct Fold_value value = {.start = l.start, .is_constant = false, .may_trap = may_trap};
+    return value;
+}
+
+// Folds constant subexpressions and simplifies identities. The operations are rewritten in
+// place, the rewritten expression is never longer than the original one.
+void optimize_expression(struct Expression *exp)
+{
+    Vec(Operation) *operations = &exp->operations;
+    struct Fold_value *stack = malloc(sizeof(struct Fold_value) * (operations->length + 1));
+    if (stack == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    int stack_size = 0;
+
+    int length = operations->length;
+    operations->length = 0;
+    for (int i = 0; i < length; i++)
+    {
+        struct Operation op = operations->data[i];
+        int start = operations->length;
+        operations->data[operations->length++] = op;
+
+        _Static_assert(OPERATION_TYPE_COUNT == 4, "Exhaustive handling of operation types");
+        switch (op.type)
+        {
+        case OPERATION_TYPE_VALUE:
+            stack[stack_size++] = (struct Fold_value){.start = start, .is_constant = true, .constant = (uint64_t)(int64_t)op.literal.value, .may_trap = false};
+            break;
+        case OPERATION_TYPE_IDENTIFIER:
+            stack[stack_size++] = (struct Fold_value){.start = start, .is_constant = false, .may_trap = false};
+            break;
+        case OPERATION_TYPE_INTRINSIC:
+            if (op.intrinsic.type == INTRINSIC_TYPE_PRINT)
+            {
+                stack_size--;
+                break;
+            }
+            struct Fold_value r = stack[--stack_size];
+            struct Fold_value l = stack[--stack_size];
+            stack[stack_size++] = Fold_binary(operations, &op, l, r);
+            break;
+        default:
+            fprintf(stderr, "ERROR: Operation type '%d' not implemented yet in 'optimize_expression'.\n", op.type);
+            exit(1);
+        }
+    }
+    free(stack);
+}
+
+// Optimizes the expressions of 'statement' and adds the statements nested in it to 'pending'.
+void optimize_statement(struct Statement *statement, Vec(Statement_pointer) *pending)
+{
+    _Static_assert(STATEMENT_TYPE_COUNT == 6, "Exhaustive handling of statement types");
+    switch (statement->type)
+    {
+    case STATEMENT_TYPE_EXP:
+        optimize_expression(&statement->expression);
+        break;
+    case STATEMENT_TYPE_IF:
+        optimize_expression(&statement->iff.condition);
+        Vec_Statement_pointer_add(pending, statement->iff.action);
+        break;
+    case STATEMENT_TYPE_WHILE:
+        optimize_expression(&statement->whilee.condition);
+        Vec_Statement_pointer_add(pending, statement->whilee.action);
+        break;
+    case STATEMENT_TYPE_VAR:
+        optimize_expression(&statement->var.assignment);
+        break;
+    case STATEMENT_TYPE_SET:
+        optimize_expression(&statement->set.assignment);
+        break;
+    case STATEMENT_TYPE_BLOCK:
+        for (int i = 0; i < statement->block.statements.length; i++)
+            Vec_Statement_pointer_add(pending, Vec_Statement_get(&statement->block.statements, i));
+        break;
+    default:
+        fprintf(stderr, "ERROR: Statement type '%d' not implemented yet in 'optimize_statement'.\n", statement->type);
+        exit(1);
+    }
+}
+
+void optimize_program(Vec(Statement) *program)
+{
+    // Statements are optimized one at a time from a work list, however deeply they are nested.
+    Vec(Statement_pointer) pending;
+    Vec_Statement_pointer_init(&pending);
+    for (int i = 0; i < program->length; i++)
+        Vec_Statement_pointer_add(&pending, Vec_Statement_get(program, i));
+    while (pending.length > 0)
+        optimize_statement(Vec_Statement_pointer_pop(&pending), &pending);
+    Vec_Statement_pointer_free(&pending);
+}
+
+#endif
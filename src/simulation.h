@@ -1,271 +1,545 @@
 #pragma once
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdint.h>
 
-#include "operation.h"
-#include "expression.h"
-#include "statement.h"
+#include "bytecode.h"
+#include "cfg.h"
+#include "ir.h"
+#include "tier.h"
 
-#define sim_error(location, ...)                                                                     \
-    {                                                                                                \
-        fprintf(stderr, "%s:%d:%d SIM_ERROR: ", location.filename, location.line, location.collumn); \
-        fprintf(stderr, __VA_ARGS__);                                                                \
-        exit(1);                                                                                     \
+#define sim_error(...)                     \
+    {                                      \
+        fprintf(stderr, "SIM_ERROR: ");    \
+        fprintf(stderr, __VA_ARGS__);      \
+        exit(1);                           \
     }
 
-struct Sim_value
+// Counts the heap allocations of the simulator, all of which go through 'sim_allocate'. The
+// stack and the frame are sized while lowering and allocated before the first instruction runs,
+// and the tier writes and compiles hot loops on a thread of its own, so running the program
+// itself allocates nothing.
+bool sim_counting = false;
+long sim_allocation_count = 0;
+
+void *sim_allocate(size_t count, size_t size)
 {
-    uint64_t data;
-    enum Type_info type;
-};
+    void *memory = calloc(count, size);
+    if (memory == NULL)
+    {
+        fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+        exit(1);
+    }
+    if (sim_counting)
+        sim_allocation_count++;
+    return memory;
+}
 
-struct Sim_identifier
+// Allocations of the C library do not go through 'sim_allocate'. test/count_allocations.c,
+// which test.py preloads, defines this hook to count every allocation of the thread that runs
+// the program. Without it the hook is null.
+#if defined(__GNUC__) && !defined(_WIN32)
+#define SIM_ALLOCATION_HOOK
+#include <unistd.h>
+void sim_allocation_hook(bool running) __attribute__((weak));
+#endif
+
+// C libraries allocate the buffer of stdout at the first write, which would be in the middle of
+// the program.
+void sim_prepare_output(void)
 {
-    struct Operation *identifier;
-    struct Sim_value value;
-};
+#ifdef SIM_ALLOCATION_HOOK
+    static char buffer[BUFSIZ];
+    static bool prepared = false;
+    if (!prepared)
+        setvbuf(stdout, buffer, isatty(fileno(stdout)) ? _IOLBF : _IOFBF, sizeof(buffer));
+    prepared = true;
+#endif
+}
+
+void sim_start_counting(void)
+{
+    sim_allocation_count = 0;
+    sim_counting = true;
+#ifdef SIM_ALLOCATION_HOOK
+    if (sim_allocation_hook)
+        sim_allocation_hook(true);
+#endif
+}
 
-struct Sim_identifier *get_sim_identifier(struct Array *identifiers, char *id)
+// Returns the allocations made since 'sim_start_counting'.
+long sim_stop_counting(void)
 {
-    for (int i = 0; i < identifiers->length; i++)
+#ifdef SIM_ALLOCATION_HOOK
+    if (sim_allocation_hook)
+        sim_allocation_hook(false);
+#endif
+    sim_counting = false;
+    return sim_allocation_count;
+}
+
+// Computed goto dispatch jumps straight from one instruction handler to the next one instead
+// of going back through a single switch. Compilers without the extension fall back to the switch.
+#if defined(__GNUC__) || defined(__clang__)
+#define SIM_THREADED_DISPATCH
+#endif
+
+// Values that are computed right where they are used only live on the stack. Every other
+// value has a frame slot of its own in 'slots'.
+void lower_value(struct Bytecode *bytecode, struct Ir *ir, int *slots, int v);
+
+// Emits the instructions that compute 'v'. Its operands are computed or loaded first.
+void lower_operation(struct Bytecode *bytecode, struct Ir *ir, int *slots, int v)
+{
+    struct Ir_value *value = Ir_get(ir, v);
+    _Static_assert(IR_OPCODE_COUNT == 9, "Exhaustive handling of IR opcodes");
+    switch (value->opcode)
     {
-        struct Sim_identifier *element = Array_get(identifiers, i);
-        if (strcmp(element->identifier->token, id) == 0)
-        {
-            return element;
-        }
+    case IR_OPCODE_CONSTANT:
+        Bytecode_emit(bytecode, OPCODE_PUSH, value->constant);
+        return;
+    case IR_OPCODE_PRINT:
+        lower_value(bytecode, ir, slots, value->operands[0]);
+        Bytecode_emit(bytecode, OPCODE_PRINT, 0);
+        return;
+    case IR_OPCODE_PHI:
+        sim_error("A phi cannot be computed in 'lower_operation'.\n");
+    default:
+        break;
+    }
+
+    lower_value(bytecode, ir, slots, value->operands[0]);
+    lower_value(bytecode, ir, slots, value->operands[1]);
+    switch (value->opcode)
+    {
+    case IR_OPCODE_PLUS:
+        Bytecode_emit(bytecode, OPCODE_PLUS, 0);
+        break;
+    case IR_OPCODE_MINUS:
+        Bytecode_emit(bytecode, OPCODE_MINUS, 0);
+        break;
+    case IR_OPCODE_GT:
+        Bytecode_emit(bytecode, OPCODE_GT, 0);
+        break;
+    case IR_OPCODE_MODULO:
+        Bytecode_emit(bytecode, OPCODE_MODULO, 0);
+        break;
+    case IR_OPCODE_EQUAL:
+        Bytecode_emit(bytecode, OPCODE_EQUAL, 0);
+        break;
+    case IR_OPCODE_OR:
+        Bytecode_emit(bytecode, OPCODE_OR, 0);
+        break;
+    default:
+        sim_error("IR opcode '%d' not implemented yet in 'lower_operation'.\n", value->opcode);
     }
-    return NULL;
 }
 
-void simulate_expression(struct Expression exp, struct Array *outputs, struct Array *identifiers)
+// Pushes the value of 'v'.
+void lower_value(struct Bytecode *bytecode, struct Ir *ir, int *slots, int v)
 {
-    outputs->length = 0;
+    if (Ir_is_inlined(ir, v))
+        lower_operation(bytecode, ir, slots, v);
+    else
+        Bytecode_emit(bytecode, OPCODE_LOAD, slots[v]);
+}
+
+void lower_block(struct Bytecode *bytecode, struct Ir *ir, int *slots, int block)
+{
+    for (int v = ir->blocks[block].first; v != -1; v = Ir_get(ir, v)->next)
+    {
+        struct Ir_value *value = Ir_get(ir, v);
+        if (value->opcode == IR_OPCODE_PHI || Ir_is_inlined(ir, v))
+            continue;
+        lower_operation(bytecode, ir, slots, v);
+        if (value->opcode == IR_OPCODE_PRINT)
+            continue;
+        if (ir->use_counts[v] == 0)
+            Bytecode_emit(bytecode, OPCODE_POP, 1);
+        else
+            Bytecode_emit(bytecode, OPCODE_STORE, slots[v]);
+    }
+}
+
+// Pushes the operands of the phis of block 'to' for the edge with index 'edge' and then stores
+// them, so the copies happen all at once, even when they read each other.
+void lower_phi_copies(struct Bytecode *bytecode, struct Ir *ir, int *slots, int to, int edge)
+{
+    Vec(int) copied;
+    Vec_int_init(&copied);
+    for (int phi = ir->blocks[to].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
+    {
+        int operand = *Ir_phi_operand(ir, Ir_get(ir, phi), edge);
+        if (operand == phi)
+            continue;
+        lower_value(bytecode, ir, slots, operand);
+        Vec_int_add(&copied, phi);
+    }
+    // The operand of the last phi is on top of the stack.
+    while (copied.length > 0)
+        Bytecode_emit(bytecode, OPCODE_STORE, slots[Vec_int_pop(&copied)]);
+    Vec_int_free(&copied);
+}
+
+// Gives the phis of block 'to' their values for the edge that comes from block 'from'.
+void lower_edge(struct Bytecode *bytecode, struct Ir *ir, int *slots, int from, int to)
+{
+    if (to != -1 && Ir_has_phis(ir, to))
+        lower_phi_copies(bytecode, ir, slots, to, Ir_predecessor_index(ir, to, from));
+}
+
+// Starts every iteration of the loop with header 'header' with a LOOP instruction, when the
+// loops are counted. Returns the index of the loop, -1 when it is not counted.
+int lower_loop(struct Bytecode *bytecode, int header)
+{
+    if (!bytecode->count_loops)
+        return -1;
+    struct Bytecode_loop loop = {.header = header, .exit = -1};
+    Vec_Bytecode_loop_add(&bytecode->loops, loop);
+    Bytecode_emit(bytecode, OPCODE_LOOP, bytecode->loops.length - 1);
+    return bytecode->loops.length - 1;
+}
+
+// A loop or a branch whose nested region is being lowered. 'stop' belongs to the region around
+// it. 'jump' is the jump to patch once the nested region is done and 'start' the instruction
+// a loop jumps back to.
+struct Lower_frame
+{
+    int block;
+    int stop;
+    int jump;
+    int start;
+    bool in_else;
+};
+
+Vec_declare(Lower_frame, struct Lower_frame);
+Vec_define(Lower_frame, struct Lower_frame)
 
-    for (int j = 0; j < exp.operations.length; j++)
+// Lowers the blocks from 'index' on until control reaches 'stop', following the structure the
+// control flow graph was built with.
+void lower_region(struct Bytecode *bytecode, struct Ir *ir, int *slots, int index, int stop)
+{
+    // The loops and branches whose nested regions are being lowered wait here instead of the
+    // C stack.
+    Vec(Lower_frame) frames;
+    Vec_Lower_frame_init(&frames);
+    for (;;)
     {
-        struct Operation *op = Array_get(&exp.operations, j);
-        struct Sim_value *r, *l;
-        //_Static_assert(OPERATION_TYPE_COUNT == 3, "Exhaustive handling of Operations");
-        switch (op->type)
+        while (index != stop && index != -1)
         {
-        case OPERATION_TYPE_INTRINSIC:
-            switch (op->intrinsic.type)
+            struct Block *block = Cfg_block(ir->cfg, index);
+            struct Lower_frame frame = {.block = index, .stop = stop};
+            if (block->is_loop_header)
             {
-            case INTRINSIC_TYPE_PRINT:
-                if (outputs->length < 1)
-                    sim_error(op->loc, "Not enough values for the print intrinsic.\n");
-                struct Sim_value *print_value = Array_pop(outputs);
-                switch (print_value->type)
+                // The condition is placed after the body so every iteration only takes a single jump.
+                if (block->terminator == TERMINATOR_BRANCH)
                 {
-                case TYPE_INFO_INT:
-                    printf("%d\n", (int32_t)print_value->data);
-                    break;
-                default:
-                    sim_error(op->loc, "Print intrinsic not applicable for type %d.\n", print_value->type);
-                    break;
+                    frame.jump = Bytecode_emit(bytecode, OPCODE_JUMP, 0);
+                    frame.start = bytecode->instructions.length;
                 }
+                else
+                {
+                    frame.start = bytecode->instructions.length;
+                    lower_loop(bytecode, index);
+                    lower_block(bytecode, ir, slots, index);
+                }
+                Vec_Lower_frame_add(&frames, frame);
+                stop = index;
+                index = block->target;
+                continue;
+            }
+
+            lower_block(bytecode, ir, slots, index);
+            _Static_assert(TERMINATOR_COUNT == 3, "Exhaustive handling of terminators");
+            switch (block->terminator)
+            {
+            case TERMINATOR_JUMP:
+                lower_edge(bytecode, ir, slots, index, block->target);
+                index = block->target;
                 break;
-            case INTRINSIC_TYPE_PLUS:
-                if (outputs->length < 2)
-                    sim_error(op->loc, "Not enough values for the plus intrinsic.\n");
-                r = Array_pop(outputs);
-                l = Array_pop(outputs);
-                // TODO: type check
-                struct Sim_value plus_result = {
-                    .data = l->data + r->data,
-                    .type = r->type,
-                };
-                Array_add(outputs, &plus_result);
-                break;
-            case INTRINSIC_TYPE_MINUS:
-                if (outputs->length < 2)
-                    sim_error(op->loc, "Not enough values for the minus intrinsic.\n");
-                r = Array_pop(outputs);
-                l = Array_pop(outputs);
-                // TODO: type check
-                struct Sim_value minus_result = {
-                    .data = l->data - r->data,
-                    .type = r->type,
-                };
-                Array_add(outputs, &minus_result);
-                break;
-            case INTRINSIC_TYPE_GT:
-                if (outputs->length < 2)
-                    sim_error(op->loc, "Not enough values for the greater than intrinsic.\n");
-                r = Array_pop(outputs);
-                l = Array_pop(outputs);
-                // TODO: type check
-                struct Sim_value gt_result = {
-                    .data = l->data > r->data,
-                    .type = r->type,
-                };
-                Array_add(outputs, &gt_result);
-                break;
-            case INTRINSIC_TYPE_MODULO:
-                if (outputs->length < 2)
-                    sim_error(op->loc, "Not enough values for the modulo intrinsic.\n");
-                r = Array_pop(outputs);
-                l = Array_pop(outputs);
-                // TODO: type check
-                struct Sim_value modulo_result = {
-                    .data = l->data % r->data,
-                    .type = r->type,
-                };
-                Array_add(outputs, &modulo_result);
-                break;
-            case INTRINSIC_TYPE_EQUAL:
-                if (outputs->length < 2)
-                    sim_error(op->loc, "Not enough values for the equal intrinsic.\n");
-                r = Array_pop(outputs);
-                l = Array_pop(outputs);
-                // TODO: type check
-                struct Sim_value equal_result = {
-                    .data = l->data == r->data,
-                    .type = r->type,
-                };
-                Array_add(outputs, &equal_result);
+            case TERMINATOR_BRANCH:
+                lower_value(bytecode, ir, slots, ir->blocks[index].condition);
+                frame.jump = Bytecode_emit(bytecode, OPCODE_JUMP_IF_ZERO, 0);
+                lower_edge(bytecode, ir, slots, index, block->target);
+                Vec_Lower_frame_add(&frames, frame);
+                stop = block->merge;
+                index = block->target;
                 break;
-            case INTRINSIC_TYPE_OR:
-                if (outputs->length < 2)
-                    sim_error(op->loc, "Not enough values for the or intrinsic.\n");
-                r = Array_pop(outputs);
-                l = Array_pop(outputs);
-                // TODO: type check
-                struct Sim_value or_result = {
-                    .data = l->data || r->data,
-                    .type = r->type,
-                };
-                Array_add(outputs, &or_result);
+            case TERMINATOR_HALT:
+                Bytecode_emit(bytecode, OPCODE_HALT, 0);
+                index = -1;
                 break;
             default:
-                sim_error(op->loc, "Intrinsic of type '%d' not implemented yet in 'simulate_expression'", op->intrinsic.type);
-                break;
+                sim_error("Terminator of type '%d' not implemented yet in 'lower_region'.\n", block->terminator);
             }
+        }
+        if (frames.length == 0)
             break;
-        case OPERATION_TYPE_VALUE:
-            struct Sim_value value_result = {
-                .data = op->literal.value,
-                .type = op->literal.typeInfo,
-            };
-            Array_add(outputs, &value_result);
-            break;
-        case OPERATION_TYPE_IDENTIFIER:
-            struct Sim_identifier *id_elem = get_sim_identifier(identifiers, op->token);
-            if (id_elem == NULL)
-                sim_error(op->loc, "Unknwon identifier '%s'.\n", op->token);
-            Array_add(outputs, &id_elem->value);
-            break;
-        default:
-            sim_error(op->loc, "Operation of type '%d' not implemented yet in 'simulate_expression'", op->type);
-            break;
+
+        // The nested region is done, the loop or branch it belongs to carries on.
+        struct Lower_frame *frame = Vec_Lower_frame_top(&frames);
+        index = frame->block;
+        stop = frame->stop;
+        struct Block *block = Cfg_block(ir->cfg, index);
+        if (block->is_loop_header && block->terminator == TERMINATOR_BRANCH)
+        {
+            Bytecode_patch_jump(bytecode, frame->jump, bytecode->instructions.length);
+            int loop = lower_loop(bytecode, index);
+            lower_block(bytecode, ir, slots, index);
+            lower_value(bytecode, ir, slots, ir->blocks[index].condition);
+            Bytecode_emit(bytecode, OPCODE_JUMP_IF_NOT_ZERO, frame->start);
+            lower_edge(bytecode, ir, slots, index, block->merge);
+            if (loop != -1)
+                Vec_Bytecode_loop_get(&bytecode->loops, loop)->exit = bytecode->instructions.length;
+            index = block->merge;
         }
+        else if (block->is_loop_header)
+        {
+            Bytecode_emit(bytecode, OPCODE_JUMP, frame->start);
+            index = -1;
+        }
+        else if (!frame->in_else && (block->else_target != block->merge || (block->merge != -1 && Ir_has_phis(ir, block->merge))))
+        {
+            int else_jump = Bytecode_emit(bytecode, OPCODE_JUMP, 0);
+            Bytecode_patch_jump(bytecode, frame->jump, bytecode->instructions.length);
+            lower_edge(bytecode, ir, slots, index, block->else_target);
+            frame->jump = else_jump;
+            frame->in_else = true;
+            stop = block->merge;
+            index = block->else_target;
+            continue;
+        }
+        else
+        {
+            Bytecode_patch_jump(bytecode, frame->jump, bytecode->instructions.length);
+            index = block->merge;
+        }
+        Vec_Lower_frame_pop(&frames);
+    }
+    Vec_Lower_frame_free(&frames);
+}
+
+// Returns the frame slot of every value, -1 for the values without one.
+int *lower_program(struct Bytecode *bytecode, struct Ir *ir)
+{
+    Ir_count_uses(ir);
+    int *slots = sim_allocate(ir->values.length + 1, sizeof(int));
+    for (int v = 0; v < ir->values.length; v++)
+    {
+        struct Ir_value *value = Ir_get(ir, v);
+        if (value->opcode == IR_OPCODE_PHI || (value->opcode != IR_OPCODE_PRINT && ir->use_counts[v] > 0 && !Ir_is_inlined(ir, v)))
+            slots[v] = bytecode->frame_size++;
+        else
+            slots[v] = -1;
     }
+
+    lower_region(bytecode, ir, slots, 0, -1);
+    Bytecode_emit(bytecode, OPCODE_HALT, 0);
+    return slots;
 }
 
-void simulate_statement(struct Statement *statement, struct Array *identifiers)
+#ifdef SIM_THREADED_DISPATCH
+#define SIM_DISPATCH() goto *dispatch_table[ip->opcode];
+#define SIM_CASE(opcode) label_##opcode:
+#define SIM_NEXT() goto *dispatch_table[ip->opcode]
+#else
+#define SIM_DISPATCH() \
+    for (;;)           \
+        switch (ip->opcode)
+#define SIM_CASE(opcode) case opcode:
+#define SIM_NEXT() continue
+#endif
+
+// With a 'tier', hot loops run as compiled code. Returns the number of allocations made while
+// the instructions ran.
+long simulate_bytecode(struct Bytecode *bytecode, struct Tier *tier)
 {
-    struct Array exp_output;
-    Array_init(&exp_output, sizeof(struct Sim_value));
+    // Values carry no type, the type checker made sure every instruction gets the types it
+    // expects. A bool is 0 or 1.
+    uint64_t *stack = sim_allocate(bytecode->max_stack_size + 1, sizeof(uint64_t));
+    uint64_t *frame = sim_allocate(bytecode->frame_size + 1, sizeof(uint64_t));
+    sim_prepare_output();
+    sim_start_counting();
+
+    struct Instruction *code = bytecode->instructions.data;
+    struct Instruction *ip = code;
+    // 'sp' always points at the next free stack entry.
+    uint64_t *sp = stack;
+
+#ifdef SIM_THREADED_DISPATCH
+    _Static_assert(OPCODE_COUNT == 16, "Exhaustive handling of opcodes");
+    static void *dispatch_table[OPCODE_COUNT] = {
+        [OPCODE_PUSH] = &&label_OPCODE_PUSH,
+        [OPCODE_LOAD] = &&label_OPCODE_LOAD,
+        [OPCODE_STORE] = &&label_OPCODE_STORE,
+        [OPCODE_POP] = &&label_OPCODE_POP,
+        [OPCODE_PLUS] = &&label_OPCODE_PLUS,
+        [OPCODE_MINUS] = &&label_OPCODE_MINUS,
+        [OPCODE_GT] = &&label_OPCODE_GT,
+        [OPCODE_MODULO] = &&label_OPCODE_MODULO,
+        [OPCODE_EQUAL] = &&label_OPCODE_EQUAL,
+        [OPCODE_OR] = &&label_OPCODE_OR,
+        [OPCODE_PRINT] = &&label_OPCODE_PRINT,
+        [OPCODE_JUMP] = &&label_OPCODE_JUMP,
+        [OPCODE_JUMP_IF_ZERO] = &&label_OPCODE_JUMP_IF_ZERO,
+        [OPCODE_JUMP_IF_NOT_ZERO] = &&label_OPCODE_JUMP_IF_NOT_ZERO,
+        [OPCODE_HALT] = &&label_OPCODE_HALT,
+        [OPCODE_LOOP] = &&label_OPCODE_LOOP,
+    };
+#endif
 
-    switch (statement->type)
+    SIM_DISPATCH()
     {
-    case STATEMENT_TYPE_EXP:
-        simulate_expression(statement->expression, &exp_output, identifiers);
-        break;
-    case STATEMENT_TYPE_IF:
-        simulate_expression(statement->iff.condition, &exp_output, identifiers);
-        if (exp_output.length != 1)
+        SIM_CASE(OPCODE_PUSH)
         {
-            struct Operation *op = Array_top(&statement->iff.condition.operations);
-            sim_error(op->loc, "If condition must produce exactly one output.\n");
+            *sp = (uint64_t)(int64_t)ip->operand;
+            sp++;
+            ip++;
+            SIM_NEXT();
         }
-        struct Sim_value *if_result = Array_get(&exp_output, 0);
-        //  TODO: do we have to cast to the correct type to check unequal zero? Maybe for floats or doubles?
-        if (if_result->data != 0)
+        SIM_CASE(OPCODE_LOAD)
         {
-            simulate_statement(statement->iff.action, identifiers);
+            *sp = frame[ip->operand];
+            sp++;
+            ip++;
+            SIM_NEXT();
         }
-        break;
-    case STATEMENT_TYPE_WHILE:
-        while (true)
+        SIM_CASE(OPCODE_STORE)
         {
-            simulate_expression(statement->whilee.condition, &exp_output, identifiers);
-            if (exp_output.length != 1)
-            {
-                struct Operation *op = Array_top(&statement->whilee.condition.operations);
-                sim_error(op->loc, "While condition must produce exactly one output.\n");
-            }
-            struct Sim_value *while_result = Array_get(&exp_output, 0);
-            // TODO: do we have to cast to the correct type to check unequal zero?
-            if (while_result->data == 0)
-                break;
-            simulate_statement(statement->whilee.action, identifiers);
+            sp--;
+            frame[ip->operand] = *sp;
+            ip++;
+            SIM_NEXT();
         }
-        break;
-    case STATEMENT_TYPE_VAR:
-        struct Sim_identifier *prev_id = get_sim_identifier(identifiers, statement->var.identifier.token);
-        if (prev_id != NULL)
-            sim_error(statement->var.identifier.loc, "Variable '%s' was already defined here: %s:%d:%d.\n.",
-                      statement->var.identifier.token,
-                      prev_id->identifier->loc.filename,
-                      prev_id->identifier->loc.line,
-                      prev_id->identifier->loc.collumn);
-
-        // add identifier
-        struct Sim_identifier id;
-        id.identifier = &statement->var.identifier;
-        simulate_expression(statement->var.assignment, &exp_output, identifiers);
-        if (exp_output.length != 1)
+        SIM_CASE(OPCODE_POP)
         {
-            struct Operation *op = Array_top(&statement->var.assignment.operations);
-            sim_error(op->loc, "Variable declaration must produce exactly one output.\n");
+            sp -= ip->operand;
+            ip++;
+            SIM_NEXT();
         }
-        struct Sim_value *var_result = Array_get(&exp_output, 0);
-        id.value = *var_result;
-        Array_add(identifiers, &id);
-        break;
-    case STATEMENT_TYPE_SET:
-        struct Sim_identifier *set_prev_id = get_sim_identifier(identifiers, statement->set.identifier.token);
-        if (set_prev_id == NULL)
-            sim_error(statement->var.identifier.loc, "Undefined variable '%s'.\n", statement->var.identifier.token);
-        // evaluate expression
-        simulate_expression(statement->set.assignment, &exp_output, identifiers);
-        if (exp_output.length != 1)
+        SIM_CASE(OPCODE_PLUS)
         {
-            struct Operation *op = Array_top(&statement->var.assignment.operations);
-            sim_error(op->loc, "Variable declaration must produce exactly one output.\n");
+            sp--;
+            sp[-1] = sp[-1] + *sp;
+            ip++;
+            SIM_NEXT();
         }
-        struct Sim_value *set_result = Array_get(&exp_output, 0);
-        set_prev_id->value = *set_result;
-        break;
-    case STATEMENT_TYPE_BLOCK:
-        int identifiers_stack_length = identifiers->length;
-        for (int i = 0; i < statement->block.statements.length; i++)
+        SIM_CASE(OPCODE_MINUS)
         {
-            struct Statement *block_statement = Array_get(&statement->block.statements, i);
-            simulate_statement(block_statement, identifiers);
+            sp--;
+            sp[-1] = sp[-1] - *sp;
+            ip++;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_GT)
+        {
+            sp--;
+            sp[-1] = sp[-1] > *sp;
+            ip++;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_MODULO)
+        {
+            sp--;
+            sp[-1] = sp[-1] % *sp;
+            ip++;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_EQUAL)
+        {
+            sp--;
+            sp[-1] = sp[-1] == *sp;
+            ip++;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_OR)
+        {
+            sp--;
+            sp[-1] = sp[-1] || *sp;
+            ip++;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_PRINT)
+        {
+            sp--;
+            printf("%d\n", (int32_t)*sp);
+            ip++;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_JUMP)
+        {
+            ip = code + ip->operand;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_JUMP_IF_ZERO)
+        {
+            sp--;
+            if (*sp == 0)
+                ip = code + ip->operand;
+            else
+                ip++;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_JUMP_IF_NOT_ZERO)
+        {
+            sp--;
+            if (*sp != 0)
+                ip = code + ip->operand;
+            else
+                ip++;
+            SIM_NEXT();
+        }
+        SIM_CASE(OPCODE_HALT)
+        {
+            goto halt;
+        }
+        SIM_CASE(OPCODE_LOOP)
+        {
+#ifdef TIER_SUPPORTED
+            if (Tier_run(tier, ip->operand, frame))
+            {
+                int exit = Vec_Bytecode_loop_get(&bytecode->loops, ip->operand)->exit;
+                if (exit == -1)
+                    goto halt;
+                ip = code + exit;
+                SIM_NEXT();
+            }
+#else
+            (void)tier;
+#endif
+            ip++;
+            SIM_NEXT();
         }
-        identifiers->length = identifiers_stack_length;
-        break;
-    default:
-        fprintf(stderr, "SIM_ERROR: Statement type %d not implement yet in 'simulate_statement'.\n", statement->type);
-        exit(1);
     }
-    Array_free(&exp_output);
+halt:;
+    long allocations = sim_stop_counting();
+
+    free(stack);
+    free(frame);
+    return allocations;
 }
 
-void simulate_program(struct Array *program)
+// With 'tiered', loops that run long enough are compiled with the system C compiler. With
+// 'count_allocations', the allocations made while the program ran are reported.
+void simulate_program(struct Ir *ir, bool tiered, bool count_allocations)
 {
-    struct Array identifiers;
-    Array_init(&identifiers, sizeof(struct Sim_identifier));
+    struct Bytecode bytecode;
+    Bytecode_init(&bytecode);
+#ifdef TIER_SUPPORTED
+    bytecode.count_loops = tiered;
+#else
+    (void)tiered;
+#endif
 
-    for (int i = 0; i < program->length; i++)
-    {
-        struct Statement *statement = Array_get(program, i);
-        simulate_statement(statement, &identifiers);
-    }
+    int *slots = lower_program(&bytecode, ir);
+    struct Tier tier;
+    Tier_init(&tier, ir, &bytecode, slots);
+    long allocations = simulate_bytecode(&bytecode, &tier);
+    Tier_free(&tier);
+    if (count_allocations)
+        fprintf(stderr, "Allocations while running: %ld\n", allocations);
 
-    Array_free(&identifiers);
-}
\ No newline at end of file
+    free(slots);
+    Bytecode_free(&bytecode);
+}
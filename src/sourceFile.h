@@ -0,0 +1,158 @@
+#ifndef SOURCE_FILE_H
+#define SOURCE_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct Location
+{
+    char *filename;
+    int collumn;
+    int line;
+};
+
+// The text of a source file. Tokens only store their offset into it, so it has to stay open
+// until the compilation is done. The text is not null terminated.
+struct Source_file
+{
+    char *filename;
+    char *text;
+    size_t length;
+    // Offsets of the first byte of every line. Only built once a location is asked for.
+    uint32_t *line_starts;
+    int line_count;
+};
+
+#ifdef __linux__
+void Source_file_open(struct Source_file *source, char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat file_stat;
+    if (fd == -1 || fstat(fd, &file_stat) == -1)
+    {
+        fprintf(stderr, "ERROR: File '%s' cannot be opened.\n", filename);
+        exit(0);
+    }
+
+    source->filename = filename;
+    source->text = NULL;
+    source->length = file_stat.st_size;
+    source->line_starts = NULL;
+    source->line_count = 0;
+    if (source->length > 0)
+    {
+        source->text = mmap(NULL, source->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (source->text == MAP_FAILED)
+        {
+            fprintf(stderr, "ERROR: File '%s' cannot be mapped.\n", filename);
+            exit(1);
+        }
+        madvise(source->text, source->length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+}
+
+void Source_file_close(struct Source_file *source)
+{
+    if (source->text != NULL)
+        munmap(source->text, source->length);
+    free(source->line_starts);
+}
+#else
+void Source_file_open(struct Source_file *source, char *filename)
+{
+    FILE *input;
+    if (fopen_s(&input, filename, "rb"))
+    {
+        fprintf(stderr, "ERROR: File '%s' cannot be opened.\n", filename);
+        exit(0);
+    }
+
+    fseek(input, 0, SEEK_END);
+    long file_size = ftell(input);
+    rewind(input);
+
+    source->filename = filename;
+    source->text = malloc(file_size + 1);
+    source->length = fread(source->text, 1, file_size, input);
+    source->line_starts = NULL;
+    source->line_count = 0;
+    fclose(input);
+}
+
+void Source_file_close(struct Source_file *source)
+{
+    free(source->text);
+    free(source->line_starts);
+}
+#endif
+
+void Source_file_build_lines(struct Source_file *source)
+{
+    int capacity = 64;
+    source->line_starts = malloc(sizeof(uint32_t) * capacity);
+    if (source->line_starts == NULL)
+    {
+        fprintf(stderr, "ERROR: Line table allocation error.\n");
+        exit(1);
+    }
+    source->line_starts[0] = 0;
+    source->line_count = 1;
+
+    char *end = source->text + source->length;
+    for (char *newline = source->text; newline < end; newline++)
+    {
+        newline = memchr(newline, '\n', end - newline);
+        if (newline == NULL)
+            break;
+        if (source->line_count == capacity)
+        {
+            capacity *= 2;
+            uint32_t *line_starts = realloc(source->line_starts, sizeof(uint32_t) * capacity);
+            if (line_starts == NULL)
+            {
+                fprintf(stderr, "ERROR: Line table allocation error.\n");
+                exit(1);
+            }
+            source->line_starts = line_starts;
+        }
+        source->line_starts[source->line_count++] = (uint32_t)(newline - source->text + 1);
+    }
+}
+
+// Works out the line and column of a byte offset. This is only needed to report errors, so
+// the line table is built on the first call and then searched.
+struct Location Source_file_location(struct Source_file *source, uint32_t offset)
+{
+    if (source->line_starts == NULL)
+        Source_file_build_lines(source);
+
+    int low = 0;
+    int high = source->line_count - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (source->line_starts[middle] <= offset)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    struct Location location = {
+        .filename = source->filename,
+        .line = low + 1,
+        .collumn = (int)(offset - source->line_starts[low]) + 1,
+    };
+    return location;
+}
+
+#endif
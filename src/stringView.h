@@ -0,0 +1,22 @@
+#ifndef STRING_VIEW_H
+#define STRING_VIEW_H
+
+#include <stdbool.h>
+#include <string.h>
+
+// A non owning, not null terminated piece of a string.
+// Print it with "%.*s" and 'String_view_arg'.
+struct String_view
+{
+    char *data;
+    int length;
+};
+
+#define String_view_arg(view) (view).length, (view).data
+
+bool String_view_equals(struct String_view view, char *text)
+{
+    return strncmp(view.data, text, view.length) == 0 && text[view.length] == 0;
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include "array.h"
+#include "operation.h"
+#include "typeInfo.h"
+
+struct Symbol
+{
+    struct Operation op;
+    enum Type_info type_info;
+    int slot;
+    // Index of the next symbol in the same bucket or -1.
+    int next;
+};
+
+Vec_declare(Symbol, struct Symbol);
+Vec_define(Symbol, struct Symbol)
+
+// A hash map of the symbols that are currently in scope, keyed by their interned name.
+// Symbols are kept on a stack in declaration order and each bucket chains them newest first.
+// Because scopes are closed in the reverse order they are opened, the symbol that is removed
+// when a scope ends is always the head of its bucket.
+struct Symbol_table
+{
+    Vec(Symbol) symbols;
+    int *buckets;
+    int bucket_count;
+};
+
+// Interned names are handed out sequentially, so they already spread evenly over the buckets.
+int Symbol_bucket(struct Symbol_table *table, int name)
+{
+    return name & (table->bucket_count - 1);
+}
+
+void Symbol_table_rehash(struct Symbol_table *table, int bucket_count)
+{
+    int *buckets = malloc(sizeof(int) * bucket_count);
+    if (buckets == NULL)
+    {
+        fprintf(stderr, "ERROR: Symbol table allocation error.\n");
+        exit(1);
+    }
+    for (int i = 0; i < bucket_count; i++)
+        buckets[i] = -1;
+
+    for (int i = 0; i < table->symbols.length; i++)
+    {
+        struct Symbol *symbol = Vec_Symbol_get(&table->symbols, i);
+        int bucket = symbol->op.identifier.name & (bucket_count - 1);
+        symbol->next = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    free(table->buckets);
+    table->buckets = buckets;
+    table->bucket_count = bucket_count;
+}
+
+void Symbol_table_init(struct Symbol_table *table)
+{
+    Vec_Symbol_init(&table->symbols);
+    table->buckets = NULL;
+    Symbol_table_rehash(table, 64);
+}
+
+void Symbol_table_free(struct Symbol_table *table)
+{
+    Vec_Symbol_free(&table->symbols);
+    free(table->buckets);
+}
+
+struct Symbol *Symbol_table_get(struct Symbol_table *table, int name)
+{
+    int index = table->buckets[Symbol_bucket(table, name)];
+    while (index != -1)
+    {
+        struct Symbol *symbol = Vec_Symbol_get(&table->symbols, index);
+        if (symbol->op.identifier.name == name)
+            return symbol;
+        index = symbol->next;
+    }
+    return NULL;
+}
+
+// Declares a symbol in the innermost scope. Its slot is the number of symbols in scope.
+// The returned pointer is only valid until the next symbol is added.
+struct Symbol *Symbol_table_add(struct Symbol_table *table, struct Operation *op, enum Type_info type_info)
+{
+    if ((table->symbols.length + 1) * 4 > table->bucket_count * 3)
+        Symbol_table_rehash(table, table->bucket_count * 2);
+
+    struct Symbol symbol = {
+        .op = *op,
+        .type_info = type_info,
+        .slot = table->symbols.length,
+    };
+    int bucket = Symbol_bucket(table, op->identifier.name);
+    symbol.next = table->buckets[bucket];
+    table->buckets[bucket] = table->symbols.length;
+    Vec_Symbol_add(&table->symbols, symbol);
+    return Vec_Symbol_top(&table->symbols);
+}
+
+int Symbol_table_scope_begin(struct Symbol_table *table)
+{
+    return table->symbols.length;
+}
+
+// Removes every symbol that was declared since the matching 'Symbol_table_scope_begin'.
+void Symbol_table_scope_end(struct Symbol_table *table, int scope)
+{
+    while (table->symbols.length > scope)
+    {
+        struct Symbol symbol = Vec_Symbol_pop(&table->symbols);
+        int bucket = Symbol_bucket(table, symbol.op.identifier.name);
+        assert(table->buckets[bucket] == table->symbols.length && "symbol table scopes must be closed in order");
+        table->buckets[bucket] = symbol.next;
+    }
+}
+
+#endif
@@ -0,0 +1,400 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "cfg.h"
+#include "compilation.h"
+#include "ir.h"
+
+// Tiered execution. The simulator counts the iterations of every loop. Once a loop is hot, it
+// hands the loop to the worker of the tier, a thread that is started before the program runs.
+// The worker writes the loop with the C backend as a function over the frame of the simulator
+// and the system C compiler turns that into a shared library. The simulator calls the function
+// at the next iteration it starts after the library was loaded. The function runs the loop
+// to its end, writes the values back into the frame and the simulator carries on after the
+// loop. Where there is no C compiler the loop keeps being simulated.
+#if !defined(_WIN32)
+#define TIER_SUPPORTED
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+#include <threads.h>
+#include <unistd.h>
+#endif
+
+// A loop is hot after this many iterations, which takes the simulator a few milliseconds.
+#define TIER_THRESHOLD 100000
+
+// A region of blocks that still has to be marked, from 'index' on until control reaches 'stop'.
+struct Tier_region
+{
+    int index;
+    int stop;
+};
+
+Vec_declare(Tier_region, struct Tier_region);
+Vec_define(Tier_region, struct Tier_region)
+
+struct Tier
+{
+    struct Ir *ir;
+    struct Bytecode *bytecode;
+    // The frame slot of every value, -1 for the values without one.
+    int *slots;
+    // One for every loop in 'bytecode->loops'.
+    struct Tier_loop *loops;
+    // NULL when there are no loops to compile.
+    struct Tier_worker *worker;
+    // Scratch space of the worker for writing a loop, one entry for every block and every value.
+    bool *in_loop;
+    bool *declared;
+    Vec(Tier_region) regions;
+};
+
+#ifdef TIER_SUPPORTED
+
+enum Tier_state
+{
+    TIER_STATE_COLD,
+    // Handed to the worker.
+    TIER_STATE_COMPILING,
+    TIER_STATE_READY,
+    TIER_STATE_FAILED,
+};
+
+struct Tier_loop
+{
+    long count;
+    // The worker sets 'function' before it makes the loop ready.
+    _Atomic int state;
+    void (*function)(void *frame);
+    void *library;
+};
+
+// Everything the simulator does with a hot loop is to queue it, so the simulator allocates
+// nothing and does not wait while the loop is written and compiled.
+struct Tier_worker
+{
+    thrd_t thread;
+    mtx_t mutex;
+    // Signaled when a loop is queued and when the program ended.
+    cnd_t wake;
+    // The hot loops in the order they got hot, 'queue_start' is the next one to compile. A loop
+    // is queued at most once. Both guarded by 'mutex'.
+    int *queue;
+    int queue_start;
+    int queue_length;
+    // Set when the program ended. The compiler is killed then, nothing would use its result.
+    _Atomic bool quit;
+    // The process group of the running compiler, 0 while none runs.
+    _Atomic int compiler;
+    // A directory only this user can write to, so no one else can put a file or a link where
+    // the source or the library is expected.
+    char directory[32];
+    char source_path[64];
+    char library_path[64];
+};
+
+// Marks the blocks from 'index' on until control reaches 'stop', following the structure the
+// control flow graph was built with. The regions nested in loops and branches wait in
+// 'tier->regions'.
+void tier_mark_region(struct Tier *tier, bool *in_loop, int index, int stop)
+{
+    struct Ir *ir = tier->ir;
+    tier->regions.length = 0;
+    Vec_Tier_region_add(&tier->regions, (struct Tier_region){.index = index, .stop = stop});
+    while (tier->regions.length > 0)
+    {
+        struct Tier_region region = Vec_Tier_region_pop(&tier->regions);
+        index = region.index;
+        while (index != region.stop && index != -1)
+        {
+            struct Block *block = Cfg_block(ir->cfg, index);
+            in_loop[index] = true;
+            if (block->is_loop_header)
+            {
+                Vec_Tier_region_add(&tier->regions, (struct Tier_region){.index = block->target, .stop = index});
+                if (block->terminator != TERMINATOR_BRANCH)
+                    break;
+                index = block->merge;
+            }
+            else if (block->terminator == TERMINATOR_JUMP)
+                index = block->target;
+            else if (block->terminator == TERMINATOR_BRANCH)
+            {
+                Vec_Tier_region_add(&tier->regions, (struct Tier_region){.index = block->target, .stop = block->merge});
+                Vec_Tier_region_add(&tier->regions, (struct Tier_region){.index = block->else_target, .stop = block->merge});
+                index = block->merge;
+            }
+            else
+                break;
+        }
+    }
+}
+
+void tier_declare(FILE *output, struct Tier *tier, bool *declared, int v)
+{
+    if (declared[v] || tier->slots[v] == -1)
+        return;
+    declared[v] = true;
+    struct Ir_value *value = Ir_get(tier->ir, v);
+    fprintf(output, "    %s v%d = frame[%d];\n", compile_type(value->type), v, tier->slots[v]);
+}
+
+// Writes the loop 'index' as the function 'betsy_loop'. The function reads the phis, the values
+// that are assigned instead of declared and the values from outside of the loop from the frame,
+// and writes them back when the loop ends.
+void tier_write_loop(FILE *output, struct Tier *tier, int index)
+{
+    struct Ir *ir = tier->ir;
+    struct Bytecode_loop *loop = Vec_Bytecode_loop_get(&tier->bytecode->loops, index);
+    struct Block *header = Cfg_block(ir->cfg, loop->header);
+    bool *in_loop = tier->in_loop;
+    bool *declared = tier->declared;
+    memset(in_loop, 0, sizeof(bool) * ir->cfg->blocks.length);
+    memset(declared, 0, sizeof(bool) * ir->values.length);
+    in_loop[loop->header] = true;
+    tier_mark_region(tier, in_loop, header->target, loop->header);
+
+    fprintf(output, "#include <stdbool.h>\n");
+    fprintf(output, "#include <stdio.h>\n");
+    fprintf(output, "#include <stdint.h>\n");
+    fprintf(output, "\n");
+    fprintf(output, "void betsy_loop(uint64_t *frame)\n");
+    fprintf(output, "{\n");
+    for (int b = 0; b < ir->cfg->blocks.length; b++)
+    {
+        if (!in_loop[b])
+            continue;
+        bool in_header = Cfg_block(ir->cfg, b)->is_loop_header && !compile_is_for_loop(ir, b);
+        if (ir->blocks[b].condition != -1 && !in_loop[Ir_get(ir, ir->blocks[b].condition)->block])
+            tier_declare(output, tier, declared, ir->blocks[b].condition);
+        for (int v = ir->blocks[b].first; v != -1; v = Ir_get(ir, v)->next)
+        {
+            struct Ir_value *value = Ir_get(ir, v);
+            if (value->opcode == IR_OPCODE_PHI || (in_header && Ir_is_binary(value->opcode) && ir->use_counts[v] > 0))
+                tier_declare(output, tier, declared, v);
+            Ir_for_each_operand(ir, value, operand, {
+                if (!in_loop[Ir_get(ir, *operand)->block])
+                    tier_declare(output, tier, declared, *operand);
+            });
+        }
+    }
+    int stop = header->terminator == TERMINATOR_BRANCH ? header->merge : -1;
+    for (int phi = stop == -1 ? -1 : ir->blocks[stop].first; phi != -1 && Ir_get(ir, phi)->opcode == IR_OPCODE_PHI; phi = Ir_get(ir, phi)->next)
+        tier_declare(output, tier, declared, phi);
+
+    compile_region(output, 1, ir, loop->header, stop);
+
+    for (int v = 0; v < ir->values.length; v++)
+    {
+        if (declared[v])
+            fprintf(output, "    frame[%d] = v%d;\n", tier->slots[v], v);
+    }
+    fprintf(output, "}\n");
+}
+
+// Runs the compiler on the source of a loop and waits for it. The compiler gets a process group
+// of its own, so killing the group also ends the programs the compiler runs. Returns whether it
+// succeeded.
+bool tier_run_compiler(struct Tier_worker *worker)
+{
+    char command[256];
+    const char *compiler = getenv("CC");
+    snprintf(command, sizeof(command), "%s -O2 -w -shared -fPIC -o %s %s >/dev/null 2>&1",
+             compiler != NULL ? compiler : "cc", worker->library_path, worker->source_path);
+    char *arguments[] = {"sh", "-c", command, NULL};
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attributes, 0);
+    pid_t pid;
+    int status = -1;
+    if (posix_spawn(&pid, "/bin/sh", NULL, &attributes, arguments, environ) == 0)
+    {
+        atomic_store(&worker->compiler, (int)pid);
+        // Tier_free might have looked for the compiler before it was there.
+        if (atomic_load(&worker->quit))
+            kill(-pid, SIGKILL);
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+            ;
+        atomic_store(&worker->compiler, 0);
+    }
+    posix_spawnattr_destroy(&attributes);
+    return status == 0 && !atomic_load(&worker->quit);
+}
+
+// Writes, compiles and loads the loop 'index'.
+void tier_compile(struct Tier *tier, int index)
+{
+    struct Tier_worker *worker = tier->worker;
+    struct Tier_loop *loop = &tier->loops[index];
+    snprintf(worker->directory, sizeof(worker->directory), "/tmp/betsy-XXXXXX");
+    if (mkdtemp(worker->directory) == NULL)
+    {
+        atomic_store(&loop->state, TIER_STATE_FAILED);
+        return;
+    }
+    snprintf(worker->source_path, sizeof(worker->source_path), "%s/loop.c", worker->directory);
+    snprintf(worker->library_path, sizeof(worker->library_path), "%s/loop.so", worker->directory);
+    FILE *output = fopen(worker->source_path, "w");
+    if (output != NULL)
+    {
+        tier_write_loop(output, tier, index);
+        bool written = fclose(output) == 0;
+        if (written && tier_run_compiler(worker))
+            loop->library = dlopen(worker->library_path, RTLD_NOW | RTLD_LOCAL);
+        if (loop->library != NULL)
+            loop->function = (void (*)(void *))dlsym(loop->library, "betsy_loop");
+    }
+    remove(worker->source_path);
+    remove(worker->library_path);
+    rmdir(worker->directory);
+    atomic_store(&loop->state, loop->function != NULL ? TIER_STATE_READY : TIER_STATE_FAILED);
+}
+
+int tier_worker_run(void *argument)
+{
+    struct Tier *tier = argument;
+    struct Tier_worker *worker = tier->worker;
+    mtx_lock(&worker->mutex);
+    while (!atomic_load(&worker->quit))
+    {
+        if (worker->queue_start == worker->queue_length)
+        {
+            cnd_wait(&worker->wake, &worker->mutex);
+            continue;
+        }
+        int index = worker->queue[worker->queue_start++];
+        mtx_unlock(&worker->mutex);
+        tier_compile(tier, index);
+        mtx_lock(&worker->mutex);
+    }
+    mtx_unlock(&worker->mutex);
+    return 0;
+}
+
+// Hands the loop 'index' to the worker.
+void tier_start(struct Tier *tier, int index)
+{
+    struct Tier_worker *worker = tier->worker;
+    atomic_store(&tier->loops[index].state, TIER_STATE_COMPILING);
+    mtx_lock(&worker->mutex);
+    worker->queue[worker->queue_length++] = index;
+    cnd_signal(&worker->wake);
+    mtx_unlock(&worker->mutex);
+}
+
+// Counts an iteration of loop 'index'. Returns true when the compiled loop ran in its place,
+// the simulator carries on after the loop then.
+bool Tier_run(struct Tier *tier, int index, void *frame)
+{
+    struct Tier_loop *loop = &tier->loops[index];
+    if (++loop->count < TIER_THRESHOLD)
+        return false;
+    if (loop->count == TIER_THRESHOLD && tier->worker != NULL)
+        tier_start(tier, index);
+    if (atomic_load(&loop->state) != TIER_STATE_READY)
+        return false;
+    loop->function(frame);
+    return true;
+}
+
+#endif
+
+void tier_allocation_error(void)
+{
+    fprintf(stderr, "ERROR: Allocation error in %s:%d\n", __FILE__, __LINE__);
+    exit(1);
+}
+
+void Tier_init(struct Tier *tier, struct Ir *ir, struct Bytecode *bytecode, int *slots)
+{
+    tier->ir = ir;
+    tier->bytecode = bytecode;
+    tier->slots = slots;
+    tier->loops = NULL;
+    tier->worker = NULL;
+    tier->in_loop = NULL;
+    tier->declared = NULL;
+#ifdef TIER_SUPPORTED
+    if (bytecode->loops.length == 0)
+        return;
+    tier->loops = calloc(bytecode->loops.length, sizeof(struct Tier_loop));
+    tier->in_loop = calloc(ir->cfg->blocks.length + 1, sizeof(bool));
+    tier->declared = calloc(ir->values.length + 1, sizeof(bool));
+    Vec_Tier_region_init(&tier->regions);
+    if (tier->loops == NULL || tier->in_loop == NULL || tier->declared == NULL)
+        tier_allocation_error();
+    for (int i = 0; i < bytecode->loops.length; i++)
+        atomic_init(&tier->loops[i].state, TIER_STATE_COLD);
+    // The C backend needs them to write loops.
+    Ir_find_counted_loops(ir);
+
+    struct Tier_worker *worker = calloc(1, sizeof(struct Tier_worker));
+    if (worker == NULL || (worker->queue = calloc(bytecode->loops.length, sizeof(int))) == NULL)
+        tier_allocation_error();
+    atomic_init(&worker->quit, false);
+    atomic_init(&worker->compiler, 0);
+    if (mtx_init(&worker->mutex, mtx_plain) != thrd_success)
+        tier_allocation_error();
+    if (cnd_init(&worker->wake) != thrd_success)
+        tier_allocation_error();
+    tier->worker = worker;
+    if (thrd_create(&worker->thread, tier_worker_run, tier) != thrd_success)
+    {
+        // Without a worker every loop stays in the simulator.
+        for (int i = 0; i < bytecode->loops.length; i++)
+            atomic_store(&tier->loops[i].state, TIER_STATE_FAILED);
+        mtx_destroy(&worker->mutex);
+        cnd_destroy(&worker->wake);
+        free(worker->queue);
+        free(worker);
+        tier->worker = NULL;
+    }
+#endif
+}
+
+// Stops the worker. A compiler that still runs is killed, a program that ended does not need
+// it and should not wait for it.
+void Tier_free(struct Tier *tier)
+{
+#ifdef TIER_SUPPORTED
+    struct Tier_worker *worker = tier->worker;
+    if (worker != NULL)
+    {
+        mtx_lock(&worker->mutex);
+        atomic_store(&worker->quit, true);
+        cnd_signal(&worker->wake);
+        mtx_unlock(&worker->mutex);
+        int compiler = atomic_load(&worker->compiler);
+        if (compiler != 0)
+            kill(-compiler, SIGKILL);
+        thrd_join(worker->thread, NULL);
+        mtx_destroy(&worker->mutex);
+        cnd_destroy(&worker->wake);
+        free(worker->queue);
+        free(worker);
+    }
+    for (int i = 0; i < tier->bytecode->loops.length; i++)
+    {
+        if (tier->loops[i].library != NULL)
+            dlclose(tier->loops[i].library);
+    }
+    if (tier->loops != NULL)
+        Vec_Tier_region_free(&tier->regions);
+#endif
+    free(tier->loops);
+    free(tier->in_loop);
+    free(tier->declared);
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef TOKEN_STREAM_H
+#define TOKEN_STREAM_H
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "operation.h"
+#include "sourceFile.h"
+#include "stringView.h"
+
+// The words of a source file as parallel arrays, 9 bytes per token. The payload is the
+// intrinsic or keyword type, the value of a literal or the interned name of an identifier.
+// Locations and spellings are not stored, they are recovered from the offset on demand.
+struct Token_stream
+{
+    struct Source_file *source;
+    uint8_t *kinds;
+    int32_t *payloads;
+    uint32_t *offsets;
+    int length;
+    int capacity;
+};
+
+void Token_stream_init(struct Token_stream *tokens, struct Source_file *source)
+{
+    tokens->source = source;
+    tokens->kinds = NULL;
+    tokens->payloads = NULL;
+    tokens->offsets = NULL;
+    tokens->length = 0;
+    tokens->capacity = 0;
+}
+
+void Token_stream_free(struct Token_stream *tokens)
+{
+    free(tokens->kinds);
+    free(tokens->payloads);
+    free(tokens->offsets);
+}
+
+void Token_stream_reserve(struct Token_stream *tokens, int capacity)
+{
+    uint8_t *kinds = realloc(tokens->kinds, sizeof(uint8_t) * capacity);
+    int32_t *payloads = realloc(tokens->payloads, sizeof(int32_t) * capacity);
+    uint32_t *offsets = realloc(tokens->offsets, sizeof(uint32_t) * capacity);
+    if (kinds == NULL || payloads == NULL || offsets == NULL)
+    {
+        fprintf(stderr, "ERROR: Token stream allocation error.\n");
+        exit(1);
+    }
+    tokens->kinds = kinds;
+    tokens->payloads = payloads;
+    tokens->offsets = offsets;
+    tokens->capacity = capacity;
+}
+
+void Token_stream_grow(struct Token_stream *tokens)
+{
+    Token_stream_reserve(tokens, tokens->capacity == 0 ? 1024 : tokens->capacity * 2);
+}
+
+void Token_stream_add(struct Token_stream *tokens, const struct Operation *op)
+{
+    if (tokens->length == tokens->capacity)
+        Token_stream_grow(tokens);
+
+    int32_t payload;
+    _Static_assert(OPERATION_TYPE_COUNT == 4, "Exhaustive handling of operation types");
+    switch (op->type)
+    {
+    case OPERATION_TYPE_KEYWORD:
+        payload = op->keyword.type;
+        break;
+    case OPERATION_TYPE_INTRINSIC:
+        payload = op->intrinsic.type;
+        break;
+    case OPERATION_TYPE_VALUE:
+        payload = op->literal.value;
+        break;
+    case OPERATION_TYPE_IDENTIFIER:
+        payload = op->identifier.name;
+        break;
+    default:
+        fprintf(stderr, "ERROR: Operation type '%d' cannot be stored in a token stream.\n", op->type);
+        exit(1);
+    }
+
+    tokens->kinds[tokens->length] = (uint8_t)op->type;
+    tokens->payloads[tokens->length] = payload;
+    tokens->offsets[tokens->length] = op->offset;
+    tokens->length++;
+}
+
+struct Operation Token_stream_get(struct Token_stream *tokens, int index)
+{
+    if (index >= tokens->length)
+    {
+        fprintf(stderr, "ERROR: Token index out of range. Index: %d, Range: %d\n", index, tokens->length - 1);
+        exit(1);
+    }
+
+    struct Operation op = {
+        .offset = tokens->offsets[index],
+        .type = tokens->kinds[index],
+    };
+    int32_t payload = tokens->payloads[index];
+    switch (op.type)
+    {
+    case OPERATION_TYPE_KEYWORD:
+        op.keyword.type = payload;
+        break;
+    case OPERATION_TYPE_INTRINSIC:
+        op.intrinsic.type = payload;
+        break;
+    case OPERATION_TYPE_VALUE:
+        op.literal.value = payload;
+        op.literal.typeInfo = TYPE_INFO_INT;
+        break;
+    case OPERATION_TYPE_IDENTIFIER:
+        op.identifier.name = payload;
+        op.identifier.slot = -1;
+        break;
+    default:
+        break;
+    }
+    return op;
+}
+
+struct Location Token_location(struct Source_file *source, struct Operation *op)
+{
+    return Source_file_location(source, op->offset);
+}
+
+// The spelling of an operation is the word that starts at its offset.
+struct String_view Token_spelling(struct Source_file *source, struct Operation *op)
+{
+    uint32_t end = op->offset;
+    while (end < source->length && isgraph((unsigned char)source->text[end]))
+        end++;
+
+    struct String_view spelling = {
+        .data = source->text + op->offset,
+        .length = (int)(end - op->offset),
+    };
+    return spelling;
+}
+
+#endif
@@ -3,6 +3,8 @@
 #include <assert.h>
 #include <string.h>
 
+#include "stringView.h"
+
 enum Type_info
 {
     TYPE_INFO_INT,
@@ -25,12 +27,12 @@ char *Type_info_name(enum Type_info type)
     }
 }
 
-enum Type_info Type_info_by_name(char *word)
+enum Type_info Type_info_by_name(struct String_view word)
 {
     _Static_assert(TYPE_INFO_COUNT == 2, "Exhaustive handling of all types.");
-    if (strcmp(word, "int") == 0)
+    if (String_view_equals(word, "int"))
         return TYPE_INFO_INT;
-    else if (strcmp(word, "bool") == 0)
+    else if (String_view_equals(word, "bool"))
         return TYPE_INFO_BOOL;
     else
         return -1;
@@ -1,6 +1,9 @@
 import subprocess
 import sys
 import os
+import platform
+import struct
+import time
 
 betsyPath = "betsy.exe"
 targetDir = "./"
@@ -49,17 +52,17 @@ def simulateTest(root, file):
         testResult(resultDir + name + ".stderr", stderr)
 
 def compileTest(root, file):
-    # Run compiler
-    proc = subprocess.Popen([betsyPath, "com", root + "/" + file], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    # Build the program, betsy runs the C compiler itself. The programs in 'partial_eval' are
+    # partly run while they are compiled, the steps run out in the middle of most of them.
+    command = [betsyPath, "build", root + "/" + file, "--output", "out.exe"]
+    if os.path.basename(root) == "partial_eval":
+        command += ["--partial-eval", "100"]
+    proc = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
     stdout, stderr = proc.communicate()
 
     stdout = stdout + b"\r\nProgram output:\r\n"
     stderr = stderr + b"\r\nProgram output:\r\n"
 
-    # Compile program
-    proc_cl = subprocess.Popen(["cl", "out.c"], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-    proc_cl.communicate()
-
     if os.path.exists("out.exe"):
         # Run program
         proc_p = subprocess.Popen(["out"], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
@@ -67,6 +70,9 @@ def compileTest(root, file):
 
         stdout = stdout + stdout_p
         stderr = stderr + stderr_p
+        # A modulo by zero traps, what the program printed so far is lost with it
+        if proc_p.returncode != 0:
+            stderr = stderr + b"\r\nProgram failed\r\n"
 
     resultDir = root + "/results_com/"
     if recordResults:
@@ -79,6 +85,200 @@ def compileTest(root, file):
         testResult(resultDir + name + ".stdout", stdout)
         testResult(resultDir + name + ".stderr", stderr)
 
+def partialEvalTest(root, file):
+    # The C code shows what the evaluation printed and where the compiled program resumes
+    proc = subprocess.Popen([betsyPath, "com", root + "/" + file, "--partial-eval", "100"], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    proc.communicate()
+    code = b""
+    if os.path.exists("out.c"):
+        with open("out.c", "rb") as infile:
+            code = infile.read()
+        os.remove("out.c")
+
+    resultDir = root + "/results_eval/"
+    if recordResults:
+        recordResult(resultDir + name + ".c", code)
+    elif updateResults:
+        updateResult(resultDir + name + ".c", code)
+    else:
+        testResult(resultDir + name + ".c", code)
+
+def nativeTest(root, file):
+    # 'betsy native' writes x86-64 Linux executables itself, they print what the simulator prints
+    proc = subprocess.Popen([betsyPath, "native", root + "/" + file, "--output", "out_native"], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    proc.communicate()
+    stdout = b""
+    stderr = b""
+    if os.path.exists("out_native"):
+        proc_p = subprocess.Popen(["./out_native"], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        stdout, stderr = proc_p.communicate()
+        os.remove("out_native")
+
+    resultDir = root + "/results_sim/"
+    testResult(resultDir + name + ".stdout", stdout)
+    testResult(resultDir + name + ".stderr", stderr)
+
+def jitTest(root, file):
+    global testsFailed
+    # The JIT runs the code of 'betsy native' in the simulator process and names it for 'perf'
+    proc = subprocess.Popen([betsyPath, "sim", root + "/" + file, "--jit"], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    stdout, stderr = proc.communicate()
+
+    resultDir = root + "/results_sim/"
+    testResult(resultDir + name + ".stdout", stdout)
+    testResult(resultDir + name + ".stderr", stderr)
+
+    perfMap = f"/tmp/perf-{proc.pid}.map"
+    if os.path.exists(perfMap):
+        with open(perfMap, "rb") as infile:
+            content = infile.read()
+        os.remove(perfMap)
+        if b" betsy_program\n" in content:
+            return
+    testsFailed = testsFailed + 1
+    print("[FAILED] " + perfMap + " names no betsy_program")
+
+def processExited(pid):
+    # A process that was killed is gone once it was reaped
+    try:
+        with open(f"/proc/{pid}/stat", "rb") as infile:
+            return infile.read().split(b") ")[-1].startswith(b"Z")
+    except FileNotFoundError:
+        return True
+
+def tierTest(root, file):
+    global testsFailed, tierCompilersStarted
+    # The loops in these programs get hot and the tier starts the compiler in CC, which here
+    # never finishes. The program must still end with the right output, without waiting for
+    # the compiler, and take the compiler with it.
+    marker = os.path.abspath("tier_compiler.pid")
+    script = os.path.abspath("tier_compiler.sh")
+    with open(script, "w") as outfile:
+        outfile.write(f"echo $$ > {marker}\nexec sleep 1000\n")
+    if os.path.exists(marker):
+        os.remove(marker)
+    env = dict(os.environ)
+    env["CC"] = "sh " + script
+    proc = subprocess.Popen([betsyPath, "sim", root + "/" + file], stdout=subprocess.PIPE, stderr=subprocess.PIPE, env=env)
+    try:
+        stdout, stderr = proc.communicate(timeout=60)
+        ended = True
+    except subprocess.TimeoutExpired:
+        ended = False
+
+    compiler = None
+    if os.path.exists(marker):
+        tierCompilersStarted = tierCompilersStarted + 1
+        with open(marker, "rb") as infile:
+            compiler = int(infile.read())
+        os.remove(marker)
+    os.remove(script)
+    if not ended:
+        # The shell that runs the compiler holds on to the output of the program
+        proc.kill()
+        if compiler is not None:
+            os.killpg(os.getpgid(compiler), 9)
+        stdout, stderr = proc.communicate()
+    killed = compiler is None
+    for _ in range(100):
+        if killed:
+            break
+        killed = processExited(compiler)
+        time.sleep(0.05)
+
+    with open(root + "/results_sim/" + name + ".stdout", "rb") as infile:
+        expected = infile.read()
+    if not ended or stdout != expected or not killed:
+        testsFailed = testsFailed + 1
+        print("[FAILED] " + root + "/" + file)
+        if not ended:
+            print("The program waited for the compiler.")
+        if not killed:
+            print(f"The compiler {compiler} still runs.")
+        print(stdout.decode("latin-1"))
+        print(stderr.decode("latin-1"))
+        if not killed:
+            os.killpg(os.getpgid(compiler), 9)
+
+def buildAllocationCounter():
+    # test/count_allocations.c counts the allocations of the C library as well, it needs a
+    # system that preloads shared libraries.
+    if not sys.platform.startswith("linux"):
+        return None
+    source = os.path.join(os.path.dirname(os.path.abspath(__file__)), "test", "count_allocations.c")
+    library = os.path.abspath("count_allocations.so")
+    proc = subprocess.run(["cc", "-std=c11", "-O2", "-shared", "-fPIC", "-o", library, source, "-ldl"], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return library if proc.returncode == 0 else None
+
+def allocationTest(root, file):
+    global testsFailed
+    # Hot loops are written and compiled on a thread of their own, the thread that runs the
+    # program allocates nothing.
+    env = dict(os.environ)
+    if allocationCounter is not None:
+        env["LD_PRELOAD"] = allocationCounter
+    proc = subprocess.Popen([betsyPath, "sim", root + "/" + file, "--count-allocations"], stdout=subprocess.PIPE, stderr=subprocess.PIPE, env=env)
+    stdout, stderr = proc.communicate()
+    lines = stderr.splitlines()
+    passed = b"Allocations while running: 0" in lines
+    if allocationCounter is not None:
+        passed = passed and b"Allocations of the running thread: 0" in lines
+    if not passed:
+        testsFailed = testsFailed + 1
+        print("[FAILED] " + root + "/" + file)
+        print(stderr.decode("latin-1"))
+
+def deepTest(name, source, output, error):
+    global testsFailed
+    # Nesting is only limited by --max-depth, not by the stack of the machine
+    path = name + ".betsy"
+    with open(path, "w") as outfile:
+        outfile.write(source)
+    proc = subprocess.Popen([betsyPath, "sim", path], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    stdout, stderr = proc.communicate()
+    limited = subprocess.Popen([betsyPath, "sim", path, "--max-depth", "100"], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    _, limitedStderr = limited.communicate()
+    os.remove(path)
+
+    passed = proc.returncode == 0 and stdout.splitlines() == output
+    passed = passed and limited.returncode == 1 and (error + b" nested deeper than 100 levels.") in limitedStderr
+    if not passed:
+        testsFailed = testsFailed + 1
+        print("[FAILED] deep " + name)
+        print(stdout.decode("latin-1")[:200])
+        print(stderr.decode("latin-1"))
+        print(limitedStderr.decode("latin-1"))
+
+# The opcodes of src/bytecode.h
+OPCODE_PUSH = 0
+OPCODE_STORE = 2
+OPCODE_PRINT = 10
+OPCODE_JUMP = 11
+OPCODE_HALT = 14
+
+def imageTest(name, instructions, frameSize, maxStackSize, damaged, output=[]):
+    global testsFailed
+    # struct Image_header of src/image.h, followed by every struct Instruction of src/bytecode.h
+    data = struct.pack("=8s6I", b"BETSYIMG", 1, 0x01020304, 8, len(instructions), frameSize, maxStackSize)
+    for opcode, operand in instructions:
+        data += struct.pack("=Bxxxi", opcode, operand)
+    path = name + ".img"
+    with open(path, "wb") as outfile:
+        outfile.write(data)
+    proc = subprocess.Popen([betsyPath, "run", path], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    stdout, stderr = proc.communicate()
+    os.remove(path)
+
+    if damaged:
+        passed = proc.returncode == 1 and b"The image is damaged" in stderr
+    else:
+        passed = proc.returncode == 0 and stdout.splitlines() == output
+    if not passed:
+        testsFailed = testsFailed + 1
+        print("[FAILED] image " + name)
+        print(stdout.decode("latin-1"))
+        print(stderr.decode("latin-1"))
+
 if len(sys.argv) != 3:
     print("Usage: test.py <record|update> <directory to test>")
     exit()
@@ -94,6 +294,13 @@ else:
     exit()
 
 targetDir = sys.argv[2]
+# 'betsy native' and 'betsy sim --jit' only write x86-64 Linux code
+nativeSupported = sys.platform.startswith("linux") and platform.machine() == "x86_64"
+tierCompilersStarted = 0
+tierTested = False
+allocationCounter = None
+if not recordResults and not updateResults:
+    allocationCounter = buildAllocationCounter()
 
 for root, dirs, files in os.walk(targetDir):
     for file in files:
@@ -104,14 +311,37 @@ for root, dirs, files in os.walk(targetDir):
         print(root + "/" + file)
         simulateTest(root, file)
         compileTest(root, file)      
-    if os.path.exists("out.c"):
-        os.remove("out.c")
-    if os.path.exists("out.obj"):
-        os.remove("out.obj")
+        if os.path.basename(root) == "partial_eval":
+            partialEvalTest(root, file)
+        if nativeSupported and not recordResults and not updateResults:
+            nativeTest(root, file)
+            jitTest(root, file)
+        if os.path.basename(root) == "tier" and not recordResults and not updateResults:
+            tierTest(root, file)
+            tierTested = True
+            allocationTest(root, file)
     if os.path.exists("out.exe"):
         os.remove("out.exe")  
 
 if not recordResults and not updateResults:
+    # 'betsy run' refuses images that would take the stack of the simulator out of its bounds
+    imageTest("stack_overflow", [(OPCODE_PUSH, 1), (OPCODE_JUMP, 0), (OPCODE_HALT, 0)], 0, 1, True)
+    imageTest("stack_underflow", [(OPCODE_STORE, 0)] * 3 + [(OPCODE_HALT, 0)], 1, 1, True)
+    imageTest("stack_too_large", [(OPCODE_PUSH, 7), (OPCODE_PRINT, 0), (OPCODE_HALT, 0)], 0, 0x7fffffff, True)
+    imageTest("valid", [(OPCODE_PUSH, 7), (OPCODE_PRINT, 0), (OPCODE_HALT, 0)], 0, 1, False, [b"7"])
+    # The longest tier program runs long enough for the tier to start the compiler during it
+    if tierTested and sys.platform.startswith("linux") and tierCompilersStarted == 0:
+        testsFailed = testsFailed + 1
+        print("[FAILED] The tier never started a compiler.")
+
+    # Deeper than the parser and the lowering could recurse on the stack of the machine
+    depth = 100000
+    deepTest("deep_plus", "var x int 1\nprint " + "+ " * depth + "x " * (depth + 1) + "\n", [str(depth + 1).encode()], b"Expression is")
+    deepTest("deep_do", "var x int 0\n" + "do " * depth + "set x + x 1 print x " + "end " * depth + "\n", [b"1"], b"Statements are")
+    deepTest("deep_if", "var x int 0\n" + "if > 5 x do " * depth + "set x + x 1 print x " + "end " * depth + "\n", [b"1"], b"Statements are")
+    if allocationCounter is not None:
+        os.remove(allocationCounter)
+
     print("")
     if testsFailed > 0:
         print( f"{testsFailed} tests failed.")
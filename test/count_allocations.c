@@ -0,0 +1,129 @@
+// Counts every allocation of the thread that runs a program, including the ones of the C library
+// that never reach 'sim_allocate'. test.py builds it as a shared library and preloads it into
+// 'betsy sim --count-allocations'; betsy calls 'sim_allocation_hook' when the program starts and
+// stops running. Linux only.
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+static _Thread_local bool counting = false;
+static _Thread_local long count = 0;
+
+// dlsym allocates the first time it is called, before the real allocator is known.
+static char bootstrap[4096];
+static size_t bootstrap_used = 0;
+static bool resolving = false;
+
+static void *bootstrap_allocate(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (bootstrap_used + size > sizeof(bootstrap))
+        return NULL;
+    bootstrap_used += size;
+    return bootstrap + bootstrap_used - size;
+}
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_reallocarray)(void *, size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+static void *(*real_valloc)(size_t);
+static void (*real_free)(void *);
+
+static void resolve(void)
+{
+    if (real_free != NULL || resolving)
+        return;
+    resolving = true;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_reallocarray = dlsym(RTLD_NEXT, "reallocarray");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_valloc = dlsym(RTLD_NEXT, "valloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    resolving = false;
+}
+
+static void counted(void)
+{
+    resolve();
+    if (counting)
+        count++;
+}
+
+void sim_allocation_hook(bool running)
+{
+    if (!running)
+        fprintf(stderr, "Allocations of the running thread: %ld\n", count);
+    count = 0;
+    counting = running;
+}
+
+void *malloc(size_t size)
+{
+    counted();
+    if (real_malloc == NULL)
+        return bootstrap_allocate(size);
+    return real_malloc(size);
+}
+
+void *calloc(size_t number, size_t size)
+{
+    counted();
+    // The bootstrap memory is zero, it is never handed out twice.
+    if (real_calloc == NULL)
+        return bootstrap_allocate(number * size);
+    return real_calloc(number, size);
+}
+
+void *realloc(void *memory, size_t size)
+{
+    counted();
+    return real_realloc(memory, size);
+}
+
+void *reallocarray(void *memory, size_t number, size_t size)
+{
+    counted();
+    return real_reallocarray(memory, number, size);
+}
+
+int posix_memalign(void **memory, size_t alignment, size_t size)
+{
+    counted();
+    return real_posix_memalign(memory, alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    counted();
+    return real_aligned_alloc(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    counted();
+    return real_memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+    counted();
+    return real_valloc(size);
+}
+
+void free(void *memory)
+{
+    if ((char *)memory >= bootstrap && (char *)memory < bootstrap + sizeof(bootstrap))
+        return;
+    resolve();
+    real_free(memory);
+}
@@ -0,0 +1,15 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+int main(int argc, char *argv[])
+{
+    puts("0");
+    puts("1");
+    puts("3");
+    puts("6");
+    puts("10");
+    puts("1");
+    return 0;
+}
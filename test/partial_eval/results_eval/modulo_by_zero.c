@@ -0,0 +1,15 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+int main(int argc, char *argv[])
+{
+    uint64_t v5 = 0u;
+    uint64_t v6 = 3u;
+    puts("7");
+    uint64_t v14 = 10 % v5;
+    printf("%d\n", (int32_t)v14);
+    printf("%d\n", (int32_t)8);
+    return 0;
+}
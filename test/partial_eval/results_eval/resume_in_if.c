@@ -0,0 +1,34 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+int main(int argc, char *argv[])
+{
+    uint64_t v3 = 3u;
+    uint64_t v4 = 3u;
+    uint64_t v8 = 3u;
+    uint64_t v25 = 0;
+    uint64_t v15 = 0;
+    uint64_t v16 = 0;
+    puts("1");
+    puts("2");
+    puts("3");
+    if (v3 > 2)
+    {
+        v15 = v3;
+        v16 = 0;
+        for (; 500 > v16; v16 = v16 + 1)
+        {
+            v15 = 2 + v15;
+        }
+        printf("%d\n", (int32_t)v15);
+        v25 = v15;
+    }
+    else
+    {
+        v25 = v3;
+    }
+    printf("%d\n", (int32_t)(v25 + 1));
+    return 0;
+}
@@ -0,0 +1,18 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+int main(int argc, char *argv[])
+{
+    uint64_t v5 = 0u;
+    uint64_t v6 = 0u;
+    puts("5");
+    for (; 1000 > v6; v6 = v6 + 1)
+    {
+        v5 = v5 + (v6 % 7);
+    }
+    printf("%d\n", (int32_t)v5);
+    printf("%d\n", (int32_t)v6);
+    return 0;
+}